@@ -64,6 +64,7 @@
 
 #include "3DPro.h"
 #include "ffb.h"
+#include "recovery.h"
 #include <string.h>
 
 //------------------------------------------------------------------------------
@@ -165,8 +166,22 @@ uint8_t
     sw_report[SW_REPSZ_3DP + ADDED_REPORT_DATA_SIZE] ;			// USB report data
 
 static uint8_t
-    sw_buttons,					// button buffer
-    sw_problem ;				// problem counter
+    sw_buttons ;				// button buffer
+
+sw_stats_t
+    sw_stats ;					// read errors and recoveries
+
+#if FFP_ASYNC_QUERY
+
+static volatile uint8_t
+    sw_pktsz,					// no. of triplets startdata() waits for
+    sw_pktdone ;				// set by TIMER0_OVF_vect, SW_PKT_...
+
+#define	SW_PKT_BUSY	0			/* transfer going on */
+#define	SW_PKT_OK	1			/* all triplets received */
+#define	SW_PKT_TIMEOUT	2			/* transfer ended early */
+
+#endif
 
 //------------------------------------------------------------------------------
 //******************************************************************************
@@ -247,17 +262,29 @@ static void FA_NOINLINE( Flash_LED_12MS ) ( void )
 
 //------------------------------------------------------------------------------
 
-// Reboot converter. Kill USB and wait for the watchdog to catch us.
-// Note: the watchdog is unleashed in main() after init_hw() returns.
+// Check what answered the last QueryFFP( 0, 126 ) and select the driver.
+// Returns the SW_ID_... of the stick or 0 if it was not a valid packet.
 
-static void FA_NORETURN( reboot ) ( void )
+static uint8_t FA_NOINLINE( findstick ) ( void )
 {
-    cli() ;					// Disable interrupts
+    if ( ! ~sw_clkcnt )
+	sw_clkcnt = 0 ;
 
-    USBCON = _B0(USBE) | _B1(FRZCLK) ;		// Kill USB
+    if ( sw_clkcnt == (DATSZFFP+1) &&
+	CheckFFPPkt( ffp_packet, DATSZFFP ) )
+	{
+	    FfbSetDriver(0);
+	    return ( SW_ID_FFP ) ;
+	}
 
-    for ( ;; )					// Wait for watchdog to bite (.5s)
-	;
+    if ( sw_clkcnt == (DATSZFFPW+1) &&
+	CheckFFPPkt( ffp_packet, DATSZFFPW ) )
+	{
+	    FfbSetDriver(1);
+	    return ( SW_ID_FFPW ) ;
+	}
+
+    return ( 0 ) ;
 }
 
 //------------------------------------------------------------------------------
@@ -296,25 +323,9 @@ void FA_NAKED( init_hw ) ( void )
 
 		// Analyze clock count
 
-		if ( ! ~sw_clkcnt )
-		    sw_clkcnt = 0 ;
-
-		if ( sw_clkcnt == (DATSZFFP+1) &&
-			CheckFFPPkt( ffp_packet, DATSZFFP ) )
-			{
-				sw_id = SW_ID_FFP ;
-				FfbSetDriver(0);
-				break;
-			}
-
-		if ( sw_clkcnt == (DATSZFFPW+1) &&
-			CheckFFPPkt( ffp_packet, DATSZFFPW ) )
-			{
-				sw_id = SW_ID_FFPW ;
-				FfbSetDriver(1);
-				break;
-			}
-			
+		if ( (sw_id = findstick()) )
+			break;
+
 		dis3DP_INT() ;
 	    }
 
@@ -329,39 +340,143 @@ void FA_NAKED( init_hw ) ( void )
 
 //------------------------------------------------------------------------------
 
-// Read the stick and create a report
+// Recover from a read error in the tier recovery.c picks for it
+
+static uint8_t FA_NOINLINE( recover ) ( void )
+	{
+	uint8_t tier = RecoveryReadError() ;
+
+	if ( tier == RECOVERY_RETRY )
+		return ( SW_READ_RETRY ) ;
+
+	QueryFFP( 0, 126 ) ;			// Flush, don't know how long - let it time out
+	dis3DP_INT() ;
+
+	if ( tier == RECOVERY_RESYNC )
+		{
+		sw_stats.resyncs++ ;
+		return ( SW_READ_FAILED ) ;
+		}
+
+	if ( findstick() != sw_id )		// Nobody home, try again later
+		return ( SW_READ_FAILED ) ;
+
+	sw_stats.reinits++ ;
+
+	RecoveryReinit() ;				// Stick lost its setup and effects, FfbMidiTask() restores them
+
+	return ( SW_READ_FAILED ) ;
+	}
+
+//------------------------------------------------------------------------------
+
+// Check the result of a query and copy a good packet into sw_report.
+// Returns SW_READ_...
+
+static uint8_t FA_NOINLINE( gotdata ) ( uint8_t ok, uint8_t pkt_size )
+	{
+	sw_stats.reads++ ;
+
+    if ( ! ok )					// If query timed out,
+	    {
+		sw_stats.timeouts++ ;
+		return ( recover() ) ;
+    	}
+
+	if ( ! CheckFFPPkt( ffp_packet, pkt_size ) )	// Bad PP/FFP packet
+		{
+		sw_stats.badpkts++ ;
+		return ( recover() ) ;
+		}
+
+	if ( RecoveryReadOk() )		// Ended a run of read errors
+		sw_stats.recovered++ ;
+
+	// LED_on() ;			// Signal good packet read
+
+	if ( sw_id == SW_ID_FFPW )
+		memcpy(sw_report, ffp_packet, 6);		// Copy data into report
+	else
+		CopyFFPData( ffp_packet ) ;		// Copy data into report
+
+	return ( SW_READ_OK ) ;
+	}
+
+//------------------------------------------------------------------------------
+
+// Read the stick and create a report. Returns SW_READ_...
 
-void getdata ( void )
+uint8_t getdata ( void )
 	{
     uint8_t
 	pkt_size, i ;
 
 	pkt_size = (sw_id == SW_ID_FFPW ? DATSZFFPW : DATSZFFP);
-	
-	i = QueryFFP( 0, pkt_size ) ;		// Query FFP
 
-    dis3DP_INT() ;
+	do
+		{
+		i = QueryFFP( 0, pkt_size ) ;		// Query FFP
 
-    if ( ! i )					// If query timed out,
-	    {
-		if ( ++sw_problem > 10 )		// 11th problem in a row
-	    	reboot() ;				// We lost the stick, lets start over
-    	}
-    else
-    	{
-		sw_problem = 0 ;			// Reset problem counter
-
-		if ( CheckFFPPkt( ffp_packet, pkt_size ) )	// If PP/FFP packet ok
-			{
-	    	// LED_on() ;			// Signal good packet read
-
-			if ( sw_id == SW_ID_FFPW )
-				memcpy(sw_report, ffp_packet, 6);		// Copy data into report
-			else
-				CopyFFPData( ffp_packet ) ;		// Copy data into report
-			}
-			
+		dis3DP_INT() ;
+
+		i = gotdata( i, pkt_size ) ;
 		}
+	while ( i == SW_READ_RETRY ) ;
+
+	return ( i ) ;
+	}
+
+#if FFP_ASYNC_QUERY
+
+//------------------------------------------------------------------------------
+
+// Trigger the stick and return while the packet arrives in the background.
+// T0 must run with prescaler /64.
+
+void startdata ( void )
+	{
+	sw_pktsz = (sw_id == SW_ID_FFPW ? DATSZFFPW : DATSZFFP);
+	sw_pktdone = SW_PKT_BUSY ;
+
+	StartFFP() ;
 	}
 
 //------------------------------------------------------------------------------
+
+// Returns SW_READ_BUSY while the packet started by startdata() is still
+// coming, else copies it into sw_report if it is good and returns SW_READ_...
+
+uint8_t dataready ( void )
+	{
+	uint8_t
+	done = sw_pktdone ;
+
+	if ( done == SW_PKT_BUSY )
+		return ( SW_READ_BUSY ) ;
+
+	return ( gotdata( done == SW_PKT_OK, sw_pktsz ) ) ;
+	}
+
+//------------------------------------------------------------------------------
+
+// T0 overflows 100us after the last clock from the stick (INT0 resets it) or
+// 400us after the trigger if the stick does not answer. Either way the
+// transfer is over.
+
+ISR( TIMER0_OVF_vect )
+	{
+	uint8_t
+	cnt = sw_clkcnt ;
+
+	dis3DP_INT() ;
+	clr_bit( TIMSK0, TOIE0 ) ;
+
+	if ( ! ~cnt )				// Swallowed INT only
+		cnt = 0 ;
+
+	sw_pktdone = (cnt >= sw_pktsz) ? SW_PKT_OK : SW_PKT_TIMEOUT ;
+	}
+
+#endif
+
+//------------------------------------------------------------------------------
@@ -161,6 +161,14 @@
 
 //-------------------------------------------------------------------------------
 
+// Read the stick in the background instead of waiting for the packet in getdata()
+
+#ifndef FFP_ASYNC_QUERY
+#define	FFP_ASYNC_QUERY	1
+#endif
+
+//-------------------------------------------------------------------------------
+
 #define	SW_REPSZ_3DP	7			/* report size for 3DP */
 #define	SW_REPSZ_FFP	6			/* report size for PP/FFP */
 
@@ -171,6 +179,11 @@
 #define	SW_ID_FFP	3			/* FFP connected */
 #define SW_ID_FFPW	4			/* FFP Wheel connected */
 
+#define	SW_READ_BUSY	0			/* packet still coming */
+#define	SW_READ_OK	1			/* sw_report updated */
+#define	SW_READ_RETRY	2			/* read error, read again now */
+#define	SW_READ_FAILED	3			/* read error, read again later */
+
 //-------------------------------------------------------------------------------
 // Inline code
 
@@ -203,10 +216,34 @@ extern uint8_t
     sw_report[SW_REPSZ_3DP + ADDED_REPORT_DATA_SIZE],		// Report buffer
     sw_reportsz ;			// Size of report in bytes
 
+typedef struct
+    {
+    uint16_t
+	reads,				// packets asked for, for the error rate
+	timeouts,			// no (complete) packet from the stick
+	badpkts,			// packets w/ parity errors
+	resyncs,			// flushed the stick's output
+	reinits,			// set up the stick again
+	recovered ;			// good packets after errors
+    } sw_stats_t ;
+
+extern sw_stats_t
+    sw_stats ;				// Read errors and recoveries
+
 extern void
-    init_hw( void ),			// Initialize HW & wait for stick
+    init_hw( void ) ;			// Initialize HW & wait for stick
+
+extern uint8_t
     getdata( void ) ;			// Read stick and set up sw_report
 
+#if FFP_ASYNC_QUERY
+extern void
+    startdata( void ) ;			// Trigger stick, packet arrives w/ interrupts
+
+extern uint8_t
+    dataready( void ) ;			// SW_READ_..., sw_report set up if packet ok
+#endif
+
 //-------------------------------------------------------------------------------
 // 3DProasm.S interface
 
@@ -231,6 +268,9 @@ extern uint8_t
     QueryFFP( uint8_t id, uint8_t sz ),	// Read data from PP/FFP
     Query3DP( uint8_t id, uint8_t sz ) ;// Read data from 3DPro
 
+extern void
+    StartFFP( void ) ;			// Trigger PP/FFP, don't wait for data
+
 //-------------------------------------------------------------------------------
 
 #else // __ASSEMBLER__
@@ -42,6 +42,25 @@
 #include "Descriptors.h"
 #include "3DPro.h"
 #include "debug.h"
+#include "latency.h"
+
+#if LATENCY_PROBES
+// Latency histograms (TLatencyReport) as a vendor defined feature report
+#define LATENCY_REPORT_DESCRIPTOR \
+	0x06,0x00,0xFF,	/* USAGE_PAGE (Vendor Defined Page 1) */ \
+	0x09,0x01,	/* USAGE (Vendor Usage 1) */ \
+	0xA1,0x02,	/* COLLECTION (Logical) */ \
+		0x85,LATENCY_REPORT_ID,	/* REPORT_ID */ \
+		0x09,0x01,	/* USAGE (Vendor Usage 1) */ \
+		0x15,0x00,	/* LOGICAL_MINIMUM (00) */ \
+		0x26,0xFF,0x00,	/* LOGICAL_MAXIMUM (00 FF) */ \
+		0x75,0x08,	/* REPORT_SIZE (08) */ \
+		0x95,3 + LATENCY_BINS,	/* REPORT_COUNT (type, stage, shift, bins) */ \
+		0xB1,0x02,	/* FEATURE (Data,Var,Abs) */ \
+	0xC0,	/* END COLLECTION () */
+#else
+#define LATENCY_REPORT_DESCRIPTOR
+#endif
 
 /** HID class report descriptor. This is a special descriptor constructed with values from the
  *  USBIF HID class specification to describe the reports and capabilities of the HID device. This
@@ -798,6 +817,7 @@ const USB_Descriptor_HIDReport_Datatype_t PROGMEM JoystickReport[] =
 		0x95,0x01,	// REPORT_COUNT (01)
 		0xB1,0x03,	// FEATURE ( Cnst,Var,Abs)
 	0xC0,	// END COLLECTION ()
+	LATENCY_REPORT_DESCRIPTOR
 0xC0,	// END COLLECTION ()
 };
 
@@ -1480,6 +1500,7 @@ const USB_Descriptor_HIDReport_Datatype_t PROGMEM WheelReport[] =
 		0x95,0x01,	// REPORT_COUNT (01)
 		0xB1,0x03,	// FEATURE ( Cnst,Var,Abs)
 	0xC0,	// END COLLECTION ()
+	LATENCY_REPORT_DESCRIPTOR
 0xC0,	// END COLLECTION ()
 };
 
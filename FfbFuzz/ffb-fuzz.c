@@ -0,0 +1,270 @@
+/*
+  Force Feedback Joystick
+  Fuzz target of the USB reports taken by the force feedback core.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+
+
+// Usage: ffb-fuzz [-n count] [-s seed] [file...]
+//
+// Each input powers up the adapter and the emulated joystick and goes to
+// the core as a series of records:
+//
+//	<kind> <length> <length bytes>
+//
+// where kind modulo 3 is
+//	0	an output report to FfbOnUsbData() as from FFB_Task() of main.c
+//	1	a feature report to SET_REPORT as in main.c, the report id being
+//		its first byte, and to FfbOnCreateNewEffect() for report 5
+//	2	kind / 3 milliseconds of the main loop
+// and the first byte of the input picks the driver (see FfbSetDriver()).
+//
+// "make fuzz" builds it for libFuzzer with clang. The main() here runs the
+// files given, or <count> random inputs (default 10000), with the address
+// and undefined behaviour sanitizers. An error stops the program.
+
+#include "ffb.h"
+#include "debug.h"
+#include "hal.h"
+#include "ffp-emu.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static TFfpEmu gEmu;
+
+static void UartToEmulator(void* context, uint8_t data, uint32_t timeUs)
+	{
+	FfpEmuReceive(&gEmu, data);
+	}
+
+// Powers up the adapter and a joystick with no effects
+static void PowerUp(uint8_t driver)
+	{
+	HalLinuxSetInterrupts(0);
+	HalLinuxReset();
+	FfpEmuInit(&gEmu);
+	HalLinuxSetUartSink(UartToEmulator, NULL);
+	FfbSetDriver(driver);
+	FfbInitMidi();
+	FfbReinitJoystick();
+	FfbWaitMidiSent();
+	HalLinuxSetInterrupts(1);
+	}
+
+static void RunMs(uint32_t ms)
+	{
+	while (ms--)
+		{
+		HalLinuxAdvance(1000);
+		FfbMidiTask();
+		FlushDebugBuffer();
+		}
+	}
+
+// The output report in a buffer of its own length so that the sanitizer
+// sees any read past it
+static void OutputReport(const uint8_t* report, uint8_t len)
+	{
+	uint8_t* data = malloc(len ? len : 1);
+	memcpy(data, report, len);
+	FfbOnUsbData(data, len);
+	free(data);
+	FfbMidiTask();
+	}
+
+// As HID_REQ_SetReport in main.c
+static void SetReport(const uint8_t* report, uint8_t len)
+	{
+	uint8_t data[FFB_FEATURE_REPORT_MAX];
+	if (len > sizeof(data))
+		return;	// stalled
+
+	memset(data, 0, sizeof(data));
+	memcpy(data, report, len);
+	if (len > 0 && report[0] == 5)
+		{
+		USB_FFBReport_PIDBlockLoad_Feature_Data_t pidBlockLoadData;
+		FfbOnCreateNewEffect((USB_FFBReport_CreateNewEffect_Feature_Data_t*) data, &pidBlockLoadData);
+		if (pidBlockLoadData.loadStatus < 1 || pidBlockLoadData.loadStatus > 3
+			|| (pidBlockLoadData.loadStatus == 1) != (pidBlockLoadData.effectBlockIndex != 0))
+			{
+			fprintf(stderr, "Create New Effect: id %u with load status %u\n",
+				pidBlockLoadData.effectBlockIndex, pidBlockLoadData.loadStatus);
+			abort();
+			}
+		}
+	}
+
+// The effect counts by type are those of the copy of the joystick's effects
+static void CheckDeviceEffects(void)
+	{
+	for (uint8_t type = 1; type < MIDI_EFFECT_TYPES; type++)
+		{
+		uint8_t count = 0;
+		for (uint8_t did = 2; did <= MAX_DEVICE_EFFECTS; did++)
+			count += GetDeviceMidiEffectType(did) == type;
+		if (GetDeviceMidiEffectCount(type) != count)
+			{
+			fprintf(stderr, "%u effects of type %u counted, %u in the joystick\n",
+				GetDeviceMidiEffectCount(type), type, count);
+			abort();
+			}
+		}
+	}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+	{
+	if (size == 0)
+		return 0;
+
+	gDebugMode = DEBUG_TO_NONE;
+	PowerUp(data[0] & 1);
+	data++;
+	size--;
+
+	while (size >= 2)
+		{
+		uint8_t kind = data[0];
+		uint8_t len = data[1];
+		data += 2;
+		size -= 2;
+		if (len > size)
+			len = size;
+
+		switch (kind % 3)
+			{
+			case 0: OutputReport(data, len); break;
+			case 1: SetReport(data, len); break;
+			default: RunMs(kind / 3); break;
+			}
+		data += len;
+		size -= len;
+		}
+
+	RunMs(100);
+	CheckDeviceEffects();
+	return 0;
+	}
+
+#ifndef FFB_LIBFUZZER
+
+static uint32_t gRandom;
+
+static uint32_t Random(uint32_t n)
+	{
+	gRandom ^= gRandom << 13;
+	gRandom ^= gRandom >> 17;
+	gRandom ^= gRandom << 5;
+	return gRandom % n;
+	}
+
+// Records mostly of the right kind of report ids and lengths, and the
+// effect ids the adapter hands out, to get past the validation
+static size_t RandomInput(uint8_t* input, size_t size)
+	{
+	size_t used = 0;
+	input[used++] = Random(2);
+	while (used + 2 + 32 <= size && Random(64) != 0)
+		{
+		uint8_t kind = Random(3);
+		uint8_t len = Random(4) ? Random(20) : Random(256);
+		if (len > 32)
+			len = 32;
+		if (kind == 2)
+			kind += 3 * Random(20);
+
+		input[used++] = kind;
+		input[used++] = len;
+		for (uint8_t i = 0; i < len; i++)
+			input[used + i] = Random(256);
+		if (len > 0)
+			input[used] = (kind == 1) ? 5 : 1 + Random(16);
+		if (len > 1 && Random(4))
+			input[used + 1] = Random(4) ? 2 + Random(8) : 0xFF;
+		if (kind == 1 && len > 1)
+			input[used + 1] = Random(14);
+		used += len;
+		}
+	return used;
+	}
+
+static int RunFile(const char* name)
+	{
+	FILE* f = fopen(name, "rb");
+	if (!f)
+		{
+		perror(name);
+		return 1;
+		}
+
+	static uint8_t input[1 << 16];
+	size_t size = fread(input, 1, sizeof(input), f);
+	fclose(f);
+	LLVMFuzzerTestOneInput(input, size);
+	return 0;
+	}
+
+int main(int argc, char* argv[])
+	{
+	uint32_t count = 10000;
+	int opt;
+
+	gRandom = 1;
+	while ((opt = getopt(argc, argv, "n:s:")) != -1)
+		{
+		switch (opt)
+			{
+			case 'n': count = strtoul(optarg, NULL, 0); break;
+			case 's': gRandom = strtoul(optarg, NULL, 0); break;
+			default:
+				fprintf(stderr, "usage: %s [-n count] [-s seed] [file...]\n", argv[0]);
+				return 2;
+			}
+		}
+	if (gRandom == 0)
+		gRandom = 1;
+
+	if (optind < argc)
+		{
+		int errors = 0;
+		for (int i = optind; i < argc; i++)
+			errors += RunFile(argv[i]);
+		return errors ? 1 : 0;
+		}
+
+	static uint8_t input[4096];
+	for (uint32_t i = 0; i < count; i++)
+		LLVMFuzzerTestOneInput(input, RandomInput(input, sizeof(input)));
+
+	printf("%u inputs ok\n", count);
+	return 0;
+	}
+
+#endif // FFB_LIBFUZZER
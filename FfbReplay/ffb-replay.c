@@ -0,0 +1,507 @@
+/*
+  Force Feedback Joystick
+  Replays a capture of the host's force feedback traffic through a native
+  build of the force feedback core and reports what it cost.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+// Usage: ffb-replay [-s speed] [-p] [-w] [-v] [-o capture_file] [-t trace_file] [file]
+//
+// The capture (see capture.h) is either a capture file or the text of a
+// CaptureDump() from the virtual serial port, where the "Cap:" lines are
+// picked up and anything else is ignored.
+//
+// The reports go to FfbOnUsbData() and FfbOnCreateNewEffect() at their
+// captured times in virtual time, divided by <speed> (default 1). Speed 0
+// sends each report as soon as the previous one has been handled. The main
+// loop runs FfbMidiTask() every millisecond between the reports. The MIDI
+// goes out through the virtual UART of hal-linux.c to the Force Feedback
+// Pro emulator.
+//
+// The table at the end gives per report the CPU time of the call, the
+// virtual time it blocked the main loop and the MIDI bytes it queued, from
+// the TRACE_MIDI records, not those the UART sent meanwhile.
+//
+//	-p	polled MIDI as before interrupts are enabled, instead of buffered
+//	-w	the wheel driver instead of the Force Feedback Pro
+//	-v	debug log to stderr
+//	-o	also save the capture as a capture file
+//	-t	save the binary trace (see trace.h) as the firmware would send it,
+//		drained every millisecond and as the MIDI goes out, for decoding
+//		with ffb-trace
+//
+// The exit status is 1 if the emulated joystick saw protocol errors.
+
+#include "capture.h"
+#include "trace.h"
+#include "ffb.h"
+#include "debug.h"
+#include "hal.h"
+#include "ffp-emu.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct
+	{
+	TCaptureRecord	header;
+	uint32_t		timeMs;		// from the start of the capture
+	uint8_t			data[255];
+	} TRecord;
+
+static TRecord* gRecords = NULL;
+static uint32_t gRecordCount = 0;
+
+static void AddRecord(const TCaptureRecord* header, const uint8_t* data)
+	{
+	gRecords = realloc(gRecords, (gRecordCount + 1) * sizeof(TRecord));
+	if (!gRecords)
+		{
+		perror("realloc");
+		exit(2);
+		}
+
+	TRecord* record = &gRecords[gRecordCount];
+	record->header = *header;
+	memcpy(record->data, data, header->len);
+
+	// Unwrap the 16-bit time stamps
+	if (gRecordCount == 0)
+		record->timeMs = 0;
+	else
+		{
+		const TRecord* prev = &gRecords[gRecordCount - 1];
+		record->timeMs = prev->timeMs + (uint16_t) (header->timeMs - prev->header.timeMs);
+		}
+
+	gRecordCount++;
+	}
+
+static void ReadBinary(FILE* f)
+	{
+	uint8_t version;
+	TCaptureRecord header;
+	uint8_t data[255];
+
+	if (fread(&version, 1, 1, f) != 1 || version != CAPTURE_FILE_VERSION)
+		{
+		fprintf(stderr, "unsupported capture version\n");
+		exit(2);
+		}
+
+	while (fread(&header, sizeof(header), 1, f) == 1)
+		{
+		if (fread(data, 1, header.len, f) != header.len)
+			{
+			fprintf(stderr, "truncated capture\n");
+			exit(2);
+			}
+		AddRecord(&header, data);
+		}
+	}
+
+static void ReadDump(FILE* f)
+	{
+	char line[1024];
+	uint32_t lineNumber = 0;
+
+	while (fgets(line, sizeof(line), f))
+		{
+		lineNumber++;
+		char* p = strstr(line, "Cap:");
+		if (!p)
+			continue;
+		p += 4;
+
+		uint8_t bytes[sizeof(TCaptureRecord) + 255];
+		uint16_t count = 0;
+		for (;;)
+			{
+			char* end;
+			unsigned long value = strtoul(p, &end, 16);
+			if (end == p)
+				break;
+			if (value > 0xff || count >= sizeof(bytes))
+				{
+				fprintf(stderr, "line %u: bad record\n", lineNumber);
+				exit(2);
+				}
+			bytes[count++] = value;
+			p = end;
+			}
+
+		TCaptureRecord header;
+		if (count < sizeof(header))
+			{
+			fprintf(stderr, "line %u: short record\n", lineNumber);
+			exit(2);
+			}
+		memcpy(&header, bytes, sizeof(header));
+		if (count != sizeof(header) + header.len)
+			{
+			fprintf(stderr, "line %u: record length %u does not match its data\n", lineNumber, header.len);
+			exit(2);
+			}
+		AddRecord(&header, bytes + sizeof(header));
+		}
+	}
+
+static void ReadCapture(FILE* f)
+	{
+	char magic[4];
+
+	if (fread(magic, 1, sizeof(magic), f) == sizeof(magic) && memcmp(magic, CAPTURE_FILE_MAGIC, sizeof(magic)) == 0)
+		ReadBinary(f);
+	else
+		{
+		rewind(f);
+		ReadDump(f);
+		}
+	}
+
+static void WriteCapture(const char* fileName)
+	{
+	FILE* f = fopen(fileName, "wb");
+	if (!f)
+		{
+		perror(fileName);
+		exit(2);
+		}
+
+	uint8_t version = CAPTURE_FILE_VERSION;
+	fwrite(CAPTURE_FILE_MAGIC, 1, 4, f);
+	fwrite(&version, 1, 1, f);
+	for (uint32_t i = 0; i < gRecordCount; i++)
+		{
+		fwrite(&gRecords[i].header, sizeof(TCaptureRecord), 1, f);
+		fwrite(gRecords[i].data, 1, gRecords[i].header.len, f);
+		}
+
+	if (fclose(f) != 0)
+		{
+		perror(fileName);
+		exit(2);
+		}
+	}
+
+// ---- Replay
+
+// Statistics per output report id, with the feature requests after them
+#define STAT_CREATE_EFFECT	(OUT_REPORT_COUNT + 1)
+#define STAT_PID_POOL		(OUT_REPORT_COUNT + 2)
+#define STAT_COUNT			(OUT_REPORT_COUNT + 3)
+
+static const char* gStatNames[STAT_COUNT] =
+	{
+	"Other",
+	"Set Effect", "Set Envelope", "Set Condition", "Set Periodic",
+	"Set Constant Force", "Set Ramp Force", "Set Custom Force Data",
+	"Download Force Sample", "Report 9", "Effect Operation", "Block Free",
+	"Device Control", "Device Gain", "Set Custom Force", "Report 15",
+	"Create New Effect", "PID Pool",
+	};
+
+typedef struct
+	{
+	uint32_t	count;
+	uint64_t	cpuNs;
+	uint64_t	cpuMaxNs;
+	uint64_t	blockedUs;		// virtual time spent in the call
+	uint32_t	blockedMaxUs;
+	uint64_t	midiBytes;		// queued by the report, wherever they went out
+	} TReportStats;
+
+static TReportStats gStats[STAT_COUNT];
+
+static TFfpEmu gEmu;
+
+static void DrainTrace(void);
+
+static void UartToEmulator(void* context, uint8_t data, uint32_t timeUs)
+	{
+	FfpEmuReceive(&gEmu, data);
+	DrainTrace();	// keeps the ring from filling up while a report waits for room
+	}
+
+static uint64_t NowNs(void)
+	{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+
+static uint8_t gPeakQueue = 0;
+
+static void SampleQueue(void)
+	{
+	uint8_t used = FfbMidiBufferUsed();
+	if (used > gPeakQueue)
+		gPeakQueue = used;
+	}
+
+static FILE* gTraceFile = NULL;
+static uint32_t gMidiQueued = 0;		// bytes of the TRACE_MIDI records so far
+static uint32_t gTraceDropped = 0;
+
+// Counts the MIDI queued from the new trace records and sends them in the
+// chunks of Trace_Task() in main.c
+static void DrainTrace(void)
+	{
+	uint8_t chunk[15];
+	uint8_t len;
+
+	while ((len = TraceRead(&chunk[2], sizeof(chunk) - 2)) > 0)
+		{
+		for (uint8_t i = 2; i < len + 2; i += TRACE_RECORD_LEN(chunk[i]))
+			{
+			const uint8_t* payload = &chunk[i + 3];
+			if (TRACE_EVENT(chunk[i]) == TRACE_MIDI)
+				gMidiQueued += payload[2];
+			else if (TRACE_EVENT(chunk[i]) == TRACE_DROPPED)
+				gTraceDropped += payload[0] | (payload[1] << 8);
+			}
+
+		if (gTraceFile)
+			{
+			chunk[0] = TRACE_CHUNK_MARKER;
+			chunk[1] = len;
+			fwrite(chunk, 1, len + 2, gTraceFile);
+			}
+		}
+	}
+
+// Runs the main loop until <timeUs>
+static void RunUntil(uint32_t timeUs)
+	{
+	while (HalLinuxMicros() < timeUs)
+		{
+		uint32_t step = timeUs - HalLinuxMicros();
+		HalLinuxAdvance(step < 1000 ? step : 1000);
+		FfbMidiTask();
+		SampleQueue();
+		DrainTrace();
+		}
+	}
+
+static uint32_t gIdMismatches = 0;
+
+static void Replay(const TRecord* record)
+	{
+	uint8_t stat = 0;
+	DrainTrace();
+	uint32_t queuedBefore = gMidiQueued;
+	uint32_t startUs = HalLinuxMicros();
+	uint64_t startNs = NowNs();
+
+	switch (record->header.type)
+		{
+		case CAPTURE_OUT_REPORT:
+			{
+			uint8_t report[255];
+			memcpy(report, record->data, record->header.len);
+			FfbOnUsbData(report, record->header.len);
+			if (record->header.len && report[0] >= 1 && report[0] <= OUT_REPORT_COUNT)
+				stat = report[0];
+			break;
+			}
+
+		case CAPTURE_CREATE_EFFECT:
+			{
+			USB_FFBReport_CreateNewEffect_Feature_Data_t request;
+			USB_FFBReport_PIDBlockLoad_Feature_Data_t response, captured;
+			if (record->header.len != sizeof(request) + sizeof(response))
+				break;
+			memcpy(&request, record->data, sizeof(request));
+			memcpy(&captured, record->data + sizeof(request), sizeof(captured));
+			FfbOnCreateNewEffect(&request, &response);
+			if (response.effectBlockIndex != captured.effectBlockIndex || response.loadStatus != captured.loadStatus)
+				gIdMismatches++;
+			stat = STAT_CREATE_EFFECT;
+			break;
+			}
+
+		case CAPTURE_PID_POOL:
+			{
+			USB_FFBReport_PIDPool_Feature_Data_t pool;
+			FfbOnPIDPool(&pool);
+			stat = STAT_PID_POOL;
+			break;
+			}
+		}
+
+	FfbMidiTask();
+	DrainTrace();
+
+	uint64_t ns = NowNs() - startNs;
+	uint32_t blockedUs = HalLinuxMicros() - startUs;
+	TReportStats* s = &gStats[stat];
+	s->count++;
+	s->cpuNs += ns;
+	if (ns > s->cpuMaxNs)
+		s->cpuMaxNs = ns;
+	s->blockedUs += blockedUs;
+	if (blockedUs > s->blockedMaxUs)
+		s->blockedMaxUs = blockedUs;
+	s->midiBytes += gMidiQueued - queuedBefore;
+
+	SampleQueue();
+	}
+
+static void PrintResults(double speed, uint32_t startUs, uint32_t startBytes, uint32_t startErrors)
+	{
+	uint32_t counts[4] = { 0 };
+	for (uint32_t i = 0; i < gRecordCount; i++)
+		if (gRecords[i].header.type < 4)
+			counts[gRecords[i].header.type]++;
+
+	printf("capture: records=%u, out reports=%u, create new effect=%u, pid pool=%u, span=%u ms\n",
+		gRecordCount, counts[CAPTURE_OUT_REPORT], counts[CAPTURE_CREATE_EFFECT], counts[CAPTURE_PID_POOL],
+		gRecordCount ? gRecords[gRecordCount - 1].timeMs : 0);
+	printf("replay: speed=%g, time=%u ms, midi bytes=%u, peak queue=%u bytes\n",
+		speed, (HalLinuxMicros() - startUs) / 1000, HalLinuxGetStats()->uartBytes - startBytes, gPeakQueue);
+	if (gTraceDropped)
+		printf("  %u trace records dropped, the midi queued below is short\n", gTraceDropped);
+	printf("midi buffers: high water=%u/%u/%u/%u, overflows=%u/%u/%u/%u (control/operation/modify/download)\n",
+		gMidiBufferStats[MIDI_PRIO_CONTROL].highWater, gMidiBufferStats[MIDI_PRIO_OPERATION].highWater,
+		gMidiBufferStats[MIDI_PRIO_MODIFY].highWater, gMidiBufferStats[MIDI_PRIO_DOWNLOAD].highWater,
+		gMidiBufferStats[MIDI_PRIO_CONTROL].overflows, gMidiBufferStats[MIDI_PRIO_OPERATION].overflows,
+		gMidiBufferStats[MIDI_PRIO_MODIFY].overflows, gMidiBufferStats[MIDI_PRIO_DOWNLOAD].overflows);
+	printf("rejected reports: unknown=%u, truncated=%u, bad effect=%u; create new effect responses differing from the capture=%u\n",
+		gFfbReportRejects.unknownId, gFfbReportRejects.truncated, gFfbReportRejects.badEffect, gIdMismatches);
+	printf("joystick: effects=%u, protocol errors=%u\n",
+		FfpEmuEffectCount(&gEmu), FfpEmuErrors(&gEmu) - startErrors);
+	if (FfpEmuErrors(&gEmu) != startErrors)
+		{
+		const TFfpEmuStats* e = &gEmu.stats;
+		printf("  checksum=%u, bad sysex=%u, stray=%u, unknown status=%u, bad id=%u, bad address=%u, orphan modify=%u, memory full=%u (since power up)\n",
+			e->checksumErrors, e->badSysEx, e->strayBytes, e->unknownStatus,
+			e->badEffectIds, e->badAddresses, e->orphanModifies, e->memFull);
+		}
+
+	printf("\n%-22s %6s %12s %12s %14s %14s %10s\n",
+		"report", "count", "cpu avg ns", "cpu max ns", "blocked avg us", "blocked max us", "midi queued");
+	for (uint8_t i = 0; i < STAT_COUNT; i++)
+		{
+		const TReportStats* s = &gStats[i];
+		if (s->count == 0)
+			continue;
+		printf("%-22s %6u %12llu %12llu %14llu %14u %10llu\n",
+			gStatNames[i], s->count,
+			(unsigned long long) (s->cpuNs / s->count), (unsigned long long) s->cpuMaxNs,
+			(unsigned long long) (s->blockedUs / s->count), s->blockedMaxUs,
+			(unsigned long long) s->midiBytes);
+		}
+	}
+
+int main(int argc, char* argv[])
+	{
+	double speed = 1;
+	int polled = 0, wheel = 0, verbose = 0;
+	const char* saveFile = NULL;
+	const char* traceFile = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:pwvo:t:")) != -1)
+		{
+		switch (opt)
+			{
+			case 's': speed = strtod(optarg, NULL); break;
+			case 'p': polled = 1; break;
+			case 'w': wheel = 1; break;
+			case 'v': verbose = 1; break;
+			case 'o': saveFile = optarg; break;
+			case 't': traceFile = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-s speed] [-p] [-w] [-v] [-o capture_file] [-t trace_file] [file]\n", argv[0]);
+				return 2;
+			}
+		}
+
+	FILE* f = stdin;
+	if (optind < argc)
+		{
+		f = fopen(argv[optind], "rb");
+		if (!f)
+			{
+			perror(argv[optind]);
+			return 2;
+			}
+		}
+	ReadCapture(f);
+	if (saveFile)
+		WriteCapture(saveFile);
+	if (traceFile)
+		{
+		gTraceFile = fopen(traceFile, "wb");
+		if (!gTraceFile)
+			{
+			perror(traceFile);
+			return 2;
+			}
+		}
+
+	// Power up as the firmware does, with the interrupts enabled after the
+	// joystick start-up sequence
+	gDebugMode = verbose ? DEBUG_TO_USB : DEBUG_TO_NONE;
+	FfpEmuInit(&gEmu);
+	HalLinuxSetUartSink(UartToEmulator, NULL);
+	FfbSetDriver(wheel ? 1 : 0);
+	FfbInitMidi();
+	FfbWaitMidiSent();
+	HalLinuxSetInterrupts(!polled);
+	FlushDebugBuffer();
+
+	uint32_t startUs = HalLinuxMicros();
+	uint32_t startBytes = HalLinuxGetStats()->uartBytes;
+	uint32_t startErrors = FfpEmuErrors(&gEmu);
+	memset((void*) gMidiBufferStats, 0, sizeof(gMidiBufferStats));
+	TraceStart();	// the MIDI each report queued is counted from the trace
+
+	for (uint32_t i = 0; i < gRecordCount; i++)
+		{
+		if (speed > 0)
+			RunUntil(startUs + (uint32_t) (gRecords[i].timeMs * 1000.0 / speed));
+		Replay(&gRecords[i]);
+		FlushDebugBuffer();
+		DrainTrace();
+		}
+
+	// Let the rest of the MIDI out
+	do
+		RunUntil(HalLinuxMicros() + 10000);
+	while (FfbMidiBufferUsed());
+	FfbWaitMidiSent();
+	FlushDebugBuffer();
+	DrainTrace();
+	if (gTraceFile)
+		fclose(gTraceFile);
+
+	PrintResults(speed, startUs, startBytes, startErrors);
+
+	return (FfpEmuErrors(&gEmu) != startErrors) ? 1 : 0;
+	}
@@ -0,0 +1,293 @@
+/*
+  Force Feedback Joystick
+  Streams commands to the adapter over the virtual serial port as binary
+  frames.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+
+// Usage: ffb-send [-n repeat] [-o file] [file|device]
+//        ffb-send -d [file]
+//
+// A script is text with one command per line, '#' starts a comment:
+//	[+<ms>] <command> [<hex bytes>]
+// where <command> is one of the command letters of main.c and the bytes
+// are its data, e.g. "u 0D FF" for a Device Gain report. The commands are
+// sent as frames (see frame.h), as many as there are before the next
+// "+<ms>" delay in one write, so that they share USB packets.
+//
+//	-n	send the script <repeat> times, e.g. for stress tests
+//	-o	write the frames to <file> instead of a device
+//	-d	decode a file of frames back into script lines
+//
+// The script is read from stdin. The frame and byte counts and the rate
+// they went out at are written to stderr.
+
+#include "frame.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct
+	{
+	uint32_t	delayMs;	// before this command
+	uint8_t		len;		// of the frame
+	uint8_t		frame[FRAME_DATA_MAX + FRAME_OVERHEAD];
+	} TCommand;
+
+static TCommand* gCommands = NULL;
+static uint32_t gCommandCount = 0;
+
+static void AddCommand(const TCommand* command)
+	{
+	gCommands = realloc(gCommands, (gCommandCount + 1) * sizeof(TCommand));
+	if (!gCommands)
+		{
+		perror("realloc");
+		exit(2);
+		}
+	gCommands[gCommandCount++] = *command;
+	}
+
+static void ReadScript(FILE* f)
+	{
+	char line[1024];
+	uint32_t lineNumber = 0;
+
+	while (fgets(line, sizeof(line), f))
+		{
+		lineNumber++;
+		char* comment = strchr(line, '#');
+		if (comment)
+			*comment = 0;
+
+		char* p = line;
+		while (isspace((unsigned char) *p))
+			p++;
+		if (!*p)
+			continue;
+
+		TCommand command = { 0 };
+		char* end;
+		if (*p == '+')
+			{
+			command.delayMs = strtoul(p + 1, &end, 10);
+			if (end == p + 1)
+				{
+				fprintf(stderr, "line %u: expected delay\n", lineNumber);
+				exit(2);
+				}
+			p = end;
+			while (isspace((unsigned char) *p))
+				p++;
+			}
+
+		if (!isalpha((unsigned char) *p) || (p[1] && !isspace((unsigned char) p[1])))
+			{
+			fprintf(stderr, "line %u: expected command letter\n", lineNumber);
+			exit(2);
+			}
+		uint8_t letter = *p++;
+
+		uint8_t data[FRAME_DATA_MAX];
+		uint8_t len = 0;
+		for (;;)
+			{
+			unsigned long value = strtoul(p, &end, 16);
+			if (end == p)
+				break;
+			if (value > 0xff || len == FRAME_DATA_MAX)
+				{
+				fprintf(stderr, "line %u: bad byte or more than %u\n", lineNumber, FRAME_DATA_MAX);
+				exit(2);
+				}
+			data[len++] = value;
+			p = end;
+			}
+		while (isspace((unsigned char) *p))
+			p++;
+		if (*p)
+			{
+			fprintf(stderr, "line %u: unexpected '%s'\n", lineNumber, p);
+			exit(2);
+			}
+
+		command.len = FrameEncode(command.frame, letter, data, len);
+		AddCommand(&command);
+		}
+	}
+
+static int Decode(FILE* f)
+	{
+	TFrameParser parser;
+	FrameInit(&parser);
+
+	int c;
+	uint32_t stray = 0;
+	while ((c = getc(f)) != EOF)
+		{
+		if (!FrameBusy(&parser) && c != FRAME_START)
+			{
+			stray++;
+			continue;
+			}
+		if (FrameParse(&parser, c) != FRAME_DONE)
+			continue;
+
+		printf("%c", parser.command);
+		for (uint8_t i = 0; i + 1 < parser.len; i++)
+			printf(" %02X", parser.data[i]);
+		printf("\n");
+		}
+
+	fprintf(stderr, "frames=%u, crc errors=%u, too long=%u, empty=%u, stray bytes=%u\n",
+		parser.stats.ok, parser.stats.crcErrors, parser.stats.tooLong, parser.stats.empty, stray);
+	return (parser.stats.crcErrors || parser.stats.tooLong || parser.stats.empty || stray) ? 1 : 0;
+	}
+
+static uint64_t NowUs(void)
+	{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+	}
+
+static void WriteAll(int fd, const uint8_t* data, size_t len)
+	{
+	while (len > 0)
+		{
+		ssize_t n = write(fd, data, len);
+		if (n < 0)
+			{
+			perror("write");
+			exit(2);
+			}
+		data += n;
+		len -= n;
+		}
+	}
+
+int main(int argc, char* argv[])
+	{
+	uint32_t repeat = 1;
+	const char* outFile = NULL;
+	int decode = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:o:d")) != -1)
+		{
+		switch (opt)
+			{
+			case 'n': repeat = strtoul(optarg, NULL, 0); break;
+			case 'o': outFile = optarg; break;
+			case 'd': decode = 1; break;
+			default:
+				fprintf(stderr, "usage: %s [-n repeat] [-o file] [file|device]\n"
+					"       %s -d [file]\n", argv[0], argv[0]);
+				return 2;
+			}
+		}
+
+	if (decode)
+		{
+		FILE* f = stdin;
+		if (optind < argc && !(f = fopen(argv[optind], "rb")))
+			{
+			perror(argv[optind]);
+			return 2;
+			}
+		return Decode(f);
+		}
+
+	const char* target = outFile;
+	if (!target && optind < argc)
+		target = argv[optind];
+	if (!target)
+		{
+		fprintf(stderr, "%s: no device or -o file given\n", argv[0]);
+		return 2;
+		}
+
+	ReadScript(stdin);
+
+	int fd = outFile ? open(outFile, O_WRONLY | O_CREAT | O_TRUNC, 0644) : open(target, O_WRONLY | O_NOCTTY);
+	if (fd < 0)
+		{
+		perror(target);
+		return 2;
+		}
+	if (isatty(fd))
+		{
+		struct termios raw;
+		if (tcgetattr(fd, &raw) == 0)
+			{
+			cfmakeraw(&raw);
+			tcsetattr(fd, TCSANOW, &raw);
+			}
+		}
+
+	// Batches of the frames between the delays
+	uint8_t batch[4096];
+	size_t batchLen = 0;
+	uint64_t frames = 0, bytes = 0;
+	uint64_t startUs = NowUs();
+
+	for (uint32_t r = 0; r < repeat; r++)
+		{
+		for (uint32_t i = 0; i < gCommandCount; i++)
+			{
+			TCommand* command = &gCommands[i];
+			if ((command->delayMs && batchLen) || batchLen + command->len > sizeof(batch))
+				{
+				WriteAll(fd, batch, batchLen);
+				batchLen = 0;
+				}
+			if (command->delayMs && !outFile)
+				usleep(command->delayMs * 1000);
+
+			memcpy(&batch[batchLen], command->frame, command->len);
+			batchLen += command->len;
+			frames++;
+			bytes += command->len;
+			}
+		}
+	WriteAll(fd, batch, batchLen);
+	if (isatty(fd))
+		tcdrain(fd);
+	close(fd);
+
+	double seconds = (NowUs() - startUs) / 1e6;
+	fprintf(stderr, "frames=%llu, bytes=%llu in %.3f s", (unsigned long long) frames, (unsigned long long) bytes, seconds);
+	if (seconds > 0)
+		fprintf(stderr, " (%.0f frames/s, %.0f bytes/s)", frames / seconds, bytes / seconds);
+	fprintf(stderr, "\n");
+
+	return 0;
+	}
@@ -0,0 +1,281 @@
+/*
+  Force Feedback Joystick
+  Records the telemetry frames of the firmware from the virtual serial port
+  or a file as CSV.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+
+
+// Usage: ffb-telemetry [-p period_ms] [-n frames] [-l] [file|device]
+//
+// Reads the virtual serial port (e.g. /dev/ttyACM1) or a file saved from
+// it, or stdin, and writes one CSV line per telemetry frame (see
+// telemetry.h) to stdout:
+//	ms,x,y,z,rz,rx,ry,rudder,throttle,buttons,hat,trim1,trim2,pedal1,pedal2,playing,gain,midi_queued
+// <ms> counts from the first frame, <playing> lists the ids of the effects
+// being played separated by spaces. The text log and the trace chunks in
+// between are skipped.
+//
+//	-p	subscribe with the 'v' command first and unsubscribe at the end
+//	-n	stop after this many frames
+//	-l	pass the text log through to stderr
+//
+// Reading a device goes on until interrupted. The frame counts and the
+// longest gap between frames are written to stderr at the end.
+
+#include "telemetry.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Clock of the frames, extended past the 16 bits of the firmware
+static uint32_t gMs = 0;
+static uint16_t gLastTime;
+static uint16_t gMaxGap = 0;
+
+static uint32_t gFrames = 0;
+static uint32_t gBadFrames = 0;
+
+static uint16_t Get16(const uint8_t** p)
+	{
+	uint16_t value = (*p)[0] | ((*p)[1] << 8);
+	*p += 2;
+	return value;
+	}
+
+static uint8_t Get8(const uint8_t** p)
+	{
+	return *(*p)++;
+	}
+
+// <data> is the frame after the marker and the length
+static void DecodeFrame(const uint8_t* data, uint8_t len)
+	{
+	if (len != TELEMETRY_FRAME_SIZE - 2)
+		{
+		gBadFrames++;
+		return;
+		}
+
+	const uint8_t* p = data;
+	uint16_t time = Get16(&p);
+	if (gFrames > 0)
+		{
+		uint16_t gap = time - gLastTime;
+		gMs += gap;
+		if (gap > gMaxGap)
+			gMaxGap = gap;
+		}
+	gLastTime = time;
+	gFrames++;
+
+	int16_t x = Get16(&p);
+	int16_t y = Get16(&p);
+	int16_t z = Get16(&p);
+	int8_t rz = Get8(&p);
+	int8_t rx = Get8(&p);
+	int8_t ry = Get8(&p);
+	uint8_t rudder = Get8(&p);
+	uint8_t throttle = Get8(&p);
+	uint16_t buttons = Get16(&p);
+	uint8_t hat = Get8(&p);
+	printf("%u,%d,%d,%d,%d,%d,%d,%u,%u,0x%04X,%u", gMs, x, y, z, rz, rx, ry,
+		rudder, throttle, buttons, hat);
+
+	for (uint8_t i = 0; i < 4; i++)
+		printf(",%u", Get16(&p));
+
+	uint32_t playing = p[0] | (p[1] << 8) | ((uint32_t) p[2] << 16);
+	p += 3;
+	printf(",");
+	const char* separator = "";
+	for (uint8_t id = 1; id <= 24; id++)
+		{
+		if (playing & (1UL << (id - 1)))
+			{
+			printf("%s%u", separator, id);
+			separator = " ";
+			}
+		}
+
+	uint8_t gain = Get8(&p);
+	uint8_t midiQueued = Get8(&p);
+	printf(",%u,%u\n", gain, midiQueued);
+	}
+
+static volatile sig_atomic_t gStop = 0;
+
+static void OnSignal(int sig)
+	{
+	gStop = 1;
+	}
+
+static int SendCommand(int fd, const char* command)
+	{
+	size_t len = strlen(command);
+	return write(fd, command, len) == (ssize_t) len;
+	}
+
+int main(int argc, char* argv[])
+	{
+	long period = -1;
+	uint32_t maxFrames = 0;
+	int log = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:n:l")) != -1)
+		{
+		switch (opt)
+			{
+			case 'p': period = strtol(optarg, NULL, 0); break;
+			case 'n': maxFrames = strtoul(optarg, NULL, 0); break;
+			case 'l': log = 1; break;
+			default:
+				fprintf(stderr, "usage: %s [-p period_ms] [-n frames] [-l] [file|device]\n", argv[0]);
+				return 2;
+			}
+		}
+
+	if (period == 0 || period > 0xFFFF)
+		{
+		fprintf(stderr, "period must be 1..65535 ms\n");
+		return 2;
+		}
+
+	int subscribe = period > 0;
+	int fd = STDIN_FILENO;
+	if (optind < argc)
+		{
+		fd = open(argv[optind], subscribe ? O_RDWR | O_NOCTTY : O_RDONLY);
+		if (fd < 0)
+			{
+			perror(argv[optind]);
+			return 2;
+			}
+		}
+
+	struct termios saved;
+	int tty = isatty(fd) && tcgetattr(fd, &saved) == 0;
+	if (tty)
+		{
+		struct termios raw = saved;
+		cfmakeraw(&raw);
+		tcsetattr(fd, TCSANOW, &raw);
+		}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = OnSignal;	// no SA_RESTART, read() returns on ^C
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if (subscribe)
+		{
+		char command[16];
+		snprintf(command, sizeof(command), "v02%02X%02X",
+			(unsigned) (period & 0xFF), (unsigned) (period >> 8));
+		if (!SendCommand(fd, command))
+			{
+			perror("subscribe");
+			return 2;
+			}
+		}
+
+	printf("ms,x,y,z,rz,rx,ry,rudder,throttle,buttons,hat,trim1,trim2,pedal1,pedal2,playing,gain,midi_queued\n");
+
+	// Parser of the frames and the trace chunks between the text
+	uint8_t frame[256];
+	int marker = -1;	// of the frame or chunk being read, -1 in the text
+	int frameLen = -1;	// -1 until the length byte has been read
+	int framePos = 0;
+
+	uint8_t buffer[4096];
+	ssize_t n;
+	while (!gStop && (n = read(fd, buffer, sizeof(buffer))) != 0)
+		{
+		if (n < 0)
+			{
+			if (errno == EINTR)
+				continue;
+			perror("read");
+			break;
+			}
+
+		for (ssize_t i = 0; i < n && !gStop; i++)
+			{
+			uint8_t c = buffer[i];
+
+			if (marker < 0)
+				{
+				if (c == TELEMETRY_MARKER || c == TRACE_CHUNK_MARKER)
+					{
+					marker = c;
+					frameLen = -1;
+					framePos = 0;
+					}
+				else if (log && c != '\r')
+					fputc(c, stderr);
+				continue;
+				}
+
+			if (frameLen < 0)
+				{
+				frameLen = c;
+				if (frameLen == 0)
+					marker = -1;
+				continue;
+				}
+
+			frame[framePos++] = c;
+			if (framePos == frameLen)
+				{
+				if (marker == TELEMETRY_MARKER)
+					{
+					DecodeFrame(frame, frameLen);
+					if (maxFrames && gFrames >= maxFrames)
+						gStop = 1;
+					}
+				marker = -1;
+				}
+			}
+		fflush(stdout);
+		}
+
+	if (subscribe)
+		SendCommand(fd, "v0100");
+	if (tty)
+		tcsetattr(fd, TCSANOW, &saved);
+
+	fprintf(stderr, "frames=%u, bad frames=%u, max gap ms=%u\n", gFrames, gBadFrames, gMaxGap);
+
+	return gBadFrames ? 1 : 0;
+	}
@@ -0,0 +1,714 @@
+/*
+  Force Feedback Joystick
+  Regression tests of the force feedback core running against the Force
+  Feedback Pro emulator.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+
+
+// Usage: ffb-test [-v] [-s seed] [test]
+//
+// Runs the tests, or the one named, each from a powered up adapter and
+// joystick. The reports go to the core as from the FFB_Task() of main.c
+// and the MIDI to the emulator through the virtual UART of hal-linux.c.
+// A failed check is written to stderr. The exit status is 1 if any failed.
+//
+//	-v	debug log to stderr
+//	-s	seed of the random tests (default 1)
+
+#include "ffb.h"
+#include "recovery.h"
+#include "debug.h"
+#include "hal.h"
+#include "ffp-emu.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static TFfpEmu gEmu;
+static uint32_t gEmuStartErrors;	// the byte written to start the UART at power up is stray
+static uint32_t gChecks = 0, gFailures = 0;
+static const char* gTestName;
+static uint32_t gSeed = 1;
+
+#define CHECK(cond, ...) \
+	do { \
+		gChecks++; \
+		if (!(cond)) \
+			{ \
+			gFailures++; \
+			fprintf(stderr, "%s: %s:%d: ", gTestName, __FILE__, __LINE__); \
+			fprintf(stderr, __VA_ARGS__); \
+			fprintf(stderr, "\n"); \
+			} \
+	} while (0)
+
+// The effect data the joystick had when the watched effect started
+static const TFfpEmuEffect* EmuEffect(uint16_t durationMs);
+static uint16_t gWatchDuration;
+static uint8_t gWatchStarted;
+static uint8_t gWatchData[FFP_EMU_MAX_DATA];
+
+static void UartToEmulator(void* context, uint8_t data, uint32_t timeUs)
+	{
+	FfpEmuReceive(&gEmu, data);
+
+	const TFfpEmuEffect* effect = gWatchDuration ? EmuEffect(gWatchDuration) : NULL;
+	if (effect && effect->playing && !gWatchStarted)
+		{
+		memcpy(gWatchData, effect->data, sizeof(gWatchData));
+		gWatchStarted = 1;
+		}
+	}
+
+// Powers up the adapter and the joystick as the firmware does, with the
+// interrupts enabled after the joystick start-up sequence
+static void PowerUp(void)
+	{
+	HalLinuxSetInterrupts(0);
+	HalLinuxReset();
+	FfpEmuInit(&gEmu);
+	HalLinuxSetUartSink(UartToEmulator, NULL);
+	FfbSetDriver(0);
+	FfbInitMidi();
+	FfbWaitMidiSent();
+	HalLinuxSetInterrupts(1);
+	gWatchDuration = 0;
+	gWatchStarted = 0;
+	FlushDebugBuffer();
+	gEmuStartErrors = FfpEmuErrors(&gEmu);
+	}
+
+// Protocol errors the joystick has seen since power up
+static uint32_t EmuErrors(void)
+	{
+	return FfpEmuErrors(&gEmu) - gEmuStartErrors;
+	}
+
+// Runs the main loop for <ms> milliseconds
+static void RunMs(uint32_t ms)
+	{
+	while (ms--)
+		{
+		HalLinuxAdvance(1000);
+		FfbMidiTask();
+		FlushDebugBuffer();
+		}
+	}
+
+// Runs the main loop until all MIDI has reached the joystick
+static void RunUntilSent(void)
+	{
+	do
+		RunMs(10);
+	while (FfbMidiBufferUsed());
+	FfbWaitMidiSent();
+	RunMs(1);
+	}
+
+// ---- Reports from the host
+
+static void SendReport(uint8_t* data, uint16_t len)
+	{
+	CHECK(FfbOnUsbData(data, len), "report %u rejected", data[0]);
+	FfbMidiTask();
+	FlushDebugBuffer();
+	}
+
+static uint8_t CreateEffect(uint8_t type)
+	{
+	USB_FFBReport_CreateNewEffect_Feature_Data_t request = { 1, type, 0 };
+	USB_FFBReport_PIDBlockLoad_Feature_Data_t response;
+	FfbOnCreateNewEffect(&request, &response);
+	FlushDebugBuffer();
+	return (response.loadStatus == 1) ? response.effectBlockIndex : 0;
+	}
+
+static void SetEffect(uint8_t id, uint8_t type, uint16_t durationMs)
+	{
+	USB_FFBReport_SetEffect_Output_Data_t report =
+		{ 1, id, type, durationMs, 0, 0, 0xFF, 0xFF, 0x04, 0x40, 0 };
+	SendReport((uint8_t*) &report, sizeof(report));
+	}
+
+static void SetPeriodic(uint8_t id, uint8_t magnitude, uint16_t periodMs)
+	{
+	USB_FFBReport_SetPeriodic_Output_Data_t report = { 4, id, magnitude, 0, 0, periodMs };
+	SendReport((uint8_t*) &report, sizeof(report));
+	}
+
+static void EffectOperation(uint8_t id, uint8_t operation)
+	{
+	USB_FFBReport_EffectOperation_Output_Data_t report = { 10, id, operation, 1 };
+	SendReport((uint8_t*) &report, sizeof(report));
+	}
+
+static void BlockFree(uint8_t id)
+	{
+	USB_FFBReport_BlockFree_Output_Data_t report = { 11, id };
+	SendReport((uint8_t*) &report, sizeof(report));
+	}
+
+static void DeviceControl(uint8_t control)
+	{
+	USB_FFBReport_DeviceControl_Output_Data_t report = { 12, control };
+	SendReport((uint8_t*) &report, sizeof(report));
+	}
+
+#define START	1
+#define STOP	3
+
+// Creates a sine known to the joystick by its duration (see EmuEffect)
+static uint8_t CreateSine(uint16_t durationMs)
+	{
+	uint8_t id = CreateEffect(USB_EFFECT_SINE);
+	CHECK(id != 0, "no effect id for a sine");
+	SetEffect(id, USB_EFFECT_SINE, durationMs);
+	SetPeriodic(id, 0x80, 100);
+	return id;
+	}
+
+// Creates a spring known to the joystick by its duration
+static uint8_t CreateSpring(uint16_t durationMs)
+	{
+	uint8_t id = CreateEffect(USB_EFFECT_SPRING);
+	CHECK(id != 0, "no effect id for a spring");
+	SetEffect(id, USB_EFFECT_SPRING, durationMs);
+	return id;
+	}
+
+// ---- Joystick
+
+// Returns the joystick's effect with the given duration, NULL if none
+static const TFfpEmuEffect* EmuEffect(uint16_t durationMs)
+	{
+	uint16_t duration = (durationMs == USB_DURATION_INFINITE) ?
+		MIDI_DURATION_INFINITE : UsbUint16ToMidiUint14_Time(durationMs);
+	for (uint8_t slot = FFP_EMU_FIRST_SLOT; slot < FFP_EMU_SLOTS; slot++)
+		{
+		const TFfpEmuEffect* effect = &gEmu.effects[slot];
+		if (effect->used && (effect->data[3] | (effect->data[4] << 8)) == duration)
+			return effect;
+		}
+	return NULL;
+	}
+
+static uint8_t EmuUsedCount(void)
+	{
+	uint8_t count = 0;
+	for (uint8_t slot = FFP_EMU_FIRST_SLOT; slot < FFP_EMU_SLOTS; slot++)
+		count += gEmu.effects[slot].used;
+	return count;
+	}
+
+static uint8_t EmuPlayingCount(void)
+	{
+	uint8_t count = 0;
+	for (uint8_t slot = FFP_EMU_FIRST_SLOT; slot < FFP_EMU_SLOTS; slot++)
+		count += gEmu.effects[slot].used && gEmu.effects[slot].playing;
+	return count;
+	}
+
+// ---- Old effect id allocation
+//
+// GetNextFreeEffect() and FreeEffect() of ffb.c before the free effect
+// bitmap, as the reference for the ids the host sees
+
+static uint8_t gOldUsed[MAX_EFFECTS + 1];
+static uint8_t gOldNextId;
+
+static void OldFreeAll(void)
+	{
+	memset(gOldUsed, 0, sizeof(gOldUsed));
+	gOldNextId = 2;
+	}
+
+static uint8_t OldCreate(void)
+	{
+	if (gOldNextId == MAX_EFFECTS)
+		return 0;
+
+	uint8_t id = gOldNextId++;
+	while (gOldUsed[gOldNextId])
+		{
+		if (gOldNextId >= MAX_EFFECTS)
+			break;
+		gOldNextId++;
+		}
+
+	gOldUsed[id] = 1;
+	return id;
+	}
+
+static void OldFree(uint8_t id)
+	{
+	gOldUsed[id] = 0;
+	if (id < gOldNextId)
+		gOldNextId = id;
+	}
+
+// ---- Random
+
+static uint32_t gRandom;
+
+static uint32_t Random(uint32_t n)
+	{
+	gRandom ^= gRandom << 13;
+	gRandom ^= gRandom >> 17;
+	gRandom ^= gRandom << 5;
+	return gRandom % n;
+	}
+
+// ---- Tests
+
+// The joystick gives a download the lowest free effect id at the time it
+// gets there. A free made to make room must not overtake a download
+// queued before it, or the two disagree on the ids from then on.
+static void TestFreeKeepsOrderWithDownloads(void)
+	{
+	PowerUp();
+
+	// Nine stopped sines in the joystick, one short of full
+	uint16_t durations[11];
+	uint8_t ids[11];
+	for (uint8_t i = 0; i < 11; i++)
+		{
+		durations[i] = 20000 + i * 256;
+		ids[i] = CreateSine(durations[i]);
+		}
+	for (uint8_t i = 0; i < 9; i++)
+		{
+		EffectOperation(ids[i], START);
+		RunUntilSent();
+		EffectOperation(ids[i], STOP);
+		RunUntilSent();
+		}
+
+	// The second start evicts while the download of the first is queued
+	EffectOperation(ids[9], START);
+	EffectOperation(ids[10], START);
+	RunUntilSent();
+
+	CHECK(EmuErrors() == 0, "joystick saw %u protocol errors (bad effect ids %u)",
+		EmuErrors(), gEmu.stats.badEffectIds);
+	for (uint8_t i = 9; i < 11; i++)
+		{
+		const TFfpEmuEffect* effect = EmuEffect(durations[i]);
+		CHECK(effect && effect->playing, "effect %u not playing in the joystick", ids[i]);
+		}
+	CHECK(EmuPlayingCount() == 2, "%u effects playing in the joystick instead of 2", EmuPlayingCount());
+	}
+
+// Only effects that are not playing make room in the joystick, however
+// long ago the others were started. With all of them playing, Create New
+// Effect reports the pool full.
+static void TestEvictOnlyStopped(void)
+	{
+	PowerUp();
+
+	// Ten sines fill the joystick
+	uint16_t durations[10];
+	uint8_t ids[10];
+	for (uint8_t i = 0; i < 10; i++)
+		{
+		durations[i] = 20000 + i * 256;
+		ids[i] = CreateSine(durations[i]);
+		EffectOperation(ids[i], START);
+		RunUntilSent();
+		}
+
+	CHECK(CreateEffect(USB_EFFECT_SINE) == 0, "effect created with the joystick full of playing effects");
+	RunUntilSent();
+	for (uint8_t i = 0; i < 10; i++)
+		{
+		const TFfpEmuEffect* effect = EmuEffect(durations[i]);
+		CHECK(effect && effect->playing, "effect %u stopped", ids[i]);
+		}
+
+	// A stopped one gives its room
+	EffectOperation(ids[0], STOP);
+	uint16_t duration = 30000;
+	uint8_t id = CreateSine(duration);
+	EffectOperation(id, START);
+	RunUntilSent();
+
+	const TFfpEmuEffect* effect = EmuEffect(duration);
+	CHECK(effect && effect->playing, "new effect %u not playing", id);
+	CHECK(EmuEffect(durations[0]) == NULL, "stopped effect %u not evicted", ids[0]);
+	for (uint8_t i = 1; i < 10; i++)
+		{
+		effect = EmuEffect(durations[i]);
+		CHECK(effect && effect->playing, "effect %u stopped", ids[i]);
+		}
+	CHECK(EmuErrors() == 0, "joystick saw %u protocol errors", EmuErrors());
+	}
+
+// The joystick holds two springs. A third one makes room by evicting a
+// stopped spring, not the sines that do not count against that limit.
+// With both springs playing there is no room for it, however many
+// stopped sines there are.
+static void TestEvictSameType(void)
+	{
+	PowerUp();
+
+	// Ten stopped sines and two stopped springs, the sines least recently used
+	uint16_t durations[12];
+	uint8_t ids[12];
+	for (uint8_t i = 0; i < 12; i++)
+		{
+		durations[i] = 20000 + i * 256;
+		ids[i] = (i < 10) ? CreateSine(durations[i]) : CreateSpring(durations[i]);
+		EffectOperation(ids[i], START);
+		RunUntilSent();
+		EffectOperation(ids[i], STOP);
+		RunUntilSent();
+		}
+
+	uint32_t evicted = gEffectDownloadStats.evicted;
+	uint16_t duration = 30000;
+	uint8_t id = CreateSpring(duration);
+	EffectOperation(id, START);
+	RunUntilSent();
+
+	const TFfpEmuEffect* effect = EmuEffect(duration);
+	CHECK(effect && effect->playing, "new spring %u not playing", id);
+	CHECK(gEffectDownloadStats.evicted - evicted == 1, "%u effects evicted for one spring",
+		gEffectDownloadStats.evicted - evicted);
+	CHECK(EmuEffect(durations[10]) == NULL, "least recently used spring %u not evicted", ids[10]);
+	for (uint8_t i = 0; i < 10; i++)
+		CHECK(EmuEffect(durations[i]) != NULL, "sine %u evicted for a spring", ids[i]);
+	CHECK(EmuEffect(durations[11]) != NULL, "spring %u evicted", ids[11]);
+
+	// Both springs playing: no room for another
+	EffectOperation(ids[11], START);
+	RunUntilSent();
+	CHECK(CreateEffect(USB_EFFECT_SPRING) == 0, "spring created with both springs playing");
+	CHECK(gEmu.stats.memFull == 0, "joystick out of memory %u times", gEmu.stats.memFull);
+	CHECK(EmuErrors() == 0, "joystick saw %u protocol errors", EmuErrors());
+	}
+
+// A start goes out behind all the modifies of its effect, also those that
+// did not fit into the MIDI buffer yet, so that the effect starts with the
+// latest parameters
+static void TestStartAfterModifies(void)
+	{
+	PowerUp();
+
+	// Two stopped sines in the joystick
+	uint16_t durations[2] = { 20000, 20256 };
+	uint8_t ids[2];
+	for (uint8_t i = 0; i < 2; i++)
+		{
+		ids[i] = CreateSine(durations[i]);
+		EffectOperation(ids[i], START);
+		RunUntilSent();
+		EffectOperation(ids[i], STOP);
+		RunUntilSent();
+		}
+
+	// Modifies of the other one take the MIDI buffer, those of the one
+	// started wait behind them
+	SetPeriodic(ids[1], 0x20, 200);
+	SetPeriodic(ids[0], 0x40, 300);
+	gWatchDuration = durations[0];
+	EffectOperation(ids[0], START);
+	RunUntilSent();
+
+	const TFfpEmuEffect* effect = EmuEffect(durations[0]);
+	CHECK(effect && effect->playing, "effect %u not playing", ids[0]);
+	CHECK(gWatchStarted && effect && memcmp(gWatchData, effect->data, effect->len) == 0,
+		"effect %u started before its modifies", ids[0]);
+	CHECK(EmuErrors() == 0, "joystick saw %u protocol errors", EmuErrors());
+	}
+
+// A Reset goes out ahead of the downloads queued before it. They must not
+// reach the joystick after it, or it keeps effects the adapter has freed
+// and gives the next download an id the adapter does not expect.
+static void TestResetDropsQueued(void)
+	{
+	PowerUp();
+
+	// Started sines with their downloads still queued
+	for (uint8_t i = 0; i < 6; i++)
+		{
+		uint8_t id = CreateSine(20000 + i * 256);
+		EffectOperation(id, START);
+		}
+	CHECK(FfbMidiBufferUsed() > 0, "nothing queued for the reset to overtake");
+
+	DeviceControl(USB_DCTRL_RESET);
+	RunUntilSent();
+	CHECK(EmuUsedCount() == 0, "%u effects left in the joystick after a reset", EmuUsedCount());
+
+	uint16_t duration = 30000;
+	uint8_t id = CreateSine(duration);
+	EffectOperation(id, START);
+	RunUntilSent();
+
+	const TFfpEmuEffect* effect = EmuEffect(duration);
+	CHECK(effect && effect->playing, "effect %u not playing after the reset", id);
+	CHECK(EmuErrors() == 0, "joystick saw %u protocol errors (bad effect ids %u)",
+		EmuErrors(), gEmu.stats.badEffectIds);
+	}
+
+// A Stop All goes out ahead of the starts queued before it, which must not
+// start their effects after it
+static void TestStopAllDropsStarts(void)
+	{
+	PowerUp();
+
+	// One sine in the joystick and one with its download queued, both started
+	uint16_t durations[2] = { 20000, 20256 };
+	uint8_t ids[2];
+	ids[0] = CreateSine(durations[0]);
+	EffectOperation(ids[0], START);
+	RunUntilSent();
+	EffectOperation(ids[0], STOP);
+	RunUntilSent();
+
+	ids[1] = CreateSine(durations[1]);
+	EffectOperation(ids[1], START);
+	EffectOperation(ids[0], START);
+	DeviceControl(USB_DCTRL_STOPALL);
+	RunUntilSent();
+
+	CHECK(EmuPlayingCount() == 0, "%u effects playing after Stop All", EmuPlayingCount());
+	CHECK(EmuEffect(durations[1]) != NULL, "download dropped with the starts");
+	CHECK(EmuErrors() == 0, "joystick saw %u protocol errors", EmuErrors());
+
+	// Both start again as usual
+	for (uint8_t i = 0; i < 2; i++)
+		EffectOperation(ids[i], START);
+	RunUntilSent();
+	CHECK(EmuPlayingCount() == 2, "%u effects playing instead of 2", EmuPlayingCount());
+	}
+
+// Random creates, frees and plays give the host the same effect ids and
+// pool full results as the old allocation did, and the adapter's copy of
+// the joystick's effects stays the same as the joystick's own.
+// Frees go to ids 2..MAX_EFFECTS, used or not: the report handler rejects
+// 0 and the old allocation would have handed out a freed id 1. Free all
+// (0xFF) is left out as the joystick takes no effect id for all of them.
+static void TestAllocFuzz(void)
+	{
+	PowerUp();
+	OldFreeAll();
+	gRandom = gSeed ? gSeed : 1;
+
+	for (uint32_t step = 0; step < 3000 && gFailures == 0; step++)
+		{
+		uint32_t op = Random(100);
+		uint8_t id;
+
+		if (op < 40)
+			{
+			uint8_t type = 1 + Random(11);
+			uint8_t expected = OldCreate();
+			id = CreateEffect(type);
+			CHECK(id == expected, "step %u: created effect %u instead of %u", step, id, expected);
+			if (id)
+				SetEffect(id, type, 1000 + Random(10000));
+			}
+		else if (op < 65)
+			{	// a used id, if any
+			uint8_t used[MAX_EFFECTS], n = 0;
+			for (id = 2; id < MAX_EFFECTS; id++)
+				if (gOldUsed[id])
+					used[n++] = id;
+			if (n == 0)
+				continue;
+			id = used[Random(n)];
+			OldFree(id);
+			BlockFree(id);
+			}
+		else if (op < 75)
+			{
+			id = 2 + Random(MAX_EFFECTS - 1);
+			OldFree(id);
+			BlockFree(id);
+			}
+		else
+			{	// played until sent, which downloads and may evict
+			id = 2 + Random(MAX_EFFECTS - 2);
+			if (!gOldUsed[id])
+				continue;
+			EffectOperation(id, START);
+			RunUntilSent();
+			EffectOperation(id, STOP);
+			}
+		RunUntilSent();
+
+		CHECK(EmuErrors() == 0, "step %u: joystick saw %u protocol errors", step, EmuErrors());
+		for (uint8_t type = 0; type < MIDI_EFFECT_TYPES; type++)
+			{
+			uint8_t mirrored = 0, joystick = 0;
+			for (uint8_t did = 2; did <= MAX_DEVICE_EFFECTS; did++)
+				mirrored += GetDeviceMidiEffectType(did) == type && type != 0;
+			for (uint8_t slot = FFP_EMU_FIRST_SLOT; slot < FFP_EMU_SLOTS; slot++)
+				joystick += gEmu.effects[slot].used && gEmu.effects[slot].data[1] == type;
+			if (type == 0)
+				continue;
+			CHECK(GetDeviceMidiEffectCount(type) == mirrored,
+				"step %u: %u effects of type %u counted, %u in the copy", step, GetDeviceMidiEffectCount(type), type, mirrored);
+			CHECK(joystick == mirrored,
+				"step %u: %u effects of type %u in the joystick, %u in the copy", step, joystick, type, mirrored);
+			}
+		}
+	}
+
+// Read errors of the stick are answered by reading again, then by flushing
+// its output, then by setting it up again. A good read or a set up starts
+// over from reading again.
+static void TestRecoveryTiers(void)
+	{
+	PowerUp();
+
+	for (uint8_t run = 0; run < 2; run++)
+		{
+		for (uint8_t i = 1; i <= SW_RETRIES + SW_RESYNCS + 2; i++)
+			{
+			uint8_t expected = (i <= SW_RETRIES) ? RECOVERY_RETRY :
+				(i <= SW_RETRIES + SW_RESYNCS) ? RECOVERY_RESYNC : RECOVERY_REINIT;
+			uint8_t tier = RecoveryReadError();
+			CHECK(tier == expected, "run %u: read error %u answered by tier %u instead of %u", run, i, tier, expected);
+			}
+		CHECK(RecoveryReadOk(), "run %u: good read did not end the read errors", run);
+		CHECK(!RecoveryReadOk(), "run %u: second good read ended read errors", run);
+		}
+
+	// The stick found again: it is set up and the tiers start over
+	for (uint8_t i = 0; i < SW_RETRIES + SW_RESYNCS + 1; i++)
+		RecoveryReadError();
+	RecoveryReinit();
+	CHECK(FfbReinitPending(), "stick not being set up again");
+	CHECK(RecoveryReadError() == RECOVERY_RETRY, "tiers did not start over after setting the stick up");
+	RecoveryReadOk();
+	RunMs(1000);
+	CHECK(!FfbReinitPending(), "stick still being set up after 1 s");
+	}
+
+// Setting up a joystick that lost its state returns right away and leaves
+// the start-up sequence to the main loop. Afterwards the joystick has the
+// effects of the host again: the endless one that was playing, and the
+// one started meanwhile.
+static void TestReinitRestoresEffects(void)
+	{
+	PowerUp();
+
+	uint16_t durations[2] = { USB_DURATION_INFINITE, 20256 };
+	uint8_t ids[2];
+	for (uint8_t i = 0; i < 2; i++)
+		ids[i] = CreateSine(durations[i]);
+	EffectOperation(ids[0], START);
+	RunUntilSent();
+
+	// The joystick powered off and on
+	FfpEmuInit(&gEmu);
+	gEmuStartErrors = FfpEmuErrors(&gEmu);
+	uint16_t time = HalMillis();
+	RecoveryReinit();
+	CHECK(HalMillis() == time, "setting up the joystick took %u ms of the main loop",
+		(uint16_t) (HalMillis() - time));
+	CHECK(FfbReinitPending(), "joystick not being set up");
+
+	// Host reports meanwhile only change the state to restore
+	EffectOperation(ids[1], START);
+	RunMs(100);
+	CHECK(FfpEmuEffectCount(&gEmu) == 0, "%u effects downloaded before the joystick was set up",
+		FfpEmuEffectCount(&gEmu));
+
+	RunMs(900);
+	RunUntilSent();
+	CHECK(!FfbReinitPending(), "joystick still being set up after 1 s");
+	for (uint8_t i = 0; i < 2; i++)
+		{
+		const TFfpEmuEffect* effect = EmuEffect(durations[i]);
+		CHECK(effect && effect->playing, "effect %u not playing after the set up", ids[i]);
+		}
+	CHECK(EmuErrors() == 0, "joystick saw %u protocol errors", EmuErrors());
+	}
+
+typedef struct
+	{
+	const char*	name;
+	void		(*run)(void);
+	} TTest;
+
+static const TTest gTests[] =
+	{
+	{ "free-order", TestFreeKeepsOrderWithDownloads },
+	{ "evict-stopped", TestEvictOnlyStopped },
+	{ "evict-same-type", TestEvictSameType },
+	{ "start-after-modifies", TestStartAfterModifies },
+	{ "alloc-fuzz", TestAllocFuzz },
+	{ "reset-drops-queued", TestResetDropsQueued },
+	{ "stop-all-drops-starts", TestStopAllDropsStarts },
+	{ "recovery-tiers", TestRecoveryTiers },
+	{ "reinit-restores-effects", TestReinitRestoresEffects },
+	};
+
+int main(int argc, char* argv[])
+	{
+	int verbose = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "vs:")) != -1)
+		{
+		switch (opt)
+			{
+			case 'v': verbose = 1; break;
+			case 's': gSeed = strtoul(optarg, NULL, 0); break;
+			default:
+				fprintf(stderr, "usage: %s [-v] [-s seed] [test]\n", argv[0]);
+				return 2;
+			}
+		}
+
+	gDebugMode = verbose ? DEBUG_TO_USB : DEBUG_TO_NONE;
+
+	uint32_t run = 0;
+	for (uint32_t i = 0; i < sizeof(gTests) / sizeof(gTests[0]); i++)
+		{
+		if (optind < argc && strcmp(argv[optind], gTests[i].name) != 0)
+			continue;
+
+		uint32_t failures = gFailures;
+		gTestName = gTests[i].name;
+		gTests[i].run();
+		printf("%-24s %s\n", gTests[i].name, (gFailures == failures) ? "ok" : "FAILED");
+		run++;
+		}
+
+	if (run == 0)
+		{
+		fprintf(stderr, "no test named %s\n", argv[optind]);
+		return 2;
+		}
+
+	printf("%u tests, %u checks, %u failed\n", run, gChecks, gFailures);
+	return gFailures ? 1 : 0;
+	}
@@ -0,0 +1,357 @@
+/*
+  Force Feedback Joystick
+  Decodes the binary trace of the firmware from the virtual serial port or
+  a file into text.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+
+// Usage: ffb-trace [-s] [-r] [file|device]
+//
+// Reads the virtual serial port (e.g. /dev/ttyACM1) or a file saved from
+// it, or stdin, and writes one line per trace record:
+//	<ms since the first record> <+ms since the previous one> <event> <fields>
+// The lines of the text log in between are passed through as they are,
+// the telemetry frames (see telemetry.h) are skipped.
+//
+//	-s	start tracing with the 'x' command first and stop it at the end
+//	-r	raw: the firmware's clock in microseconds instead of the ms columns
+//
+// Reading a device goes on until interrupted. The record counts and the
+// records dropped by the firmware are written to stderr at the end.
+
+#include "trace.h"
+#include "telemetry.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define REPORT_NAMES	16
+#define EVENT_NAMES		12
+
+static const char* gReportNames[REPORT_NAMES] =
+	{
+	"Report 0",
+	"Set Effect", "Set Envelope", "Set Condition", "Set Periodic",
+	"Set Constant Force", "Set Ramp Force", "Set Custom Force Data",
+	"Download Force Sample", "Report 9", "Effect Operation", "Block Free",
+	"Device Control", "Device Gain", "Set Custom Force", "Create New Effect",
+	};
+
+static const char* gEventNames[EVENT_NAMES] =
+	{
+	"TIME", "DROPPED", "USB_OUT", "USB_REJECT", "CREATE_EFFECT", "MIDI",
+	"MIDI_OVERFLOW", "DEVICE_CONTROL", "DEVICE_GAIN", "REINIT", "DOWNLOAD",
+	"EVICT",
+	};
+
+static const char* gPrioNames[] = { "control", "operation", "modify", "download" };
+
+static const char* gControlNames[] =
+	{
+	"0", "enable actuators", "disable actuators", "stop all", "reset", "pause", "continue",
+	};
+
+static const char* gRejectNames[] = { "0", "unknown id", "truncated", "bad effect id" };
+
+#define NAME(table, i)	(((i) < sizeof(table) / sizeof(table[0])) ? table[i] : "?")
+
+static int gRaw = 0;
+
+// Clock of the records, extended past the 32 bits of the firmware
+static uint64_t gHighUs = 0;
+static uint16_t gHigh = 0;
+static int gHighValid = 0;
+static uint64_t gFirstUs = 0, gPrevUs = 0;
+static int gTimed = 0;
+
+static uint32_t gCounts[32];
+static uint32_t gDropped = 0;
+static uint32_t gBadChunks = 0;
+
+static void PrintTime(uint16_t low)
+	{
+	if (!gHighValid)
+		{
+		printf(gRaw ? "%10s " : "%10s %8s ", "?", "");
+		return;
+		}
+
+	uint64_t us = gHighUs + low;
+	if (gRaw)
+		{
+		printf("%10llu ", (unsigned long long) us);
+		return;
+		}
+
+	if (!gTimed)
+		{
+		gFirstUs = gPrevUs = us;
+		gTimed = 1;
+		}
+	printf("%10.3f %+8.3f ", (us - gFirstUs) / 1000.0, (us - gPrevUs) / 1000.0);
+	gPrevUs = us;
+	}
+
+static void DecodeRecord(const uint8_t* record)
+	{
+	uint8_t event = TRACE_EVENT(record[0]);
+	uint8_t len = TRACE_PAYLOAD_LEN(record[0]);
+	uint16_t low = record[1] | (record[2] << 8);
+	const uint8_t* p = &record[3];
+	uint16_t value = (len >= 2) ? p[0] | (p[1] << 8) : 0;
+
+	gCounts[event]++;
+
+	if (event == TRACE_TIME)
+		{
+		if (gHighValid && value < gHigh)
+			gHighUs += 1ULL << 32;	// the firmware's clock wrapped around
+		gHighUs = (gHighUs & ~0xFFFFFFFFULL) | ((uint64_t) value << 16);
+		gHigh = value;
+		gHighValid = 1;
+		return;	// says nothing else
+		}
+
+	PrintTime(low);
+	if (event < EVENT_NAMES)
+		printf("%-14s", gEventNames[event]);
+	else
+		printf("EVENT_%-8u", event);
+
+	switch (event)
+		{
+		case TRACE_DROPPED:
+			printf(" %u records", value);
+			gDropped += value;
+			break;
+
+		case TRACE_USB_OUT:
+			printf(" %s (%u)", NAME(gReportNames, p[0]), p[0]);
+			if (p[0] == 12)
+				printf(" %s", NAME(gControlNames, p[1]));
+			else if (p[0] == 13)
+				printf(" gain=%u", p[1]);
+			else if (p[0] == 10)
+				printf(" effect=%u operation=%u", p[1], p[2]);
+			else
+				printf(" effect=%u", p[1]);
+			break;
+
+		case TRACE_USB_REJECT:
+			printf(" report=%u %s", p[0], NAME(gRejectNames, p[1]));
+			break;
+
+		case TRACE_CREATE_EFFECT:
+			printf(" type=%u effect=%u %s", p[0], p[1],
+				(p[2] == 1) ? "ok" : (p[2] == 2) ? "full" : "error");
+			break;
+
+		case TRACE_MIDI:
+			printf(" %s effect=%u len=%u", NAME(gPrioNames, p[0]), p[1], p[2]);
+			break;
+
+		case TRACE_MIDI_OVERFLOW:
+			printf(" %s len=%u", NAME(gPrioNames, p[0]), p[1]);
+			break;
+
+		case TRACE_DEVICE_CONTROL:
+			printf(" %s%s", NAME(gControlNames, p[0]), p[1] ? "" : " failed");
+			break;
+
+		case TRACE_DEVICE_GAIN:
+			printf(" %u", p[0]);
+			break;
+
+		case TRACE_DOWNLOAD:
+			printf(" effect=%u device=%u", p[0], p[1]);
+			break;
+
+		case TRACE_EVICT:
+			printf(" device=%u", p[0]);
+			break;
+
+		default:
+			for (uint8_t i = 0; i < len; i++)
+				printf(" %02X", p[i]);
+			break;
+		}
+	printf("\n");
+	}
+
+static void DecodeChunk(const uint8_t* data, uint8_t len)
+	{
+	uint8_t pos = 0;
+
+	while (pos < len)
+		{
+		uint8_t size = TRACE_RECORD_LEN(data[pos]);
+		if (TRACE_PAYLOAD_LEN(data[pos]) > TRACE_PAYLOAD_MAX || pos + size > len)
+			{
+			gBadChunks++;
+			printf("# bad trace chunk\n");
+			return;
+			}
+		DecodeRecord(&data[pos]);
+		pos += size;
+		}
+	}
+
+static volatile sig_atomic_t gStop = 0;
+
+static void OnSignal(int sig)
+	{
+	gStop = 1;
+	}
+
+static int SendCommand(int fd, const char* command)
+	{
+	size_t len = strlen(command);
+	return write(fd, command, len) == (ssize_t) len;
+	}
+
+int main(int argc, char* argv[])
+	{
+	int start = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "sr")) != -1)
+		{
+		switch (opt)
+			{
+			case 's': start = 1; break;
+			case 'r': gRaw = 1; break;
+			default:
+				fprintf(stderr, "usage: %s [-s] [-r] [file|device]\n", argv[0]);
+				return 2;
+			}
+		}
+
+	int fd = STDIN_FILENO;
+	if (optind < argc)
+		{
+		fd = open(argv[optind], start ? O_RDWR | O_NOCTTY : O_RDONLY);
+		if (fd < 0)
+			{
+			perror(argv[optind]);
+			return 2;
+			}
+		}
+
+	struct termios saved;
+	int tty = isatty(fd) && tcgetattr(fd, &saved) == 0;
+	if (tty)
+		{
+		struct termios raw = saved;
+		cfmakeraw(&raw);
+		tcsetattr(fd, TCSANOW, &raw);
+		}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = OnSignal;	// no SA_RESTART, read() returns on ^C
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if (start && !SendCommand(fd, "x0101"))
+		{
+		perror("start");
+		return 2;
+		}
+
+	// Chunk parser
+	uint8_t chunk[256];
+	int chunkLen = -1;	// -1 until the length byte has been read
+	int chunkPos = 0;
+	int inChunk = 0;
+	int isTelemetry = 0;	// the chunk is a telemetry frame
+
+	uint8_t buffer[4096];
+	ssize_t n;
+	while (!gStop && (n = read(fd, buffer, sizeof(buffer))) != 0)
+		{
+		if (n < 0)
+			{
+			if (errno == EINTR)
+				continue;
+			perror("read");
+			break;
+			}
+
+		for (ssize_t i = 0; i < n; i++)
+			{
+			uint8_t c = buffer[i];
+
+			if (!inChunk)
+				{
+				if (c == TRACE_CHUNK_MARKER || c == TELEMETRY_MARKER)
+					{
+					inChunk = 1;
+					isTelemetry = (c == TELEMETRY_MARKER);
+					chunkLen = -1;
+					chunkPos = 0;
+					}
+				else if (c != '\r')
+					putchar(c);
+				continue;
+				}
+
+			if (chunkLen < 0)
+				{
+				chunkLen = c;
+				if (chunkLen == 0)
+					inChunk = 0;
+				continue;
+				}
+
+			chunk[chunkPos++] = c;
+			if (chunkPos == chunkLen)
+				{
+				if (!isTelemetry)
+					DecodeChunk(chunk, chunkLen);
+				inChunk = 0;
+				}
+			}
+		fflush(stdout);
+		}
+
+	if (start)
+		SendCommand(fd, "x0100");
+	if (tty)
+		tcsetattr(fd, TCSANOW, &saved);
+
+	fprintf(stderr, "records:");
+	for (uint8_t e = 0; e < EVENT_NAMES; e++)
+		if (gCounts[e])
+			fprintf(stderr, " %s=%u", gEventNames[e], gCounts[e]);
+	fprintf(stderr, "\ndropped=%u, bad chunks=%u\n", gDropped, gBadChunks);
+
+	return gBadChunks ? 1 : 0;
+	}
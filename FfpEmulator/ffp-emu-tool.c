@@ -0,0 +1,276 @@
+/*
+  Force Feedback Joystick
+  Runs a MIDI scenario through the Force Feedback Pro emulator and writes
+  the resulting force at 1 kHz as CSV.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+// Usage: ffp-emu [-b] [-q] [-t tail_ms] [file]
+//
+// A scenario is text with one event per line, '#' starts a comment:
+//	<ms> <hex bytes>	bytes given to the MIDI output at <ms>
+//	<ms> pos <x> <y>	stick position from <ms> on, -512..511
+// With -b the file is raw MIDI bytes, all given to the output at 0 ms.
+//
+// The bytes go to the emulator at 31250 baud in the order given. The force
+// is written to stdout as "ms,x,y" unless -q is given, and the counters and
+// the latency from each event to its last byte on the wire to stderr. The
+// exit status is 1 if the joystick would have seen any protocol errors.
+
+#include "ffp-emu.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct
+	{
+	uint32_t	timeMs;
+	uint8_t		isPos;
+	int16_t		x, y;
+	uint16_t	len;
+	uint8_t*	data;
+	} TEvent;
+
+static TEvent* gEvents = NULL;
+static uint32_t gEventCount = 0;
+
+static void AddEvent(const TEvent* event)
+	{
+	gEvents = realloc(gEvents, (gEventCount + 1) * sizeof(TEvent));
+	if (!gEvents)
+		{
+		perror("realloc");
+		exit(2);
+		}
+	gEvents[gEventCount++] = *event;
+	}
+
+static void ReadBinary(FILE* f)
+	{
+	TEvent event = { 0 };
+	uint8_t buffer[4096];
+	size_t n;
+
+	while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+		{
+		event.data = realloc(event.data, event.len + n);
+		memcpy(event.data + event.len, buffer, n);
+		event.len += n;
+		}
+	AddEvent(&event);
+	}
+
+static void ReadScenario(FILE* f)
+	{
+	char line[1024];
+	uint32_t lineNumber = 0;
+
+	while (fgets(line, sizeof(line), f))
+		{
+		lineNumber++;
+		char* comment = strchr(line, '#');
+		if (comment)
+			*comment = 0;
+
+		char* p = line;
+		while (isspace((unsigned char) *p))
+			p++;
+		if (!*p)
+			continue;
+
+		TEvent event = { 0 };
+		char* end;
+		event.timeMs = strtoul(p, &end, 10);
+		if (end == p)
+			{
+			fprintf(stderr, "line %u: expected time\n", lineNumber);
+			exit(2);
+			}
+		p = end;
+
+		while (isspace((unsigned char) *p))
+			p++;
+		if (strncmp(p, "pos", 3) == 0)
+			{
+			event.isPos = 1;
+			if (sscanf(p + 3, "%hd %hd", &event.x, &event.y) != 2)
+				{
+				fprintf(stderr, "line %u: expected pos <x> <y>\n", lineNumber);
+				exit(2);
+				}
+			AddEvent(&event);
+			continue;
+			}
+
+		for (;;)
+			{
+			unsigned long value = strtoul(p, &end, 16);
+			if (end == p)
+				break;
+			if (value > 0xff)
+				{
+				fprintf(stderr, "line %u: bad byte\n", lineNumber);
+				exit(2);
+				}
+			event.data = realloc(event.data, event.len + 1);
+			event.data[event.len++] = value;
+			p = end;
+			}
+		while (isspace((unsigned char) *p))
+			p++;
+		if (*p)
+			{
+			fprintf(stderr, "line %u: unexpected '%s'\n", lineNumber, p);
+			exit(2);
+			}
+		AddEvent(&event);
+		}
+	}
+
+static void PrintStats(const TFfpEmu* emu)
+	{
+	const TFfpEmuStats* s = &emu->stats;
+
+	fprintf(stderr, "bytes=%u (download=%u, modify=%u, operation=%u, control=%u)\n",
+		s->bytes, s->downloadBytes, s->modifyBytes, s->operationBytes, s->controlBytes);
+	fprintf(stderr, "downloads=%u, overwrites=%u, other sysex=%u, modifies=%u, device modifies=%u\n",
+		s->downloads, s->overwrites, s->otherSysEx, s->modifies, s->deviceModifies);
+	fprintf(stderr, "starts=%u, stops=%u, frees=%u, controls=%u, effects=%u, max effects=%u\n",
+		s->starts, s->stops, s->frees, s->controls, FfpEmuEffectCount(emu), s->maxUsed);
+	fprintf(stderr, "errors: checksum=%u, bad sysex=%u, stray=%u, unknown status=%u, bad id=%u, bad address=%u, orphan modify=%u, memory full=%u\n",
+		s->checksumErrors, s->badSysEx, s->strayBytes, s->unknownStatus,
+		s->badEffectIds, s->badAddresses, s->orphanModifies, s->memFull);
+	}
+
+int main(int argc, char* argv[])
+	{
+	int binary = 0, quiet = 0;
+	uint32_t tailMs = 1000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "bqt:")) != -1)
+		{
+		switch (opt)
+			{
+			case 'b': binary = 1; break;
+			case 'q': quiet = 1; break;
+			case 't': tailMs = strtoul(optarg, NULL, 0); break;
+			default:
+				fprintf(stderr, "usage: %s [-b] [-q] [-t tail_ms] [file]\n", argv[0]);
+				return 2;
+			}
+		}
+
+	FILE* f = stdin;
+	if (optind < argc)
+		{
+		f = fopen(argv[optind], binary ? "rb" : "r");
+		if (!f)
+			{
+			perror(argv[optind]);
+			return 2;
+			}
+		}
+
+	if (binary)
+		ReadBinary(f);
+	else
+		ReadScenario(f);
+
+	TFfpEmu emu;
+	FfpEmuInit(&emu);
+
+	// Serialize the events onto the wire
+	uint32_t wireUs = 0;		// when the wire is free
+	uint32_t next = 0;			// next event to put on the wire
+	uint32_t byteIndex = 0;		// next byte of it
+	uint32_t byteDoneUs = 0;	// when that byte has been received
+	uint32_t events = 0;
+	uint64_t latencySum = 0;
+	uint32_t latencyMax = 0;
+
+	if (!quiet)
+		printf("ms,x,y\n");
+
+	for (uint32_t ms = 0; ; ms++)
+		{
+		uint32_t nowUs = ms * 1000;
+
+		// Everything that has arrived by now
+		while (next < gEventCount && gEvents[next].timeMs * 1000 <= nowUs)
+			{
+			TEvent* event = &gEvents[next];
+			uint32_t eventUs = event->timeMs * 1000;
+
+			if (event->isPos)
+				{
+				FfpEmuSetPosition(&emu, event->x, event->y);
+				next++;
+				continue;
+				}
+
+			if (byteIndex == 0)
+				byteDoneUs = ((wireUs > eventUs) ? wireUs : eventUs) + FFP_EMU_BYTE_US;
+			if (byteIndex < event->len && byteDoneUs > nowUs)
+				break;	// still on the wire
+
+			if (byteIndex < event->len)
+				{
+				FfpEmuReceive(&emu, event->data[byteIndex++]);
+				wireUs = byteDoneUs;
+				byteDoneUs += FFP_EMU_BYTE_US;
+				if (byteIndex < event->len)
+					continue;
+				}
+
+			if (event->len)
+				{
+				uint32_t latency = wireUs - eventUs;
+				latencySum += latency;
+				if (latency > latencyMax)
+					latencyMax = latency;
+				events++;
+				}
+
+			next++;
+			byteIndex = 0;
+			}
+
+		TFfpEmuForce force;
+		FfpEmuTick(&emu, nowUs, &force);
+		if (!quiet)
+			printf("%u,%d,%d\n", ms, force.x, force.y);
+
+		if (next >= gEventCount && ms >= wireUs / 1000 + tailMs)
+			break;
+		}
+
+	PrintStats(&emu);
+	fprintf(stderr, "events=%u, latency us: avg=%u, max=%u\n",
+		events, events ? (uint32_t) (latencySum / events) : 0, latencyMax);
+
+	return FfpEmuErrors(&emu) ? 1 : 0;
+	}
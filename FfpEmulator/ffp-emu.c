@@ -0,0 +1,712 @@
+/*
+  Force Feedback Joystick
+  Host-side emulator of the Microsoft Sidewinder Force Feedback Pro
+  MIDI interface for testing the force feedback code without a joystick.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#include "ffp-emu.h"
+
+#include <math.h>
+#include <string.h>
+
+// The protocol as sent by ffb-pro.c:
+//
+//	F0 00 01 0A 01 <data> <checksum> F7	download an effect, <data> starts
+//											with 0x23 and byte 2 is 0x7f for a
+//											new effect or the id to overwrite
+//	B5 <op> <id>							10=free, 20=start, 30=stop
+//	B5 <address> <id> A5 <lo> <hi>			modify a parameter
+//	C5 <control>							device control
+//
+// 14-bit values are sent as two 7-bit bytes, low first. The joystick gives
+// a new effect the lowest free id starting from FFP_EMU_FIRST_SLOT.
+
+static const uint8_t gSysExHeader[] = { 0x00, 0x01, 0x0a, 0x01 };
+
+#define WAVE_SINE			0x02
+#define WAVE_COSINE			0x03
+#define WAVE_SQUARE			0x05
+#define WAVE_RAMPUP			0x06
+#define WAVE_RAMPDOWN		0x07
+#define WAVE_TRIANGLE		0x08
+#define WAVE_SAWTOOTHDOWN	0x0a
+#define WAVE_SAWTOOTHUP		0x0b
+#define WAVE_SPRING			0x0d
+#define WAVE_DAMPER			0x0e
+#define WAVE_INERTIA		0x0f
+#define WAVE_FRICTION		0x10
+#define WAVE_CONSTANT		0x12
+
+// Effect data offsets (see FFP_MIDI_Effect_Basic and friends in ffb-pro.h)
+#define OFS_WAVEFORM		1
+#define OFS_EFFECTID		2
+#define OFS_DURATION		3
+#define OFS_DIRECTION		7
+#define OFS_GAIN			9
+#define OFS_SAMPLERATE		10
+#define OFS_ATTACKLEVEL		14
+#define OFS_ATTACKTIME		15
+#define OFS_MAGNITUDE		17
+#define OFS_FADETIME		18
+#define OFS_FADELEVEL		20
+#define OFS_FREQUENCY		21
+#define OFS_PARAM1			23
+#define OFS_PARAM2			25
+#define OFS_COEFFAXIS0		7
+#define OFS_COEFFAXIS1		9
+#define OFS_OFFSETAXIS0		11
+#define OFS_OFFSETAXIS1		13
+
+#define LEN_BASIC			27
+#define LEN_CONDITION		15
+#define LEN_FRICTION		11
+
+// Device modify address for the overall gain
+#define ADDR_DEVICEGAIN		0x7c
+
+// Per effect memory limits of the joystick (see FfbproDeviceMemFull)
+#define MAX_WAVEFORMS		10
+#define MAX_PER_CONDITION	2
+
+// Condition effects reach full force at these, in stick travels per second
+#define DAMPER_FULL_VELOCITY	4.0
+#define INERTIA_FULL_ACCEL		100.0
+#define FRICTION_MIN_VELOCITY	0.05
+#define AUTOCENTER_COEFF		0.5
+
+typedef struct
+	{
+	uint8_t	address;
+	uint8_t	offset;
+	uint8_t	bits;	// 7 or 14
+	} TModifyField;
+
+static const TModifyField gBasicFields[] =
+	{
+		{ 0x40, OFS_DURATION, 14 },
+		{ 0x44, 5, 14 },	// trigger button
+		{ 0x48, OFS_DIRECTION, 14 },
+		{ 0x4c, OFS_GAIN, 7 },
+		{ 0x50, OFS_SAMPLERATE, 14 },
+		{ 0x5c, OFS_ATTACKTIME, 14 },
+		{ 0x60, OFS_FADETIME, 14 },
+		{ 0x64, OFS_ATTACKLEVEL, 7 },
+		{ 0x68, OFS_MAGNITUDE, 7 },
+		{ 0x6c, OFS_FADELEVEL, 7 },
+		{ 0x70, OFS_FREQUENCY, 14 },
+		{ 0x74, OFS_PARAM1, 14 },
+		{ 0x78, OFS_PARAM2, 14 },
+		{ 0, 0, 0 }
+	};
+
+static const TModifyField gConditionFields[] =
+	{
+		{ 0x40, OFS_DURATION, 14 },
+		{ 0x44, 5, 14 },
+		{ 0x48, OFS_COEFFAXIS0, 14 },
+		{ 0x4c, OFS_COEFFAXIS1, 14 },
+		{ 0x50, OFS_OFFSETAXIS0, 14 },
+		{ 0x54, OFS_OFFSETAXIS1, 14 },
+		{ 0, 0, 0 }
+	};
+
+static const TModifyField gFrictionFields[] =
+	{
+		{ 0x40, OFS_DURATION, 14 },
+		{ 0x44, 5, 14 },
+		{ 0x48, OFS_COEFFAXIS0, 14 },
+		{ 0x4c, OFS_COEFFAXIS1, 14 },
+		{ 0, 0, 0 }
+	};
+
+static uint8_t IsCondition(uint8_t waveForm)
+	{
+	return waveForm >= WAVE_SPRING && waveForm <= WAVE_FRICTION;
+	}
+
+static uint8_t IsWaveform(uint8_t waveForm)
+	{
+	switch (waveForm)
+		{
+		case WAVE_SINE:
+		case WAVE_COSINE:
+		case WAVE_SQUARE:
+		case WAVE_RAMPUP:
+		case WAVE_RAMPDOWN:
+		case WAVE_TRIANGLE:
+		case WAVE_SAWTOOTHDOWN:
+		case WAVE_SAWTOOTHUP:
+		case WAVE_CONSTANT:
+			return 1;
+		}
+	return 0;
+	}
+
+static uint8_t DataLength(uint8_t waveForm)
+	{
+	if (waveForm == WAVE_FRICTION)
+		return LEN_FRICTION;
+	if (IsCondition(waveForm))
+		return LEN_CONDITION;
+	if (IsWaveform(waveForm))
+		return LEN_BASIC;
+	return 0;
+	}
+
+static const TModifyField* ModifyFields(uint8_t waveForm)
+	{
+	if (waveForm == WAVE_FRICTION)
+		return gFrictionFields;
+	if (IsCondition(waveForm))
+		return gConditionFields;
+	return gBasicFields;
+	}
+
+static uint16_t Midi14(const uint8_t* data, uint8_t offset)
+	{
+	return (data[offset] & 0x7f) | ((data[offset + 1] & 0x7f) << 7);
+	}
+
+static int16_t MidiInt14(const uint8_t* data, uint8_t offset)
+	{
+	int16_t value = Midi14(data, offset);
+	if (value & 0x2000)
+		value -= 0x4000;
+	return value;
+	}
+
+// ----------------------------------------------
+// Effect memory
+
+uint8_t FfpEmuEffectCount(const TFfpEmu* emu)
+	{
+	uint8_t count = 0;
+	for (uint8_t id = FFP_EMU_FIRST_SLOT; id < FFP_EMU_SLOTS; id++)
+		count += emu->effects[id].used;
+	return count;
+	}
+
+static uint8_t CountEffects(const TFfpEmu* emu, uint8_t waveForm)
+	{
+	uint8_t count = 0;
+	for (uint8_t id = FFP_EMU_FIRST_SLOT; id < FFP_EMU_SLOTS; id++)
+		{
+		const TFfpEmuEffect* effect = &emu->effects[id];
+		if (!effect->used)
+			continue;
+		if (waveForm ? effect->data[OFS_WAVEFORM] == waveForm : IsWaveform(effect->data[OFS_WAVEFORM]))
+			count++;
+		}
+	return count;
+	}
+
+static uint8_t ValidEffect(TFfpEmu* emu, uint8_t id)
+	{
+	if (id >= FFP_EMU_FIRST_SLOT && id < FFP_EMU_SLOTS && emu->effects[id].used)
+		return 1;
+
+	emu->stats.badEffectIds++;
+	return 0;
+	}
+
+static void Download(TFfpEmu* emu, const uint8_t* data, uint8_t len)
+	{
+	uint8_t waveForm = data[OFS_WAVEFORM];
+	uint8_t id = data[OFS_EFFECTID];
+
+	if (len != DataLength(waveForm))
+		{
+		emu->stats.badSysEx++;
+		return;
+		}
+
+	if (id != 0x7f)
+		{	// Overwrite the data of an existing effect
+		if (!ValidEffect(emu, id))
+			return;
+		memcpy(emu->effects[id].data, data, len);
+		emu->effects[id].len = len;
+		emu->stats.overwrites++;
+		return;
+		}
+
+	if (IsCondition(waveForm) ? CountEffects(emu, waveForm) >= MAX_PER_CONDITION : CountEffects(emu, 0) >= MAX_WAVEFORMS)
+		{
+		emu->stats.memFull++;
+		return;
+		}
+
+	for (id = FFP_EMU_FIRST_SLOT; id < FFP_EMU_SLOTS; id++)
+		{
+		TFfpEmuEffect* effect = &emu->effects[id];
+		if (effect->used)
+			continue;
+
+		memset(effect, 0, sizeof(TFfpEmuEffect));
+		effect->used = 1;
+		effect->len = len;
+		memcpy(effect->data, data, len);
+		emu->stats.downloads++;
+
+		uint8_t used = FfpEmuEffectCount(emu);
+		if (used > emu->stats.maxUsed)
+			emu->stats.maxUsed = used;
+		return;
+		}
+
+	emu->stats.memFull++;
+	}
+
+static void OnSysEx(TFfpEmu* emu)
+	{
+	const uint8_t* data = emu->sysex + sizeof(gSysExHeader);
+	uint8_t len = emu->sysexLen - sizeof(gSysExHeader) - 1;	// without the checksum
+
+	emu->stats.downloadBytes += emu->sysexLen + 2;
+
+	if (emu->sysexOverflow || emu->sysexLen < sizeof(gSysExHeader) + 2
+		|| memcmp(emu->sysex, gSysExHeader, sizeof(gSysExHeader)) != 0)
+		{
+		emu->stats.badSysEx++;
+		return;
+		}
+
+	uint8_t checksum = 0;
+	for (uint8_t i = 0; i <= len; i++)
+		checksum += data[i];
+	if (checksum & 0x7f)
+		{
+		emu->stats.checksumErrors++;
+		return;
+		}
+
+	if (data[0] == 0x23)
+		Download(emu, data, len);
+	else
+		emu->stats.otherSysEx++;
+	}
+
+static void StopAll(TFfpEmu* emu)
+	{
+	for (uint8_t id = 0; id < FFP_EMU_SLOTS; id++)
+		emu->effects[id].playing = 0;
+	}
+
+static void OnControl(TFfpEmu* emu, uint8_t control)
+	{
+	emu->stats.controlBytes += 2;
+	emu->stats.controls++;
+
+	switch (control)
+		{
+		case 0x01:	// reset
+			memset(emu->effects, 0, sizeof(emu->effects));
+			emu->deviceGain = 0x7f;
+			emu->actuators = 1;
+			emu->paused = 0;
+			emu->autoCenter = 1;
+			break;
+		case 0x02:	// enable actuators
+			emu->actuators = 1;
+			break;
+		case 0x03:	// disable actuators
+			emu->actuators = 0;
+			break;
+		case 0x04:	// continue
+			emu->paused = 0;
+			break;
+		case 0x05:	// pause
+			emu->paused = 1;
+			break;
+		case 0x06:	// stop all, including the auto centering
+			StopAll(emu);
+			emu->autoCenter = 0;
+			break;
+		default:
+			emu->stats.unknownStatus++;
+			break;
+		}
+	}
+
+static void OnOperation(TFfpEmu* emu, uint8_t op, uint8_t id)
+	{
+	if (op >= 0x40)
+		{	// Modify address - the value follows in A5
+		if (emu->modifyPending)
+			{
+			emu->stats.orphanModifies++;
+			emu->stats.modifyBytes += 3;
+			}
+		emu->modifyAddress = op;
+		emu->modifyId = id;
+		emu->modifyPending = 1;
+		return;
+		}
+
+	emu->stats.operationBytes += 3;
+
+	if (op != 0x10 && op != 0x20 && op != 0x30)
+		{
+		emu->stats.badAddresses++;
+		return;
+		}
+
+	if (!ValidEffect(emu, id))
+		return;
+
+	TFfpEmuEffect* effect = &emu->effects[id];
+	switch (op)
+		{
+		case 0x10:
+			effect->used = 0;
+			effect->playing = 0;
+			emu->stats.frees++;
+			break;
+		case 0x20:
+			effect->playing = 1;
+			effect->startMs = emu->effectMs;
+			emu->stats.starts++;
+			break;
+		case 0x30:
+			effect->playing = 0;
+			emu->stats.stops++;
+			break;
+		}
+	}
+
+static void OnModifyValue(TFfpEmu* emu, uint8_t lo, uint8_t hi)
+	{
+	if (!emu->modifyPending)
+		{
+		emu->stats.orphanModifies++;
+		emu->stats.modifyBytes += 3;
+		return;
+		}
+
+	emu->stats.modifyBytes += 6;
+	emu->modifyPending = 0;
+
+	if (emu->modifyId == FFP_EMU_DEVICE_ID)
+		{
+		if (emu->modifyAddress == ADDR_DEVICEGAIN)
+			emu->deviceGain = lo;
+		emu->stats.deviceModifies++;
+		return;
+		}
+
+	if (!ValidEffect(emu, emu->modifyId))
+		return;
+
+	TFfpEmuEffect* effect = &emu->effects[emu->modifyId];
+	const TModifyField* field = ModifyFields(effect->data[OFS_WAVEFORM]);
+	while (field->bits && field->address != emu->modifyAddress)
+		field++;
+
+	if (!field->bits)
+		{
+		emu->stats.badAddresses++;
+		return;
+		}
+
+	effect->data[field->offset] = lo;
+	if (field->bits == 14)
+		effect->data[field->offset + 1] = hi;
+	emu->stats.modifies++;
+	}
+
+// ----------------------------------------------
+// MIDI parser
+
+void FfpEmuInit(TFfpEmu* emu)
+	{
+	memset(emu, 0, sizeof(TFfpEmu));
+	emu->deviceGain = 0x7f;
+	emu->actuators = 1;
+	emu->autoCenter = 1;
+	}
+
+void FfpEmuReceive(TFfpEmu* emu, uint8_t data)
+	{
+	emu->stats.bytes++;
+
+	if (emu->status == 0xf0)
+		{
+		if (data == 0xf7)
+			{
+			OnSysEx(emu);
+			emu->status = 0;
+			return;
+			}
+		if (!(data & 0x80))
+			{
+			if (emu->sysexLen < sizeof(emu->sysex))
+				emu->sysex[emu->sysexLen++] = data;
+			else
+				emu->sysexOverflow = 1;
+			return;
+			}
+
+		// Another message before the end of the SysEx
+		emu->stats.downloadBytes += emu->sysexLen + 1;
+		emu->stats.badSysEx++;
+		emu->status = 0;
+		}
+
+	if (data & 0x80)
+		{
+		if (emu->modifyPending && data != 0xa5)
+			{	// Nothing may come between the modify address and its value
+			emu->stats.orphanModifies++;
+			emu->stats.modifyBytes += 3;
+			emu->modifyPending = 0;
+			}
+
+		emu->status = data;
+		emu->count = 0;
+		emu->sysexLen = 0;
+		emu->sysexOverflow = 0;
+		if (data != 0xf0 && data != 0xb5 && data != 0xa5 && data != 0xc5)
+			{
+			emu->stats.unknownStatus++;
+			emu->status = 0;
+			}
+		return;
+		}
+
+	if (emu->status == 0)
+		{	// No running status in this protocol
+		emu->stats.strayBytes++;
+		return;
+		}
+
+	emu->msg[emu->count++] = data;
+
+	switch (emu->status)
+		{
+		case 0xc5:
+			OnControl(emu, emu->msg[0]);
+			emu->status = 0;
+			break;
+		case 0xb5:
+			if (emu->count == 2)
+				{
+				OnOperation(emu, emu->msg[0], emu->msg[1]);
+				emu->status = 0;
+				}
+			break;
+		case 0xa5:
+			if (emu->count == 2)
+				{
+				OnModifyValue(emu, emu->msg[0], emu->msg[1]);
+				emu->status = 0;
+				}
+			break;
+		}
+	}
+
+void FfpEmuReceiveData(TFfpEmu* emu, const uint8_t* data, uint16_t len)
+	{
+	while (len--)
+		FfpEmuReceive(emu, *data++);
+	}
+
+uint32_t FfpEmuErrors(const TFfpEmu* emu)
+	{
+	const TFfpEmuStats* s = &emu->stats;
+	return s->checksumErrors + s->badSysEx + s->strayBytes + s->unknownStatus
+		+ s->badEffectIds + s->badAddresses + s->orphanModifies + s->memFull;
+	}
+
+// ----------------------------------------------
+// Force synthesis
+
+void FfpEmuSetPosition(TFfpEmu* emu, int16_t x, int16_t y)
+	{
+	emu->posX = x;
+	emu->posY = y;
+	}
+
+static double Clamp(double value, double limit)
+	{
+	if (value > limit)
+		return limit;
+	if (value < -limit)
+		return -limit;
+	return value;
+	}
+
+// Waveform value -1..1 at <phase> 0..1
+static double Wave(uint8_t waveForm, double phase, double elapsed, double duration)
+	{
+	switch (waveForm)
+		{
+		case WAVE_SINE:			return sin(2 * M_PI * phase);
+		case WAVE_COSINE:		return cos(2 * M_PI * phase);
+		case WAVE_SQUARE:		return (phase < 0.5) ? 1 : -1;
+		case WAVE_TRIANGLE:		return (phase < 0.5) ? 4 * phase - 1 : 3 - 4 * phase;
+		case WAVE_SAWTOOTHUP:	return 2 * phase - 1;
+		case WAVE_SAWTOOTHDOWN:	return 1 - 2 * phase;
+		case WAVE_RAMPUP:		return duration ? 2 * elapsed / duration - 1 : 2 * phase - 1;
+		case WAVE_RAMPDOWN:		return duration ? 1 - 2 * elapsed / duration : 1 - 2 * phase;
+		}
+	return 0;
+	}
+
+// Force of a waveform effect along its direction, -127..127
+static double BasicForce(const TFfpEmuEffect* effect, double elapsed, double duration)
+	{
+	const uint8_t* data = effect->data;
+	double level = data[OFS_MAGNITUDE];
+
+	// Envelope
+	double attackTime = Midi14(data, OFS_ATTACKTIME) * 2;
+	double fadeStart = Midi14(data, OFS_FADETIME) * 2;
+	if (elapsed < attackTime)
+		level = data[OFS_ATTACKLEVEL] + (level - data[OFS_ATTACKLEVEL]) * elapsed / attackTime;
+	else if (duration && fadeStart && elapsed > fadeStart && duration > fadeStart)
+		level = level + (data[OFS_FADELEVEL] - level) * (elapsed - fadeStart) / (duration - fadeStart);
+
+	double param1 = MidiInt14(data, OFS_PARAM1);
+	double param2 = MidiInt14(data, OFS_PARAM2);
+	double force;
+
+	if (data[OFS_WAVEFORM] == WAVE_CONSTANT)
+		force = param2 + (param1 - param2) * level / 127;
+	else
+		{
+		// The waveform is sampled at the effect's sample rate
+		double sampleRate = Midi14(data, OFS_SAMPLERATE);
+		double t = elapsed;
+		if (sampleRate > 0)
+			t = floor(elapsed * sampleRate / 1000) * 1000 / sampleRate;
+
+		double frequency = Midi14(data, OFS_FREQUENCY);
+		double phase = t * frequency / 1000;
+		phase -= floor(phase);
+
+		// param1 and param2 are the peaks with the full level
+		double w = Wave(data[OFS_WAVEFORM], phase, t, duration);
+		force = (param1 + param2) / 2 + w * (param1 - param2) / 2 * level / 127;
+		}
+
+	return force * data[OFS_GAIN] / 127;
+	}
+
+// Force of a condition effect on one axis, -127..127
+static double ConditionForce(TFfpEmu* emu, const TFfpEmuEffect* effect, uint8_t axis)
+	{
+	const uint8_t* data = effect->data;
+	double coeff = MidiInt14(data, axis ? OFS_COEFFAXIS1 : OFS_COEFFAXIS0) / 128.0;
+	double pos = (axis ? emu->posY : emu->posX) / 512.0;
+	double vel = (axis ? emu->velY : emu->velX) / 512.0;
+	double acc = (axis ? emu->accY : emu->accX) / 512.0;
+
+	switch (data[OFS_WAVEFORM])
+		{
+		case WAVE_SPRING:
+			{
+			double offset = MidiInt14(data, axis ? OFS_OFFSETAXIS1 : OFS_OFFSETAXIS0) / 128.0;
+			return -127 * coeff * Clamp(pos - offset, 1);
+			}
+		case WAVE_DAMPER:
+			return -127 * coeff * Clamp(vel / DAMPER_FULL_VELOCITY, 1);
+		case WAVE_INERTIA:
+			return -127 * coeff * Clamp(acc / INERTIA_FULL_ACCEL, 1);
+		case WAVE_FRICTION:
+			if (fabs(vel) < FRICTION_MIN_VELOCITY)
+				return 0;
+			return (vel > 0) ? -127 * coeff : 127 * coeff;
+		}
+	return 0;
+	}
+
+void FfpEmuTick(TFfpEmu* emu, uint32_t timeUs, TFfpEmuForce* outForce)
+	{
+	uint32_t dt = emu->ticked ? timeUs - emu->lastTickUs : 0;
+	emu->lastTickUs = timeUs;
+
+	if (!emu->paused)
+		{
+		emu->effectUs += dt;
+		emu->effectMs += emu->effectUs / 1000;
+		emu->effectUs %= 1000;
+		}
+
+	// Stick motion for the condition effects
+	if (dt)
+		{
+		double velX = (emu->posX - emu->lastPosX) * 1e6 / dt;
+		double velY = (emu->posY - emu->lastPosY) * 1e6 / dt;
+		emu->accX = (velX - emu->velX) * 1e6 / dt;
+		emu->accY = (velY - emu->velY) * 1e6 / dt;
+		emu->velX = velX;
+		emu->velY = velY;
+		}
+	emu->lastPosX = emu->posX;
+	emu->lastPosY = emu->posY;
+	emu->ticked = 1;
+
+	double x = 0, y = 0;
+
+	for (uint8_t id = FFP_EMU_FIRST_SLOT; id < FFP_EMU_SLOTS; id++)
+		{
+		TFfpEmuEffect* effect = &emu->effects[id];
+		if (!effect->playing)
+			continue;
+
+		double elapsed = emu->effectMs - effect->startMs;
+		double duration = Midi14(effect->data, OFS_DURATION) * 2;
+		if (duration && elapsed >= duration)
+			{
+			effect->playing = 0;
+			continue;
+			}
+
+		if (IsCondition(effect->data[OFS_WAVEFORM]))
+			{
+			x += ConditionForce(emu, effect, 0);
+			y += ConditionForce(emu, effect, 1);
+			}
+		else
+			{	// Direction is where the force comes from, 0 = north
+			double direction = Midi14(effect->data, OFS_DIRECTION) * M_PI / 180;
+			double force = BasicForce(effect, elapsed, duration);
+			x -= force * sin(direction);
+			y += force * cos(direction);
+			}
+		}
+
+	if (emu->autoCenter)
+		{
+		x -= 127 * AUTOCENTER_COEFF * emu->posX / 512.0;
+		y -= 127 * AUTOCENTER_COEFF * emu->posY / 512.0;
+		}
+
+	if (!emu->actuators || emu->paused)
+		x = y = 0;
+
+	double scale = (double) FFP_EMU_FORCE_MAX / 127 * emu->deviceGain / 127;
+	outForce->x = (int16_t) lround(Clamp(x * scale, FFP_EMU_FORCE_MAX));
+	outForce->y = (int16_t) lround(Clamp(y * scale, FFP_EMU_FORCE_MAX));
+	}
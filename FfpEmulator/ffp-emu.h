@@ -0,0 +1,140 @@
+/*
+  Force Feedback Joystick
+  Host-side emulator of the Microsoft Sidewinder Force Feedback Pro
+  MIDI interface for testing the force feedback code without a joystick.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#ifndef _FFP_EMU_H_
+#define _FFP_EMU_H_
+
+#include <stdint.h>
+
+// Effect ids the joystick understands. Ids 0 and 1 are never given to
+// downloaded effects and 0x7f addresses the device itself.
+#define FFP_EMU_SLOTS		32
+#define FFP_EMU_FIRST_SLOT	2
+#define FFP_EMU_DEVICE_ID	0x7f
+
+// Longest effect data between the SysEx header and the checksum
+#define FFP_EMU_MAX_DATA	32
+
+// Time to send one byte at 31250 baud with 8N1 framing
+#define FFP_EMU_BYTE_US		320
+
+// Full force in the output of FfpEmuTick()
+#define FFP_EMU_FORCE_MAX	10000
+
+typedef struct
+	{
+	uint8_t		used;
+	uint8_t		playing;
+	uint8_t		len;		// bytes in <data>
+	uint8_t		data[FFP_EMU_MAX_DATA];	// as downloaded, starting from 0x23
+	uint32_t	startMs;	// effect clock when started
+	} TFfpEmuEffect;
+
+// Counters of what the joystick received. The error counters should stay
+// at zero for anything the firmware sends.
+typedef struct
+	{
+	uint32_t	bytes;
+	uint32_t	downloadBytes, modifyBytes, operationBytes, controlBytes;
+	uint32_t	downloads;		// new effects
+	uint32_t	overwrites;		// downloads to an existing effect
+	uint32_t	otherSysEx;		// e.g. the start-up SysEx
+	uint32_t	modifies, deviceModifies;
+	uint32_t	starts, stops, frees;
+	uint32_t	controls;
+	uint32_t	maxUsed;		// most effects in the memory at once
+
+	// Errors
+	uint32_t	checksumErrors;
+	uint32_t	badSysEx;		// wrong header or length
+	uint32_t	strayBytes;		// data bytes outside a message
+	uint32_t	unknownStatus;
+	uint32_t	badEffectIds;	// operation or modify to an unused effect
+	uint32_t	badAddresses;	// modify to an address the effect does not have
+	uint32_t	orphanModifies;	// modify address without a value or vice versa
+	uint32_t	memFull;		// download that did not fit
+	} TFfpEmuStats;
+
+typedef struct
+	{
+	int16_t		x, y;	// -FFP_EMU_FORCE_MAX..FFP_EMU_FORCE_MAX
+	} TFfpEmuForce;
+
+typedef struct
+	{
+	TFfpEmuEffect	effects[FFP_EMU_SLOTS];
+	TFfpEmuStats	stats;
+
+	// Device state
+	uint8_t		deviceGain;		// 0..127
+	uint8_t		actuators;		// enabled
+	uint8_t		paused;
+	uint8_t		autoCenter;
+
+	// MIDI parser
+	uint8_t		status;			// of the message being received, 0 if none
+	uint8_t		count;			// data bytes received for it
+	uint8_t		msg[2];
+	uint8_t		sysex[FFP_EMU_MAX_DATA + 8];
+	uint8_t		sysexLen;
+	uint8_t		sysexOverflow;
+	uint8_t		modifyAddress;	// from B5, waiting for A5
+	uint8_t		modifyId;
+	uint8_t		modifyPending;
+
+	// Synthesis
+	uint32_t	lastTickUs;
+	uint32_t	effectMs;		// effect clock, stops while paused
+	uint32_t	effectUs;		// fraction of a ms not yet in <effectMs>
+	int16_t		posX, posY;		// stick position -512..511
+	double		lastPosX, lastPosY;
+	double		velX, velY;		// position units per second
+	double		accX, accY;
+	uint8_t		ticked;
+	} TFfpEmu;
+
+// Resets the emulator to a powered up joystick.
+void FfpEmuInit(TFfpEmu* emu);
+
+// Feeds one byte received by the joystick.
+void FfpEmuReceive(TFfpEmu* emu, uint8_t data);
+void FfpEmuReceiveData(TFfpEmu* emu, const uint8_t* data, uint16_t len);
+
+// Sets the stick position used by the condition effects.
+void FfpEmuSetPosition(TFfpEmu* emu, int16_t x, int16_t y);
+
+// Advances time to <timeUs> and returns the force the motors produce.
+// Call at 1 kHz for a force trace.
+void FfpEmuTick(TFfpEmu* emu, uint32_t timeUs, TFfpEmuForce* outForce);
+
+// Number of effects in the joystick's memory
+uint8_t FfpEmuEffectCount(const TFfpEmu* emu);
+
+// Sum of the error counters in the stats
+uint32_t FfpEmuErrors(const TFfpEmu* emu);
+
+#endif // _FFP_EMU_H_
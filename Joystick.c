@@ -36,9 +36,11 @@
 
 #include "3DPro.h"
 #include "Joystick.h"
+#include "calibration.h"
 #include "ffb.h"
 #include "usb_hid.h"
 #include "debug.h"
+#include "hal.h"
 
 //#define USE_FAKE_JOYSTICK
 
@@ -82,6 +84,56 @@ static uint8_t sw_repchg ( void )
 }
 // <--- Code from 3DPVert ends
 
+// Input reports read by Joystick_Task(). The front one is complete and
+// served to the host while the other one is being filled.
+static USB_JoystickReport_Data_t gInputReports[2];
+static uint8_t gInputReportFront = 0;
+static uint8_t gInputReportSequence = 0;	// incremented for each new front report
+// Added analog controls, sampled in rotation by the ADC interrupt. Each
+// round converts every channel once and after 4^ADC_OVERSAMPLE_BITS rounds
+// the sums are published as one snapshot.
+//	ADC0 - Trim 1
+//	ADC1 - Trim 2
+//	ADC4 - Left Pedal
+//	ADC5 - Right Pedal
+#define ADC_CHANNELS	4
+#define ADC_ROUNDS		(1 << (2 * ADC_OVERSAMPLE_BITS))
+
+#if ADC_OVERSAMPLE_BITS > 3
+#error "ADC_OVERSAMPLE_BITS > 3 overflows the 16-bit sums"
+#endif
+
+static const uint8_t ADC_MUX[ADC_CHANNELS] = { 0, 1, 4, 5 };	// in the order of AddedControls_ADC_t
+
+static uint16_t gAdcSums[ADC_CHANNELS];
+static uint8_t gAdcChannel = 0;	// index to ADC_MUX being converted
+static uint8_t gAdcRound = 0;
+static volatile uint16_t gAdcSnapshot[ADC_CHANNELS];
+
+static uint16_t gInputReportTime = 0;	// HalMicros() when the front report was read
+static uint16_t gInputReportSof = 0;	// gSofTime of the frame of the last read
+
+// Last input report sent to the IN endpoint
+static USB_JoystickReport_Data_t gInputReportSent;
+static uint16_t gInputReportSentTime = 0;	// HalMillis() when it was sent
+
+// USB start of frame, set in interrupt
+static volatile uint16_t gSofTime = 0;	// HalMicros()
+#if FFP_ASYNC_QUERY
+static uint8_t gInputReadPending = 0;	// packet from the stick on its way
+#endif
+
+static struct
+	{
+	uint16_t refreshed;	// reports served that were newer than the last one to the same requester
+	uint16_t reused;	// reports served again without a new read
+	uint16_t ageLast;	// microseconds from reading the joystick to serving the report
+	uint16_t ageMax;
+	uint16_t ageAvg;	// moving average of 8
+	uint16_t unchanged;	// new reads not sent to the IN endpoint as nothing changed
+	uint16_t idle;		// unchanged reports sent again as the idle time ran out
+	} gInputReportStats;
+
 
 /** Configures the board hardware and chip peripherals for the joystick's functionality. */
 void Joystick_Init(void)
@@ -93,7 +145,7 @@ void Joystick_Init(void)
     init_hw() ;					// hardware. Note: defined as naked !
 	sw_reportsz = SW_REPSZ_FFP + ADDED_REPORT_DATA_SIZE;
 
-    SetTMPS( 1, 64 ) ;				// Set T1 prescaler to /64
+    HalMicrosInit();				// T1 as the microsecond clock, init_hw() set it for its delays
     SetTMPS( 0, 1024 ) ;			// Set T0 prescaler to / 1024 for delay
 
     sw_sendrep = sw_repchg() ;			// Init send report flag, saved report
@@ -103,6 +155,8 @@ void Joystick_Init(void)
 	// Force feedback
 	FfbInitMidi();
 
+	CalInit();
+
 	// ADC for extra controls
 	DDRF = 0; // all inputs
 //	PORTF |= 0xff; // all pullups enabled
@@ -112,11 +166,15 @@ void Joystick_Init(void)
 	ADMUX |= (1 << REFS0);		// ADC reference := Vcc
 //	ADCSRA |= (1 << ADFR); 		// ADATE
 //	ADCSRA |= (1 << ADATE); 	// free/continous mode
-	ADMUX |= (1 << ADLAR); 		// 8-bit resolution to HIGH
+	ADMUX |= ADC_MUX[0];		// 10-bit results, right adjusted
 	ADCSRA |= (1 << ADEN); 		// Enable ADC
 	ADCSRA |= (1 << ADIE);  	// Enable ADC Interrupt 
 
 	ADCSRA |= (1 << ADSC); 		// Go ADC
+
+	// Until the first read
+	gInputReports[0].reportId = 1;
+	gInputReports[1].reportId = 1;
 	}
 
 /** Configures the board hardware and chip peripherals for the joystick's functionality. */
@@ -139,29 +197,20 @@ typedef struct
 	uint16_t 	scaler;
 	} JoystickData;
 
-typedef struct
-	{
-	uint8_t sampledChannel;
-	uint8_t	trim1, trim2, pedal1, pedal2;
-	} AddedControls_ADC_t;
-
-static volatile AddedControls_ADC_t added_controls_adc;
-
 static volatile JoystickData prev_joystick_data;
-static volatile uint8_t ADC_is_ready = 0;
 
 
 
-int Joystick_CreateInputReport(uint8_t inReportId, USB_JoystickReport_Data_t* const outReportData)
+void Joystick_CreateInputReport(uint8_t inReportId, USB_JoystickReport_Data_t* const outReportData)
 	{
 	// Read the data from the FFP-joystick
 
-	int InputChanged = 1;	// ???? TODO: check for actual changes to avoid unnecessary input reports
-
 #ifndef USE_FAKE_JOYSTICK
+#if !FFP_ASYNC_QUERY	// else Joystick_Task() has read the packet already
 	// Code from 3DPVert begins-->
 	SetTMPS( 0, 64 ) ;		// Set T0 prescaler to / 64 for query
 	getdata();
+#endif
 
 	// -------------------------------------------------------------------------------
 	// *******************************************************************************
@@ -196,47 +245,10 @@ int Joystick_CreateInputReport(uint8_t inReportId, USB_JoystickReport_Data_t* co
 
 	// ???? This could be done more directly by modifying the 3DPVert code
 	// ???? that generates its own USB report to the abovementioned format.
-	// Here we read the additional analog controls in
-	// rotation for each AD-channel at a time.
-	//
-	// Here,
-	//	ADC0 - Trim 1
-	//	ADC1 - Trim 2
-	//	ADC4 - Left Pedal
-	//	ADC5 - Right Pedal
-
-	if (ADC_is_ready)
-		{
-		ADC_is_ready = 0;
-
-		switch (added_controls_adc.sampledChannel)
-			{
-			case 0:
-				added_controls_adc.trim1 = ADCH;
-				added_controls_adc.sampledChannel = 1;
-				break;
-			case 1:
-				added_controls_adc.trim2 = ADCH;
-				added_controls_adc.sampledChannel = 4;
-				break;
-			case 4:
-				added_controls_adc.pedal1 = ADCH;
-				added_controls_adc.sampledChannel = 5;
-				break;
-			case 5:
-				added_controls_adc.pedal2 = ADCH;
-				added_controls_adc.sampledChannel = 0;
-				break;
-			default:
-				added_controls_adc.sampledChannel = 0;	// just in case
-				break;
-			}
-
-		// Start AD-conversion for the next channel in the rotation
-		ADMUX &= 0b11111000;
-		ADMUX |= (0b111 & added_controls_adc.sampledChannel);
-		ADCSRA|=(1<<ADSC);
-		}
+	// The additional analog controls are sampled by the ADC interrupt,
+	// take its latest snapshot of all of them.
+	AddedControls_ADC_t added_controls_adc;
+	Joystick_GetAddedControls(&added_controls_adc);
 
 /*
 5 wwwwwwww
@@ -262,27 +274,34 @@ int Joystick_CreateInputReport(uint8_t inReportId, USB_JoystickReport_Data_t* co
 	else
 		{
 		// Convert data from Sidewinder Force Feedback Pro
-		outReportData->X = sw_report[0] + ((sw_report[1] & 0x03) << 8);
+		int16_t x = sw_report[0] + ((sw_report[1] & 0x03) << 8);
 		if (sw_report[1] & 0x02)
-			outReportData->X |= (0b11111100 << 8);
+			x |= (0b11111100 << 8);
 		
 		
-		outReportData->Y = (sw_report[1] >> 2) + ((sw_report[2] & 0x0F) << 6);
+		int16_t y = (sw_report[1] >> 2) + ((sw_report[2] & 0x0F) << 6);
 		if (sw_report[2] & 0x08)
-			outReportData->Y |= (0b11111100 << 8);
+			y |= (0b11111100 << 8);
 		outReportData->Button = ((sw_report[4] & 0x7F) << 2) + ((sw_report[3] & 0xC0) >> 6);
 		outReportData->Hat = sw_report[2] >> 4;
-		outReportData->Rz = (sw_report[3] & 0x3f) - 32;
-		outReportData->Throttle = ((sw_report[5] & 0x3f) << 1) + (sw_report[4] >> 7);
+		int8_t rz = ((sw_report[3] & 0x3f) ^ 0x20) - 32;	// signed 6 bits
+		int8_t throttle = ((sw_report[5] & 0x3f) << 1) + (sw_report[4] >> 7);
 		if (sw_report[5] & 0x20)
-			outReportData->Throttle |= 0b11000000;
+			throttle |= 0b11000000;
+
+		// Calibrate to the logical ranges of the report fields
+		outReportData->X = CalApply(CAL_AXIS_X, x);
+		outReportData->Y = CalApply(CAL_AXIS_Y, y);
+		outReportData->Rz = CalApply(CAL_AXIS_RZ, rz);
+		outReportData->Throttle = CalApply(CAL_AXIS_THROTTLE, throttle);
 
 		outReportData->Z = 0;	// not used at the moment
 
-		// Get data from additional controls
-		outReportData->Rudder = (added_controls_adc.pedal2 - added_controls_adc.pedal1) / 2 - 128;	// Combine two pedals into a single rudder
-		outReportData->Rx = added_controls_adc.trim2;	// rudder trim
-		outReportData->Ry = added_controls_adc.trim1;	// elevator trim
+		// Get data from additional controls at full resolution
+		// Combine two pedals into a single rudder
+		outReportData->Rudder = CalApply(CAL_AXIS_RUDDER, (int16_t) added_controls_adc.pedal2 - (int16_t) added_controls_adc.pedal1);
+		outReportData->Rx = CalApply(CAL_AXIS_RX, added_controls_adc.trim2);	// rudder trim
+		outReportData->Ry = CalApply(CAL_AXIS_RY, added_controls_adc.trim1);	// elevator trim
 		}
 
 /*
@@ -293,7 +312,7 @@ int Joystick_CreateInputReport(uint8_t inReportId, USB_JoystickReport_Data_t* co
 
 	prev_joystick_data.scaler++;
 	if (prev_joystick_data.scaler < 200)
-		return false;
+		return;
 	prev_joystick_data.scaler = 0;
 
 	// "Read" the joystick
@@ -328,16 +347,218 @@ int Joystick_CreateInputReport(uint8_t inReportId, USB_JoystickReport_Data_t* co
 	outReportData->Slider = prev_joystick_data.position & 0xFF;
 	outReportData->Hat = prev_joystick_data.position % 8;
 */
-	return InputChanged;
 	}
 
 
+// The low 16 bits of HalMicros() are enough for the report timing
+static uint16_t Joystick_Micros(void)
+	{
+	return (uint16_t) HalMicros();
+	}
+
+void Joystick_OnStartOfFrame(void)
+	{
+	gSofTime = Joystick_Micros();
+	}
+
+static void Joystick_PublishInputReport(void)
+	{
+	uint8_t back = gInputReportFront ^ 1;
+	Joystick_CreateInputReport(INPUT_REPORTID_ALL, &gInputReports[back]);
+
+	gInputReportTime = Joystick_Micros();
+	gInputReportFront = back;
+	gInputReportSequence++;
+	}
+
+void Joystick_Task(void)
+	{
+	// The joystick's start-up sequence pulses the lines it is read with
+	if (FfbReinitPending())
+		return;
+
+#if FFP_ASYNC_QUERY
+	// Build the report once the packet requested below has arrived
+	if (gInputReadPending)
+		{
+		uint8_t result = dataready();
+		if (result == SW_READ_BUSY)
+			return;
+
+		gInputReadPending = 0;
+		if (result == SW_READ_OK)
+			Joystick_PublishInputReport();
+		else if (result == SW_READ_RETRY)
+			{	// Don't wait for the next frame
+			startdata();
+			gInputReadPending = 1;
+			return;
+			}
+		}
+#endif
+
+	// Read at the given phase after the start of frame so that the report
+	// is as fresh as possible when the host polls for it
+	CRITICAL_VAR();
+	ENTER_CRITICAL();
+	uint16_t sofTime = gSofTime;
+	EXIT_CRITICAL();
+
+	// Frames are 1000 us apart, give or take the jitter of the interrupt
+	if ((uint16_t) (sofTime - gInputReportSof) < JOYSTICK_READ_INTERVAL * 1000u - 500)
+		return;
+
+	if ((uint16_t) (Joystick_Micros() - sofTime) < JOYSTICK_READ_PHASE_US)
+		return;
+
+	gInputReportSof = sofTime;
+
+#if FFP_ASYNC_QUERY
+	// The main loop keeps running while the stick sends the packet
+	SetTMPS( 0, 64 ) ;		// Set T0 prescaler to / 64 for query
+	startdata();
+	gInputReadPending = 1;
+#else
+	Joystick_PublishInputReport();
+#endif
+	}
+
+int Joystick_GetInputReport(USB_JoystickReport_Data_t* const outReportData, uint8_t* ioSequence)
+	{
+	memcpy(outReportData, &gInputReports[gInputReportFront], sizeof(USB_JoystickReport_Data_t));
+
+	if (*ioSequence == gInputReportSequence)
+		{
+		gInputReportStats.reused++;
+		return 0;
+		}
+
+	*ioSequence = gInputReportSequence;
+	gInputReportStats.refreshed++;
+
+	uint16_t age = Joystick_Micros() - gInputReportTime;
+	gInputReportStats.ageLast = age;
+	if (age > gInputReportStats.ageMax)
+		gInputReportStats.ageMax = age;
+	gInputReportStats.ageAvg += ((int16_t) (age - gInputReportStats.ageAvg)) / 8;
+
+	return 1;
+	}
+
+void Joystick_PeekInputReport(USB_JoystickReport_Data_t* const outReportData)
+	{
+	memcpy(outReportData, &gInputReports[gInputReportFront], sizeof(USB_JoystickReport_Data_t));
+	}
+
+void Joystick_GetAddedControls(AddedControls_ADC_t* const outControls)
+	{
+	CRITICAL_VAR();
+	ENTER_CRITICAL();
+	memcpy(outControls, (const void*) gAdcSnapshot, sizeof(AddedControls_ADC_t));
+	EXIT_CRITICAL();
+	}
+
+uint8_t Joystick_InputReportSequence(void)
+	{
+	return gInputReportSequence;
+	}
+
+int Joystick_GetChangedInputReport(USB_JoystickReport_Data_t* const outReportData)
+	{
+	static uint8_t sequence;	// of the last report looked at here
+
+	uint16_t now = HalMillis();
+	uint8_t idle = (idle_rate != 0 && (uint16_t) (now - gInputReportSentTime) >= idle_rate * 4u);
+
+	if (!idle && sequence == gInputReportSequence)
+		return 0;	// nothing new read
+
+	Joystick_GetInputReport(outReportData, &sequence);
+
+	if (memcmp(outReportData, &gInputReportSent, sizeof(USB_JoystickReport_Data_t)) == 0)
+		{
+		if (!idle)
+			{
+			gInputReportStats.unchanged++;
+			return 0;
+			}
+		gInputReportStats.idle++;
+		}
+
+	memcpy(&gInputReportSent, outReportData, sizeof(USB_JoystickReport_Data_t));
+	gInputReportSentTime = now;
+	return 1;
+	}
+
+void Joystick_SetIdle(uint8_t rate)
+	{
+	idle_rate = rate;
+	gInputReportSent.reportId = 0;	// differs from any report
+	}
+
+uint8_t Joystick_GetIdle(void)
+	{
+	return idle_rate;
+	}
+
+void Joystick_DebugListStats(void)
+	{
+	LogTextP(PSTR("Input report sequence="));
+	LogBinary(&gInputReportSequence, 1);
+	LogTextP(PSTR(", refreshed="));
+	LogBinary(&gInputReportStats.refreshed, 2);
+	LogTextP(PSTR(", reused="));
+	LogBinaryLf(&gInputReportStats.reused, 2);
+	LogTextP(PSTR("Input report age us: last="));
+	LogBinary(&gInputReportStats.ageLast, 2);
+	LogTextP(PSTR(", max="));
+	LogBinary(&gInputReportStats.ageMax, 2);
+	LogTextP(PSTR(", avg="));
+	LogBinaryLf(&gInputReportStats.ageAvg, 2);
+	LogTextP(PSTR("Stick reads="));
+	LogBinary(&sw_stats.reads, 2);
+	LogTextP(PSTR(", timeouts="));
+	LogBinary(&sw_stats.timeouts, 2);
+	LogTextP(PSTR(", bad packets="));
+	LogBinary(&sw_stats.badpkts, 2);
+	LogTextP(PSTR(", resyncs="));
+	LogBinary(&sw_stats.resyncs, 2);
+	LogTextP(PSTR(", reinits="));
+	LogBinary(&sw_stats.reinits, 2);
+	LogTextP(PSTR(", recovered="));
+	LogBinaryLf(&sw_stats.recovered, 2);
+	LogTextP(PSTR("Input reports unchanged="));
+	LogBinary(&gInputReportStats.unchanged, 2);
+	LogTextP(PSTR(", idle="));
+	LogBinary(&gInputReportStats.idle, 2);
+	LogTextP(PSTR(", idle rate="));
+	LogBinaryLf(&idle_rate, 1);
+	}
+
 // AD-conversion-completed-interrupt handler.
-// We only set a "ADC ready"-flag here so that
-// the actual data can be read later when there
-// is more time. Doing any heavier stuff here
-// seems to cause problems reading data from FFP joystick.
-ISR(ADC_vect) 
+// Sums the result and starts the next channel in the rotation.
+// Interrupts are enabled right away since anything delaying INT0
+// causes problems reading data from FFP joystick. This can't nest
+// with itself as the next conversion is started at the end.
+ISR(ADC_vect, ISR_NOBLOCK)
 	{
-	ADC_is_ready = 1;
+	gAdcSums[gAdcChannel] += ADC;
+
+	if (++gAdcChannel == ADC_CHANNELS)
+		{
+		gAdcChannel = 0;
+
+		if (++gAdcRound == ADC_ROUNDS)
+			{	// Keep the extra bits of resolution, drop the rest
+			gAdcRound = 0;
+			for (uint8_t i = 0; i < ADC_CHANNELS; i++)
+				{
+				gAdcSnapshot[i] = gAdcSums[i] >> ADC_OVERSAMPLE_BITS;
+				gAdcSums[i] = 0;
+				}
+			}
+		}
+
+	ADMUX = (ADMUX & 0b11111000) | ADC_MUX[gAdcChannel];
+	ADCSRA |= (1 << ADSC);
 	}
@@ -49,6 +49,12 @@ typedef struct
 	uint8_t Hat;
 	} USB_JoystickReport_Data_t;
 
+// Latest samples of the added analog controls
+typedef struct
+	{
+	uint16_t	trim1, trim2, pedal1, pedal2;	// ADC_RESULT_BITS each
+	} AddedControls_ADC_t;
+
 // Functions that form the inferface from the generic parts of the code
 // to joystick model specific parts.
 
@@ -65,12 +71,68 @@ void Joystick_Init(void);
 // joystick to be connected).
 int Joystick_Connect(void);
 
-// Gets called when input report of joysticks position, buttons etc. are
-// requested. Data written to <outReportData> is sent to host if the function
-// returns true. If false is returned, nothing is sent.
+// Reads the joystick and writes its position, buttons etc. to <outReportData>
+// as an input report. Whether it gets sent is up to
+// Joystick_GetChangedInputReport().
 // If <inReportId> has value INPUT_REPORTID_ALL, all input report IDs should
 // generated.
-int Joystick_CreateInputReport(uint8_t inReportId, USB_JoystickReport_Data_t* const outReportData);
+void Joystick_CreateInputReport(uint8_t inReportId, USB_JoystickReport_Data_t* const outReportData);
+
+// Frames (ms) between reading the joystick in Joystick_Task()
+#ifndef JOYSTICK_READ_INTERVAL
+#define JOYSTICK_READ_INTERVAL 1
+#endif
+
+// Microseconds after the USB start of frame to trigger reading the joystick.
+// Tune this with the sample age from the 's' command so that the report is
+// ready just before the host polls the IN endpoint.
+#ifndef JOYSTICK_READ_PHASE_US
+#define JOYSTICK_READ_PHASE_US 400
+#endif
+
+// Samples summed per added analog control (trims and pedals) are 4 to the
+// power of this, giving 10 + ADC_OVERSAMPLE_BITS bits of resolution (max 3)
+#ifndef ADC_OVERSAMPLE_BITS
+#define ADC_OVERSAMPLE_BITS 2
+#endif
+
+#define ADC_RESULT_BITS	(10 + ADC_OVERSAMPLE_BITS)
+
+// Gets called from the main loop. Reads the joystick to the cached input
+// report every JOYSTICK_READ_INTERVAL USB frames.
+void Joystick_Task(void);
+
+// Gets called from the USB start of frame interrupt. Only takes the time.
+void Joystick_OnStartOfFrame(void);
+
+// Returns the sequence number of the latest cached input report.
+uint8_t Joystick_InputReportSequence(void);
+
+// Copies the latest cached input report to <outReportData> for the IN
+// endpoint if it differs from the one sent last or the idle time has run
+// out. Returns false if nothing needs to be sent now.
+int Joystick_GetChangedInputReport(USB_JoystickReport_Data_t* const outReportData);
+
+// HID idle rate in 4 ms units, 0 to send only changes. Setting it also
+// makes the next report go out.
+void Joystick_SetIdle(uint8_t rate);
+uint8_t Joystick_GetIdle(void);
+
+// Copies the latest cached input report to <outReportData> without reading
+// the joystick. <ioSequence> holds the sequence number of the report the
+// caller got the last time and is updated. Returns true if the report is
+// newer than that one.
+int Joystick_GetInputReport(USB_JoystickReport_Data_t* const outReportData, uint8_t* ioSequence);
+
+// Copies the latest cached input report to <outReportData> like
+// Joystick_GetInputReport() but without counting it in the statistics of
+// the reports served to the host.
+void Joystick_PeekInputReport(USB_JoystickReport_Data_t* const outReportData);
+
+// Copies the latest samples of the added analog controls.
+void Joystick_GetAddedControls(AddedControls_ADC_t* const outControls);
+
+void Joystick_DebugListStats(void);
 
 #endif
 
@@ -0,0 +1,503 @@
+/*
+  Force Feedback Joystick
+  Benchmark firmware for the simavr AVR simulator ("make bench"). Runs a
+  fixed sequence of force feedback reports through the core and prints the
+  cycles each call took as CSV on the simavr console.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+// Built with FFB_BENCH and USE_FAKE_JOYSTICK, so that there is no USB, the
+// gameport is not read and the MIDI goes out at CPU speed (see hal-avr.h).
+// Timer 1 counts the cycles with the CPU clock and its overflow interrupt
+// extends it to 32 bits. Nothing else interrupts the measurements, so the
+// counts are the same on every run.
+//
+// The output is one CSV row per function and case:
+//	function,case,calls,min_cycles,avg_cycles,max_cycles,midi_bytes
+// where <midi_bytes> is the total the calls sent.
+
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/pgmspace.h>
+
+#include "avr/avr_mcu_section.h"
+
+#ifndef FFB_BENCH
+#error "bench.c is built by \"make bench\" only"
+#endif
+
+#include "Joystick.h"
+#include "calibration.h"
+#include "ffb.h"
+#include "ffb-pro.h"
+#include "hal.h"
+
+AVR_MCU(F_CPU, "atmega32u4");
+AVR_MCU_SIMAVR_CONSOLE(&GPIOR1);
+
+// ---- Cycle counter
+
+static volatile uint16_t gBenchOverflows = 0;
+static uint16_t gBenchOverhead = 0;	// cycles of an empty measurement
+
+ISR(TIMER1_OVF_vect)
+	{
+	gBenchOverflows++;
+	}
+
+static uint32_t BenchCycles(void)
+	{
+	CRITICAL_VAR();
+	ENTER_CRITICAL();
+	uint16_t low = TCNT1;
+	uint16_t high = gBenchOverflows;
+	if ((TIFR1 & (1<<TOV1)) && low < 0x8000)
+		high++;	// overflowed after entering, the interrupt is still pending
+	EXIT_CRITICAL();
+	return ((uint32_t) high << 16) | low;
+	}
+
+// ---- Statistics
+
+typedef struct
+	{
+	uint16_t	calls;
+	uint16_t	midiBytes;
+	uint32_t	min, max, total;
+	} TBenchStat;
+
+// Output reports 1..OUT_REPORT_COUNT by their id, then the rest
+#define BENCH_CREATE_NEW_EFFECT		(OUT_REPORT_COUNT + 1)
+#define BENCH_SET_EFFECT_NEW		(OUT_REPORT_COUNT + 2)
+#define BENCH_SET_EFFECT_PLAYING	(OUT_REPORT_COUNT + 3)
+#define BENCH_SEND_SYSEX			(OUT_REPORT_COUNT + 4)
+#define BENCH_INPUT_REPORT			(OUT_REPORT_COUNT + 5)
+#define BENCH_STATS					(OUT_REPORT_COUNT + 6)
+
+static TBenchStat gBenchStats[BENCH_STATS];
+
+static const char gNameOnUsbData[] PROGMEM = "FfbOnUsbData";
+static const char gNameSetEffect[] PROGMEM = "FfbproSetEffect";
+static const char gNameOther[] PROGMEM = "";
+
+static const char gCase0[] PROGMEM = "";
+static const char gCase1[] PROGMEM = "Set Effect";
+static const char gCase2[] PROGMEM = "Set Envelope";
+static const char gCase3[] PROGMEM = "Set Condition";
+static const char gCase4[] PROGMEM = "Set Periodic";
+static const char gCase5[] PROGMEM = "Set Constant Force";
+static const char gCase6[] PROGMEM = "Set Ramp Force";
+static const char gCase7[] PROGMEM = "Set Custom Force Data";
+static const char gCase8[] PROGMEM = "Download Force Sample";
+static const char gCase10[] PROGMEM = "Effect Operation";
+static const char gCase11[] PROGMEM = "Block Free";
+static const char gCase12[] PROGMEM = "Device Control";
+static const char gCase13[] PROGMEM = "Device Gain";
+static const char gCase14[] PROGMEM = "Set Custom Force";
+static const char gCase15[] PROGMEM = "Create New Effect";
+static const char gCaseCreate[] PROGMEM = "FfbOnCreateNewEffect";
+static const char gCaseNew[] PROGMEM = "not downloaded";
+static const char gCasePlaying[] PROGMEM = "playing";
+static const char gCaseSysEx[] PROGMEM = "FfbSendSysEx";
+static const char gCaseInput[] PROGMEM = "Joystick_CreateInputReport";
+
+typedef struct
+	{
+	const char*	function;
+	const char*	reportCase;
+	} TBenchName;
+
+static const TBenchName gBenchNames[BENCH_STATS] PROGMEM =
+	{
+		{ gNameOther, gCase0 },
+		{ gNameOnUsbData, gCase1 },
+		{ gNameOnUsbData, gCase2 },
+		{ gNameOnUsbData, gCase3 },
+		{ gNameOnUsbData, gCase4 },
+		{ gNameOnUsbData, gCase5 },
+		{ gNameOnUsbData, gCase6 },
+		{ gNameOnUsbData, gCase7 },
+		{ gNameOnUsbData, gCase8 },
+		{ gNameOnUsbData, gCase0 },
+		{ gNameOnUsbData, gCase10 },
+		{ gNameOnUsbData, gCase11 },
+		{ gNameOnUsbData, gCase12 },
+		{ gNameOnUsbData, gCase13 },
+		{ gNameOnUsbData, gCase14 },
+		{ gNameOnUsbData, gCase15 },
+		{ gCaseCreate, gCase0 },
+		{ gNameSetEffect, gCaseNew },
+		{ gNameSetEffect, gCasePlaying },
+		{ gCaseSysEx, gCase0 },
+		{ gCaseInput, gCase0 },
+	};
+
+static uint32_t gBenchStart;
+static uint16_t gBenchStartBytes;
+
+static void BenchBegin(void)
+	{
+	gBenchStartBytes = gHalBenchMidiBytes;
+	gBenchStart = BenchCycles();
+	}
+
+static void BenchEnd(uint8_t stat)
+	{
+	uint32_t cycles = BenchCycles() - gBenchStart - gBenchOverhead;
+	TBenchStat* s = &gBenchStats[stat];
+
+	if (s->calls == 0 || cycles < s->min)
+		s->min = cycles;
+	if (cycles > s->max)
+		s->max = cycles;
+	s->total += cycles;
+	s->calls++;
+	s->midiBytes += gHalBenchMidiBytes - gBenchStartBytes;
+	}
+
+// ---- Output to the simavr console
+
+static void BenchPutc(char c)
+	{
+	GPIOR1 = c;
+	}
+
+static void BenchPutsP(const char* text)
+	{
+	char c;
+	while ((c = pgm_read_byte(text++)) != 0)
+		BenchPutc(c);
+	}
+
+static void BenchPutNumber(uint32_t value)
+	{
+	char text[11];
+	ultoa(value, text, 10);
+	for (char* p = text; *p; p++)
+		BenchPutc(*p);
+	}
+
+static void BenchPrint(void)
+	{
+	BenchPutsP(PSTR("function,case,calls,min_cycles,avg_cycles,max_cycles,midi_bytes\n"));
+
+	for (uint8_t i = 0; i < BENCH_STATS; i++)
+		{
+		const TBenchStat* s = &gBenchStats[i];
+		if (s->calls == 0)
+			continue;
+
+		BenchPutsP(HalReadPgmPtr(&gBenchNames[i].function));
+		BenchPutc(',');
+		BenchPutsP(HalReadPgmPtr(&gBenchNames[i].reportCase));
+		BenchPutc(',');
+		BenchPutNumber(s->calls);
+		BenchPutc(',');
+		BenchPutNumber(s->min);
+		BenchPutc(',');
+		BenchPutNumber((s->total + s->calls / 2) / s->calls);
+		BenchPutc(',');
+		BenchPutNumber(s->max);
+		BenchPutc(',');
+		BenchPutNumber(s->midiBytes);
+		BenchPutc('\n');
+		}
+	}
+
+// ---- Report sequence
+
+// Entries are BENCH_CREATE and an effect type, or BENCH_OUT and an output
+// report. BENCH_LAST as the effect block index of a report is replaced by
+// the index the last BENCH_CREATE got.
+#define BENCH_END		0
+#define BENCH_OUT		1
+#define BENCH_CREATE	2
+#define BENCH_LAST		0xFE
+
+static const uint8_t gBenchScript[] PROGMEM =
+	{
+	// Constant
+	BENCH_CREATE, USB_EFFECT_CONSTANT,
+	BENCH_OUT, 2, BENCH_LAST, 0xc8, 0x28, 0x64, 0x00, 0xc8, 0x00,	// Set Envelope
+	BENCH_OUT, 5, BENCH_LAST, 0xc8, 0x00,	// Set Constant Force
+	BENCH_OUT, 1, BENCH_LAST, USB_EFFECT_CONSTANT, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0x04, 0x40, 0x00,	// Set Effect
+	BENCH_OUT, 10, BENCH_LAST, 0x01, 0x01,	// Effect Operation, start
+	BENCH_OUT, 5, BENCH_LAST, 0x88, 0xff,	// Set Constant Force, reversed
+	BENCH_OUT, 1, BENCH_LAST, USB_EFFECT_CONSTANT, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0xc8, 0xff, 0x04, 0x60, 0x00,	// Set Effect, direction and gain changed
+	BENCH_OUT, 10, BENCH_LAST, 0x03, 0x00,	// Effect Operation, stop
+	BENCH_OUT, 11, BENCH_LAST,	// Block Free
+
+	// Ramp
+	BENCH_CREATE, USB_EFFECT_RAMP,
+	BENCH_OUT, 2, BENCH_LAST, 0xc8, 0x28, 0x64, 0x00, 0xc8, 0x00,	// Set Envelope
+	BENCH_OUT, 6, BENCH_LAST, 0x80, 0x7f,	// Set Ramp Force
+	BENCH_OUT, 1, BENCH_LAST, USB_EFFECT_RAMP, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0x04, 0x40, 0x00,	// Set Effect
+	BENCH_OUT, 10, BENCH_LAST, 0x01, 0x01,	// Effect Operation, start
+	BENCH_OUT, 6, BENCH_LAST, 0x7f, 0x80,	// Set Ramp Force, reversed
+	BENCH_OUT, 1, BENCH_LAST, USB_EFFECT_RAMP, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0xc8, 0xff, 0x04, 0x60, 0x00,	// Set Effect, direction and gain changed
+	BENCH_OUT, 10, BENCH_LAST, 0x03, 0x00,	// Effect Operation, stop
+	BENCH_OUT, 11, BENCH_LAST,	// Block Free
+
+	// Square
+	BENCH_CREATE, USB_EFFECT_SQUARE,
+	BENCH_OUT, 2, BENCH_LAST, 0xc8, 0x28, 0x64, 0x00, 0xc8, 0x00,	// Set Envelope
+	BENCH_OUT, 4, BENCH_LAST, 0xb4, 0x00, 0x00, 0x32, 0x00,	// Set Periodic
+	BENCH_OUT, 1, BENCH_LAST, USB_EFFECT_SQUARE, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0x04, 0x40, 0x00,	// Set Effect
+	BENCH_OUT, 10, BENCH_LAST, 0x01, 0x01,	// Effect Operation, start
+	BENCH_OUT, 4, BENCH_LAST, 0x5a, 0x00, 0x00, 0x32, 0x00,	// Set Periodic, magnitude changed
+	BENCH_OUT, 1, BENCH_LAST, USB_EFFECT_SQUARE, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0xc8, 0xff, 0x04, 0x60, 0x00,	// Set Effect, direction and gain changed
+	BENCH_OUT, 10, BENCH_LAST, 0x03, 0x00,	// Effect Operation, stop
+	BENCH_OUT, 11, BENCH_LAST,	// Block Free
+
+	// Sine
+	BENCH_CREATE, USB_EFFECT_SINE,
+	BENCH_OUT, 2, BENCH_LAST, 0xc8, 0x28, 0x64, 0x00, 0xc8, 0x00,	// Set Envelope
+	BENCH_OUT, 4, BENCH_LAST, 0xb4, 0x00, 0x00, 0x32, 0x00,	// Set Periodic
+	BENCH_OUT, 1, BENCH_LAST, USB_EFFECT_SINE, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0x04, 0x40, 0x00,	// Set Effect
+	BENCH_OUT, 10, BENCH_LAST, 0x01, 0x01,	// Effect Operation, start
+	BENCH_OUT, 4, BENCH_LAST, 0x5a, 0x00, 0x00, 0x32, 0x00,	// Set Periodic, magnitude changed
+	BENCH_OUT, 1, BENCH_LAST, USB_EFFECT_SINE, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0xc8, 0xff, 0x04, 0x60, 0x00,	// Set Effect, direction and gain changed
+	BENCH_OUT, 10, BENCH_LAST, 0x03, 0x00,	// Effect Operation, stop
+	BENCH_OUT, 11, BENCH_LAST,	// Block Free
+
+	// Triangle
+	BENCH_CREATE, USB_EFFECT_TRIANGLE,
+	BENCH_OUT, 2, BENCH_LAST, 0xc8, 0x28, 0x64, 0x00, 0xc8, 0x00,	// Set Envelope
+	BENCH_OUT, 4, BENCH_LAST, 0xb4, 0x00, 0x00, 0x32, 0x00,	// Set Periodic
+	BENCH_OUT, 1, BENCH_LAST, USB_EFFECT_TRIANGLE, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0x04, 0x40, 0x00,	// Set Effect
+	BENCH_OUT, 10, BENCH_LAST, 0x01, 0x01,	// Effect Operation, start
+	BENCH_OUT, 4, BENCH_LAST, 0x5a, 0x00, 0x00, 0x32, 0x00,	// Set Periodic, magnitude changed
+	BENCH_OUT, 1, BENCH_LAST, USB_EFFECT_TRIANGLE, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0xc8, 0xff, 0x04, 0x60, 0x00,	// Set Effect, direction and gain changed
+	BENCH_OUT, 10, BENCH_LAST, 0x03, 0x00,	// Effect Operation, stop
+	BENCH_OUT, 11, BENCH_LAST,	// Block Free
+
+	// Sawtoothdown
+	BENCH_CREATE, USB_EFFECT_SAWTOOTHDOWN,
+	BENCH_OUT, 2, BENCH_LAST, 0xc8, 0x28, 0x64, 0x00, 0xc8, 0x00,	// Set Envelope
+	BENCH_OUT, 4, BENCH_LAST, 0xb4, 0x00, 0x00, 0x32, 0x00,	// Set Periodic
+	BENCH_OUT, 1, BENCH_LAST, USB_EFFECT_SAWTOOTHDOWN, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0x04, 0x40, 0x00,	// Set Effect
+	BENCH_OUT, 10, BENCH_LAST, 0x01, 0x01,	// Effect Operation, start
+	BENCH_OUT, 4, BENCH_LAST, 0x5a, 0x00, 0x00, 0x32, 0x00,	// Set Periodic, magnitude changed
+	BENCH_OUT, 1, BENCH_LAST, USB_EFFECT_SAWTOOTHDOWN, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0xc8, 0xff, 0x04, 0x60, 0x00,	// Set Effect, direction and gain changed
+	BENCH_OUT, 10, BENCH_LAST, 0x03, 0x00,	// Effect Operation, stop
+	BENCH_OUT, 11, BENCH_LAST,	// Block Free
+
+	// Sawtoothup
+	BENCH_CREATE, USB_EFFECT_SAWTOOTHUP,
+	BENCH_OUT, 2, BENCH_LAST, 0xc8, 0x28, 0x64, 0x00, 0xc8, 0x00,	// Set Envelope
+	BENCH_OUT, 4, BENCH_LAST, 0xb4, 0x00, 0x00, 0x32, 0x00,	// Set Periodic
+	BENCH_OUT, 1, BENCH_LAST, USB_EFFECT_SAWTOOTHUP, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0x04, 0x40, 0x00,	// Set Effect
+	BENCH_OUT, 10, BENCH_LAST, 0x01, 0x01,	// Effect Operation, start
+	BENCH_OUT, 4, BENCH_LAST, 0x5a, 0x00, 0x00, 0x32, 0x00,	// Set Periodic, magnitude changed
+	BENCH_OUT, 1, BENCH_LAST, USB_EFFECT_SAWTOOTHUP, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0xc8, 0xff, 0x04, 0x60, 0x00,	// Set Effect, direction and gain changed
+	BENCH_OUT, 10, BENCH_LAST, 0x03, 0x00,	// Effect Operation, stop
+	BENCH_OUT, 11, BENCH_LAST,	// Block Free
+
+	// Spring
+	BENCH_CREATE, USB_EFFECT_SPRING,
+	BENCH_OUT, 3, BENCH_LAST, 0x00, 0x80, 0x64,	// Set Condition X
+	BENCH_OUT, 3, BENCH_LAST, 0x01, 0x80, 0x64,	// Set Condition Y
+	BENCH_OUT, 1, BENCH_LAST, USB_EFFECT_SPRING, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0x04, 0x40, 0x00,	// Set Effect
+	BENCH_OUT, 10, BENCH_LAST, 0x01, 0x01,	// Effect Operation, start
+	BENCH_OUT, 3, BENCH_LAST, 0x00, 0x8c, 0x3c,	// Set Condition X, changed
+	BENCH_OUT, 1, BENCH_LAST, USB_EFFECT_SPRING, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0xc8, 0xff, 0x04, 0x60, 0x00,	// Set Effect, direction and gain changed
+	BENCH_OUT, 10, BENCH_LAST, 0x03, 0x00,	// Effect Operation, stop
+	BENCH_OUT, 11, BENCH_LAST,	// Block Free
+
+	// Damper
+	BENCH_CREATE, USB_EFFECT_DAMPER,
+	BENCH_OUT, 3, BENCH_LAST, 0x00, 0x80, 0x64,	// Set Condition X
+	BENCH_OUT, 3, BENCH_LAST, 0x01, 0x80, 0x64,	// Set Condition Y
+	BENCH_OUT, 1, BENCH_LAST, USB_EFFECT_DAMPER, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0x04, 0x40, 0x00,	// Set Effect
+	BENCH_OUT, 10, BENCH_LAST, 0x01, 0x01,	// Effect Operation, start
+	BENCH_OUT, 3, BENCH_LAST, 0x00, 0x8c, 0x3c,	// Set Condition X, changed
+	BENCH_OUT, 1, BENCH_LAST, USB_EFFECT_DAMPER, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0xc8, 0xff, 0x04, 0x60, 0x00,	// Set Effect, direction and gain changed
+	BENCH_OUT, 10, BENCH_LAST, 0x03, 0x00,	// Effect Operation, stop
+	BENCH_OUT, 11, BENCH_LAST,	// Block Free
+
+	// Inertia
+	BENCH_CREATE, USB_EFFECT_INERTIA,
+	BENCH_OUT, 3, BENCH_LAST, 0x00, 0x80, 0x64,	// Set Condition X
+	BENCH_OUT, 3, BENCH_LAST, 0x01, 0x80, 0x64,	// Set Condition Y
+	BENCH_OUT, 1, BENCH_LAST, USB_EFFECT_INERTIA, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0x04, 0x40, 0x00,	// Set Effect
+	BENCH_OUT, 10, BENCH_LAST, 0x01, 0x01,	// Effect Operation, start
+	BENCH_OUT, 3, BENCH_LAST, 0x00, 0x8c, 0x3c,	// Set Condition X, changed
+	BENCH_OUT, 1, BENCH_LAST, USB_EFFECT_INERTIA, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0xc8, 0xff, 0x04, 0x60, 0x00,	// Set Effect, direction and gain changed
+	BENCH_OUT, 10, BENCH_LAST, 0x03, 0x00,	// Effect Operation, stop
+	BENCH_OUT, 11, BENCH_LAST,	// Block Free
+
+	// Friction
+	BENCH_CREATE, USB_EFFECT_FRICTION,
+	BENCH_OUT, 3, BENCH_LAST, 0x00, 0x80, 0x64,	// Set Condition X
+	BENCH_OUT, 3, BENCH_LAST, 0x01, 0x80, 0x64,	// Set Condition Y
+	BENCH_OUT, 1, BENCH_LAST, USB_EFFECT_FRICTION, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0x04, 0x40, 0x00,	// Set Effect
+	BENCH_OUT, 10, BENCH_LAST, 0x01, 0x01,	// Effect Operation, start
+	BENCH_OUT, 3, BENCH_LAST, 0x00, 0x8c, 0x3c,	// Set Condition X, changed
+	BENCH_OUT, 1, BENCH_LAST, USB_EFFECT_FRICTION, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0xc8, 0xff, 0x04, 0x60, 0x00,	// Set Effect, direction and gain changed
+	BENCH_OUT, 10, BENCH_LAST, 0x03, 0x00,	// Effect Operation, stop
+	BENCH_OUT, 11, BENCH_LAST,	// Block Free
+
+	// Device
+	BENCH_OUT, 13, 0xc8,	// Device Gain
+	BENCH_OUT, 12, 0x05,	// Device Control, pause
+	BENCH_OUT, 12, 0x06,	// Device Control, continue
+	BENCH_OUT, 12, 0x03,	// Device Control, stop all
+	BENCH_OUT, 12, 0x01,	// Device Control, enable actuators
+
+	BENCH_END
+	};
+
+static void BenchRunScript(void)
+	{
+	const uint8_t* p = gBenchScript;
+	uint8_t lastEffect = 0;
+	uint8_t entry;
+
+	while ((entry = pgm_read_byte(p++)) != BENCH_END)
+		{
+		if (entry == BENCH_CREATE)
+			{
+			USB_FFBReport_CreateNewEffect_Feature_Data_t request;
+			USB_FFBReport_PIDBlockLoad_Feature_Data_t response;
+			request.reportId = 1;
+			request.effectType = pgm_read_byte(p++);
+			request.byteCount = 0;
+
+			BenchBegin();
+			FfbOnCreateNewEffect(&request, &response);
+			BenchEnd(BENCH_CREATE_NEW_EFFECT);
+
+			lastEffect = response.effectBlockIndex;
+			continue;
+			}
+
+		uint8_t report[16];
+		uint8_t len = FfbOutReportSize(pgm_read_byte(p));
+		memcpy_P(report, p, len);
+		p += len;
+		if (len > 1 && report[1] == BENCH_LAST)
+			report[1] = lastEffect;
+
+		BenchBegin();
+		FfbOnUsbData(report, len);
+		FfbMidiTask();
+		BenchEnd(report[0]);
+		}
+	}
+
+// ---- Single functions
+
+static void BenchSetEffect(void)
+	{
+	static volatile TEffectState effect;
+	USB_FFBReport_SetEffect_Output_Data_t data =
+		{ 1, 2, USB_EFFECT_SINE, 2000, 0, 0, 255, 0xFF, 4, 64, 0 };
+
+	for (uint8_t i = 0; i < 16; i++)
+		{
+		memset((void*) &effect, 0, sizeof(effect));
+		effect.state = MEffectState_Allocated;
+		data.directionX = i * 16;
+
+		BenchBegin();
+		FfbproSetEffect(&data, &effect);
+		BenchEnd(BENCH_SET_EFFECT_NEW);
+
+		effect.state |= MEffectState_SentToJoystick | MEffectState_Playing;
+		data.directionX += 8;
+		data.gain = 128 + i;
+
+		BenchBegin();
+		FfbproSetEffect(&data, &effect);
+		FfbFlushModifies();
+		BenchEnd(BENCH_SET_EFFECT_PLAYING);
+		}
+	}
+
+static void BenchSendSysEx(void)
+	{
+	// A sine download as FfbproCreateNewEffect makes it
+	static const uint8_t sine[] PROGMEM =
+		{
+		0x23, 0x02, 0x7f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7f, 0x64, 0x00,
+		0x10, 0x4e, 0x00, 0x00, 0x00, 0x7f, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x7f,
+		0x00, 0x00, 0x7f,
+		};
+	uint8_t data[sizeof(sine)];
+	memcpy_P(data, sine, sizeof(sine));
+
+	for (uint8_t i = 0; i < 16; i++)
+		{
+		BenchBegin();
+		FfbSendSysEx(0x7f, data, sizeof(data));
+		BenchEnd(BENCH_SEND_SYSEX);
+		}
+	}
+
+static void BenchInputReport(void)
+	{
+	USB_JoystickReport_Data_t report;
+
+	for (uint8_t i = 0; i < 16; i++)
+		{
+		BenchBegin();
+		Joystick_CreateInputReport(INPUT_REPORTID_ALL, &report);
+		BenchEnd(BENCH_INPUT_REPORT);
+		}
+	}
+
+int main(void)
+	{
+	// Timer 1 free running at the CPU clock
+	TCCR1A = 0;
+	TCCR1B = (1<<CS10);
+	TIMSK1 = (1<<TOIE1);
+	sei();
+
+	BenchBegin();
+	BenchEnd(0);
+	gBenchOverhead = gBenchStats[0].min;
+	memset(gBenchStats, 0, sizeof(gBenchStats));
+
+	FfbSetDriver(0);
+	FfbInitMidi();
+	CalInit();
+
+	BenchRunScript();
+	BenchSetEffect();
+	BenchSendSysEx();
+	BenchInputReport();
+
+	BenchPrint();
+
+	// simavr exits when the CPU sleeps with interrupts disabled
+	cli();
+	sleep_enable();
+	sleep_cpu();
+	for (;;)
+		;
+	}
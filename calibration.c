@@ -0,0 +1,276 @@
+/*
+  Force Feedback Joystick
+  Axis calibration and response curves for the joystick input report.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#include "calibration.h"
+
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+
+#include "Joystick.h"
+#include "debug.h"
+
+// Raw value range of each axis and the logical range of its report field
+typedef struct
+	{
+	int16_t	rawMin, rawMax;
+	int16_t	outMin, outCenter, outMax;
+	} TCalAxisRange;
+
+#define ADC_MAX ((1 << ADC_RESULT_BITS) - 1)
+
+static const TCalAxisRange gCalAxisRanges[CAL_AXES] PROGMEM =
+	{
+		{ -512, 511, -512, 0, 511 },	// X
+		{ -512, 511, -512, 0, 511 },	// Y
+		{ -32, 31, 0, 32, 63 },			// Rz
+		{ -64, 63, -64, 0, 63 },		// Throttle
+		{ -ADC_MAX, ADC_MAX, -128, 0, 127 },	// Rudder
+		{ 0, ADC_MAX, 0, 128, 255 },	// Rx
+		{ 0, ADC_MAX, 0, 128, 255 },	// Ry
+	};
+
+// Profiles in the EEPROM. A profile that has never been written reads
+// as the defaults.
+#define CAL_PROFILE_MAGIC 0xCA
+
+typedef struct
+	{
+	uint8_t		magic;	// CAL_PROFILE_MAGIC when written
+	TCalAxis	axes[CAL_AXES];
+	} TCalProfile;
+
+static TCalProfile EEMEM gCalProfiles[CAL_PROFILES];
+static uint8_t EEMEM gCalSelectedProfile;
+
+// One side of the center precomputed so that the deflection maps to
+// 0..0x7fff of the calibrated travel with a shift and a multiply
+typedef struct
+	{
+	uint16_t	deadzone;	// raw units
+	uint16_t	span;		// raw travel past the dead zone
+	uint16_t	scale;		// 0x7fff0000 / (span << shift)
+	uint8_t		shift;		// normalizes span to 0x8000..0xffff
+	} TCalSide;
+
+typedef struct
+	{
+	int16_t		center;
+	TCalSide	neg, pos;
+	uint16_t	lut[CAL_CURVE_POINTS];	// response curve, 0..0x7fff
+	} TCalState;
+
+static TCalState gCalStates[CAL_AXES];
+static uint8_t gCalProfile;
+
+static void CalDefaultAxis(uint8_t axis, TCalAxis* params)
+	{
+	params->min = pgm_read_word(&gCalAxisRanges[axis].rawMin);
+	params->max = pgm_read_word(&gCalAxisRanges[axis].rawMax);
+	params->center = (params->min + params->max + 1) / 2;
+	params->deadzone = 0;
+	for (uint8_t i = 0; i < CAL_CURVE_POINTS; i++)
+		params->curve[i] = ((uint32_t) (i + 1) * 0x7fff) / CAL_CURVE_POINTS;
+	}
+
+static uint8_t CalValidAxis(const TCalAxis* params)
+	{
+	return params->min <= params->center && params->center <= params->max;
+	}
+
+static void CalReadAxis(uint8_t profile, uint8_t axis, TCalAxis* params)
+	{
+	if (eeprom_read_byte(&gCalProfiles[profile].magic) == CAL_PROFILE_MAGIC)
+		{
+		eeprom_read_block(params, &gCalProfiles[profile].axes[axis], sizeof(TCalAxis));
+		if (CalValidAxis(params))
+			return;
+		}
+
+	CalDefaultAxis(axis, params);
+	}
+
+static void CalBuildSide(TCalSide* side, uint16_t travel, uint8_t deadzone)
+	{
+	side->deadzone = ((uint32_t) travel * deadzone) >> 8;
+	side->span = travel - side->deadzone;
+	side->shift = 0;
+	side->scale = 0;
+
+	uint16_t span = side->span;
+	if (span == 0)
+		return;	// everything past the dead zone is full deflection
+
+	while (!(span & 0x8000))
+		{
+		span <<= 1;
+		side->shift++;
+		}
+	side->scale = 0x7fff0000UL / span;
+	}
+
+static void CalBuildAxis(uint8_t axis, const TCalAxis* params)
+	{
+	TCalState* state = &gCalStates[axis];
+
+	state->center = params->center;
+	CalBuildSide(&state->neg, (uint16_t) params->center - (uint16_t) params->min, params->deadzone);
+	CalBuildSide(&state->pos, (uint16_t) params->max - (uint16_t) params->center, params->deadzone);
+
+	for (uint8_t i = 0; i < CAL_CURVE_POINTS; i++)
+		state->lut[i] = (params->curve[i] > 0x7fff) ? 0x7fff : params->curve[i];
+	}
+
+static void CalLoadProfile(uint8_t profile)
+	{
+	TCalAxis params;
+
+	for (uint8_t axis = 0; axis < CAL_AXES; axis++)
+		{
+		CalReadAxis(profile, axis, &params);
+		CalBuildAxis(axis, &params);
+		}
+
+	gCalProfile = profile;
+	}
+
+void CalInit(void)
+	{
+	uint8_t profile = eeprom_read_byte(&gCalSelectedProfile);
+	if (profile >= CAL_PROFILES)
+		profile = 0;	// erased EEPROM
+
+	CalLoadProfile(profile);
+	}
+
+int16_t CalApply(uint8_t axis, int16_t value)
+	{
+	const TCalState* state = &gCalStates[axis];
+	const TCalAxisRange* range = &gCalAxisRanges[axis];
+	int16_t outCenter = pgm_read_word(&range->outCenter);
+	const TCalSide* side;
+	uint16_t deflection, outSpan;
+	uint8_t negative = value < state->center;
+
+	if (negative)
+		{
+		side = &state->neg;
+		deflection = (uint16_t) state->center - (uint16_t) value;
+		outSpan = outCenter - (int16_t) pgm_read_word(&range->outMin);
+		}
+	else
+		{
+		side = &state->pos;
+		deflection = (uint16_t) value - (uint16_t) state->center;
+		outSpan = (int16_t) pgm_read_word(&range->outMax) - outCenter;
+		}
+
+	if (deflection <= side->deadzone)
+		return outCenter;
+	deflection -= side->deadzone;
+
+	// Position within the calibrated travel, 0..0x7fff
+	uint16_t n;
+	if (deflection >= side->span)
+		n = 0x7fff;
+	else
+		n = ((uint32_t) (deflection << side->shift) * side->scale) >> 16;
+
+	// Response curve, linear between the points
+	uint8_t i = n >> 13;
+	uint16_t y0 = i ? state->lut[i - 1] : 0;
+	uint16_t frac = (n & 0x1fff) << 3;
+	int16_t y = y0 + (int16_t) (((int32_t) (int16_t) (state->lut[i] - y0) * frac) >> 16);
+
+	// Scale to the report field with rounding
+	uint16_t delta = ((uint32_t) ((uint16_t) y << 1) * outSpan + 0x8000) >> 16;
+
+	return negative ? outCenter - delta : outCenter + delta;
+	}
+
+uint8_t CalSelectProfile(uint8_t profile)
+	{
+	if (profile >= CAL_PROFILES)
+		return 0;
+
+	eeprom_update_byte(&gCalSelectedProfile, profile);
+	CalLoadProfile(profile);
+	return 1;
+	}
+
+uint8_t CalGetProfile(void)
+	{
+	return gCalProfile;
+	}
+
+uint8_t CalSetAxis(uint8_t axis, const TCalAxis* params)
+	{
+	TCalAxis defaults;
+
+	if (axis >= CAL_AXES)
+		return 0;
+
+	if (params == NULL)
+		{
+		CalDefaultAxis(axis, &defaults);
+		params = &defaults;
+		}
+	else if (!CalValidAxis(params))
+		return 0;
+
+	TCalProfile* profile = &gCalProfiles[gCalProfile];
+	if (eeprom_read_byte(&profile->magic) != CAL_PROFILE_MAGIC)
+		{	// First change to this profile - store the defaults for the other axes
+		TCalAxis other;
+		for (uint8_t i = 0; i < CAL_AXES; i++)
+			{
+			CalDefaultAxis(i, &other);
+			eeprom_update_block(&other, &profile->axes[i], sizeof(TCalAxis));
+			}
+		eeprom_update_byte(&profile->magic, CAL_PROFILE_MAGIC);
+		}
+
+	eeprom_update_block(params, &profile->axes[axis], sizeof(TCalAxis));
+	CalBuildAxis(axis, params);
+	return 1;
+	}
+
+void CalDebugListProfile(void)
+	{
+	TCalAxis params;
+
+	LogTextP(PSTR("Calibration profile="));
+	LogBinaryLf(&gCalProfile, 1);
+
+	for (uint8_t axis = 0; axis < CAL_AXES; axis++)
+		{
+		CalReadAxis(gCalProfile, axis, &params);
+		LogTextP(PSTR(" axis="));
+		LogBinary(&axis, 1);
+		LogTextP(PSTR(": "));
+		LogBinaryLf(&params, sizeof(params));
+		DrainDebugBuffer();
+		}
+	}
@@ -0,0 +1,86 @@
+/*
+  Force Feedback Joystick
+  Axis calibration and response curves for the joystick input report.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#ifndef _CALIBRATION_H_
+#define _CALIBRATION_H_
+
+#include <stdint.h>
+
+// Axes of the input report that go through calibration
+#define CAL_AXIS_X			0
+#define CAL_AXIS_Y			1
+#define CAL_AXIS_RZ			2
+#define CAL_AXIS_THROTTLE	3
+#define CAL_AXIS_RUDDER		4	// pedal2 - pedal1
+#define CAL_AXIS_RX			5	// rudder trim
+#define CAL_AXIS_RY			6	// elevator trim
+#define CAL_AXES			7
+
+// Calibration profiles kept in the EEPROM
+#ifndef CAL_PROFILES
+#define CAL_PROFILES 4
+#endif
+
+// Response curve points per side of the center, at 1/4, 2/4, 3/4 and full
+// deflection past the dead zone. The curve starts from 0 at the dead zone.
+// CalApply() picks the segment with a shift, so this must stay at 4.
+#define CAL_CURVE_POINTS 4
+
+// Calibration of one axis as stored in a profile.
+// <min>, <center> and <max> are in raw axis units (see CalApply).
+typedef struct
+	{
+	int16_t min, center, max;
+	uint8_t deadzone;	// around the center, 1/256 of the travel to either end
+	uint16_t curve[CAL_CURVE_POINTS];	// output 0..0x7fff = 0..full deflection
+	} TCalAxis;
+
+// Loads the profile selected in the EEPROM. Call once at startup.
+void CalInit(void);
+
+// Maps a raw axis value to its input report value through the calibration,
+// dead zone and response curve of the current profile. Raw values are:
+//	X, Y		signed 10-bit stick position
+//	Rz			signed 6-bit twist
+//	Throttle	signed 7-bit
+//	Rudder		pedal2 - pedal1 in ADC_RESULT_BITS
+//	Rx, Ry		trims in ADC_RESULT_BITS
+// Runs in bounded time without divisions.
+int16_t CalApply(uint8_t axis, int16_t value);
+
+// Switches to the given profile and stores it as the one to use on startup.
+// Returns false if there is no such profile.
+uint8_t CalSelectProfile(uint8_t profile);
+uint8_t CalGetProfile(void);
+
+// Stores the calibration of <axis> to the current profile and takes it in use.
+// If <params> is NULL, the axis is reset to the defaults (full raw range,
+// no dead zone, linear response). Returns false if the values are invalid.
+uint8_t CalSetAxis(uint8_t axis, const TCalAxis* params);
+
+void CalDebugListProfile(void);
+
+#endif // _CALIBRATION_H_
@@ -0,0 +1,131 @@
+/*
+  Force Feedback Joystick
+  Capture of the force feedback traffic from the host for replaying it
+  on a PC (see FfbReplay).
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+#include "capture.h"
+
+#if CAPTURE_BUFFER_SIZE > 0
+
+#include "hal.h"
+#include "debug.h"
+
+#if (CAPTURE_BUFFER_SIZE & (CAPTURE_BUFFER_SIZE - 1)) || CAPTURE_BUFFER_SIZE > 32768
+#error "CAPTURE_BUFFER_SIZE must be a power of two no larger than 32768"
+#endif
+
+#define CAPTURE_MASK (CAPTURE_BUFFER_SIZE - 1)
+
+static uint8_t gCaptureBuffer[CAPTURE_BUFFER_SIZE];
+static uint16_t gCaptureHead = 0;	// where the next record goes
+static uint16_t gCaptureTail = 0;	// oldest record
+static uint16_t gCaptureDropped = 0;	// records dropped to make room
+static uint8_t gCaptureOn = 0;
+
+static uint16_t CaptureUsed(void)
+	{
+	return (gCaptureHead - gCaptureTail) & CAPTURE_MASK;
+	}
+
+static void CapturePut(const void *data, uint8_t len)
+	{
+	const uint8_t *p = (const uint8_t*) data;
+
+	while (len--)
+		{
+		gCaptureBuffer[gCaptureHead] = *p++;
+		gCaptureHead = (gCaptureHead + 1) & CAPTURE_MASK;
+		}
+	}
+
+void CaptureStart(void)
+	{
+	gCaptureHead = gCaptureTail = 0;
+	gCaptureDropped = 0;
+	gCaptureOn = 1;
+	}
+
+void CaptureStop(void)
+	{
+	gCaptureOn = 0;
+	}
+
+void CaptureRecord(uint8_t type, const void *data, uint8_t len, const void *data2, uint8_t len2)
+	{
+	if (!gCaptureOn)
+		return;
+
+	uint16_t size = sizeof(TCaptureRecord) + len + len2;
+	if (size > CAPTURE_MASK)
+		return;
+
+	// Drop the oldest records until the new one fits
+	while (CAPTURE_MASK - CaptureUsed() < size)
+		{
+		uint8_t oldLen = gCaptureBuffer[(gCaptureTail + 1) & CAPTURE_MASK];
+		gCaptureTail = (gCaptureTail + sizeof(TCaptureRecord) + oldLen) & CAPTURE_MASK;
+		gCaptureDropped++;
+		}
+
+	TCaptureRecord record;
+	record.type = type;
+	record.len = len + len2;
+	record.timeMs = HalMillis();
+
+	CapturePut(&record, sizeof(record));
+	CapturePut(data, len);
+	if (len2)
+		CapturePut(data2, len2);
+	}
+
+void CaptureDump(void)
+	{
+	uint8_t on = gCaptureOn;
+	gCaptureOn = 0;
+
+	LogTextP(PSTR("Capture records dropped="));
+	LogBinaryLf(&gCaptureDropped, sizeof(gCaptureDropped));
+	DrainDebugBuffer();
+
+	uint16_t pos = gCaptureTail;
+	while (pos != gCaptureHead)
+		{
+		uint8_t size = sizeof(TCaptureRecord) + gCaptureBuffer[(pos + 1) & CAPTURE_MASK];
+
+		LogTextP(PSTR("Cap:"));
+		while (size--)
+			{
+			LogBinary(&gCaptureBuffer[pos], 1);
+			pos = (pos + 1) & CAPTURE_MASK;
+			}
+		LogTextLfP(PSTR(""));
+		DrainDebugBuffer();
+		}
+
+	gCaptureOn = on;
+	}
+
+#endif // CAPTURE_BUFFER_SIZE
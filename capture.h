@@ -0,0 +1,86 @@
+/*
+  Force Feedback Joystick
+  Capture of the force feedback traffic from the host for replaying it
+  on a PC (see FfbReplay).
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdint.h>
+
+// A capture is a sequence of records, each a TCaptureRecord header followed
+// by <len> bytes of data. Multibyte values are little endian.
+//
+// A capture file starts with CAPTURE_FILE_MAGIC and CAPTURE_FILE_VERSION.
+// The dump over the virtual serial port (CaptureDump) has one record per
+// line as "Cap:" followed by the bytes of the record in hex.
+
+#define CAPTURE_FILE_MAGIC		"FFBC"
+#define CAPTURE_FILE_VERSION	1
+
+// Record types and their data
+#define CAPTURE_OUT_REPORT		1	// USB output report as received, starting with the report id
+#define CAPTURE_CREATE_EFFECT	2	// Create New Effect feature request followed by the PID Block Load response
+#define CAPTURE_PID_POOL		3	// PID Pool feature response
+
+typedef struct
+	{
+	uint8_t		type;	// CAPTURE_xxx
+	uint8_t		len;	// data bytes after the header
+	uint16_t	timeMs;	// HalMillis() when received, wraps around
+	} TCaptureRecord;
+
+// Size of the recorder ring in RAM in bytes (power of two). When the ring
+// is full the oldest records are dropped. Define as 0 to leave the
+// recorder out, which is the default as it needs RAM the firmware does
+// not have to spare with the default MIDI buffer sizes.
+#ifndef CAPTURE_BUFFER_SIZE
+#define CAPTURE_BUFFER_SIZE 0
+#endif
+
+#if CAPTURE_BUFFER_SIZE > 0
+
+// Clears the ring and starts recording
+void CaptureStart(void);
+void CaptureStop(void);
+
+// Adds a record if recording. <data2> is appended after <data>.
+void CaptureRecord(uint8_t type, const void *data, uint8_t len, const void *data2, uint8_t len2);
+
+// Writes the records in the ring to the debug log, oldest first.
+// Recording is paused meanwhile.
+void CaptureDump(void);
+
+#else
+
+#define CaptureStart()
+#define CaptureStop()
+#define CaptureRecord(type, data, len, data2, len2)
+#define CaptureDump()
+
+#endif // CAPTURE_BUFFER_SIZE
+
+#endif // _CAPTURE_H_
@@ -29,6 +29,8 @@
 
 #include "debug.h"
 
+#include <stddef.h>
+
 // Various debug target settings
 const uint8_t DEBUG_TO_NONE = 0; // Disable sending debug data
 const uint8_t DEBUG_TO_UART = 1; // Debug data sent to UART-out
@@ -41,9 +43,18 @@ const uint8_t DEBUG_DETAIL = 4; // Include additional details to debug data
 volatile uint8_t gDebugMode = 2; // set this higher if debugging e.g. at startup is needed
 
 #ifdef DEBUG_ENABLE_USB
-// Internal buffer for sending debug data to USB COM-port
+// Ring for sending debug data to USB COM-port. Written by LogSendByte() and
+// read by FlushDebugBuffer(), which never waits for the host.
+#if (DEBUG_BUFFER_SIZE & (DEBUG_BUFFER_SIZE - 1))
+#error "DEBUG_BUFFER_SIZE must be a power of two"
+#endif
+#define DEBUG_BUFFER_MASK (DEBUG_BUFFER_SIZE - 1)
+
 volatile char debug_buffer[DEBUG_BUFFER_SIZE];
-volatile uint16_t debug_buffer_used = 0;
+volatile uint16_t debug_buffer_head = 0;	// where the next byte goes
+volatile uint16_t debug_buffer_tail = 0;	// next byte to send
+volatile uint16_t debug_buffer_since = 0;	// HalMillis() when the ring was last empty
+volatile uint16_t debug_dropped = 0;	// bytes discarded since the last report of them
 #endif
 
 void LogSendData(uint8_t *data, uint16_t len)
@@ -166,28 +177,6 @@ void LogDataLf(const char *text, uint8_t reportId, const void *data, uint16_t le
 	LogBinaryLf(data, len);
 	}
 
-// Log all reports found in the given data (may have one or more)
-void LogReport(const char *text, const uint16_t *reportSizeArray, uint8_t *data, uint16_t len)
-	{
-	if (gDebugMode == DEBUG_TO_NONE)
-		return;
-
-	LogTextP(text);
-
-	uint8_t *p = data;
-
-	while (p < data + len)
-		{
-		uint8_t replen = reportSizeArray[p[0]-1];
-		LogBinary(p, 1);
-		if (replen > 1)
-			LogBinary(&p[1], replen-1);
-		p += replen;
-		}
-	LogSendByte('\r');	// CR+LF
-	LogSendByte('\n');	// CR+LF
-	}
-
 bool DoDebug(const uint8_t type)
 	{
 	return ((gDebugMode & type) == type);
@@ -203,10 +192,19 @@ void LogSendByte(uint8_t data)
 
 	if (gDebugMode & DEBUG_TO_USB)
 		{
-		if (debug_buffer_used >= DEBUG_BUFFER_SIZE)
-			return;	// overflow - discard
-
-		debug_buffer[debug_buffer_used++] = data;
+		uint16_t head = debug_buffer_head;
+		uint16_t used = (head - debug_buffer_tail) & DEBUG_BUFFER_MASK;
+		if (used >= DEBUG_BUFFER_MASK)
+			{	// overflow - discard
+			if (debug_dropped != 0xFFFF)
+				debug_dropped++;
+			return;
+			}
+
+		if (used == 0)
+			debug_buffer_since = HalMillis();
+		debug_buffer[head] = data;
+		debug_buffer_head = (head + 1) & DEBUG_BUFFER_MASK;
 		}
 #endif
 
@@ -214,38 +212,93 @@ void LogSendByte(uint8_t data)
 	if (gDebugMode & DEBUG_TO_UART)
 		{
 		// Wait if a byte is being transmitted
-		while((UCSR1A & (1<<UDRE1)) == 0);
+		while (!HalUartTxReady())
+			HalIdle();
 
-		UDR1 = data;
+		HalUartTx(data);
 		}
 #endif // DEBUG_ENABLE_UART
 	}
 
 
-void FlushDebugBuffer(void)
-	{
 #ifdef DEBUG_ENABLE_USB
-	uint16_t len = debug_buffer_used;	// use this to lessen chance of value changing in the middle of sending it - e.g. in interrupt
+// Hands what the sink takes now to it. Less than a packet goes only when it
+// has waited DEBUG_FLUSH_MS or when <all> is set. Returns the bytes left.
+static uint16_t DebugSend(uint8_t all)
+	{
+	CRITICAL_VAR();
+	ENTER_CRITICAL();
+	uint16_t head = debug_buffer_head;	// LogSendByte() may be called from interrupts
+	uint16_t since = debug_buffer_since;
+	EXIT_CRITICAL();
 
-	if (len == 0)
-		return;
+	uint16_t tail = debug_buffer_tail;
+	uint16_t used = (head - tail) & DEBUG_BUFFER_MASK;
 
-	debug_buffer_used = 0;
+	if (used == 0)
+		{
+		HalLogWrite(NULL, 0);	// end of the transfer
+		return 0;
+		}
+
+	if (!all && (uint16_t) (HalMillis() - since) < DEBUG_FLUSH_MS)
+		used -= used % HAL_LOG_PACKET_SIZE;	// wait for more
+
+	while (used > 0)
+		{
+		uint16_t len = (tail + used > DEBUG_BUFFER_SIZE) ? DEBUG_BUFFER_SIZE - tail : used;	// up to the end of the ring
+		uint16_t sent = HalLogWrite((const void*) &debug_buffer[tail], len);
+		tail = (tail + sent) & DEBUG_BUFFER_MASK;
+		used -= sent;
+		if (sent < len)
+			break;	// the host has not read the previous packets yet
+		}
 
-	// Select the Serial Tx Endpoint
-	Endpoint_SelectEndpoint(CDC1_TX_EPNUM);
+	ENTER_CRITICAL();
+	debug_buffer_tail = tail;
+	used = (debug_buffer_head - tail) & DEBUG_BUFFER_MASK;
+	EXIT_CRITICAL();
 
-	// Write the String to the Endpoint
-	Endpoint_Write_Stream_LE(&debug_buffer, len, NULL);
+	// Report the discarded bytes once there is room for it again
+	if (debug_dropped && DEBUG_BUFFER_MASK - used >= 32)
+		{
+		uint16_t dropped = debug_dropped;
+		debug_dropped = 0;
+		LogTextP(PSTR("Debug log dropped="));
+		LogBinaryLf(&dropped, sizeof(dropped));
+
+		ENTER_CRITICAL();
+		used = (debug_buffer_head - tail) & DEBUG_BUFFER_MASK;
+		EXIT_CRITICAL();
+		}
+
+	return used;
+	}
+#endif // DEBUG_ENABLE_USB
 
-	// Finalize the stream transfer to send the last packet
-	Endpoint_ClearIN();
+void FlushDebugBuffer(void)
+	{
+#ifdef DEBUG_ENABLE_USB
+	DebugSend(0);
+#endif // DEBUG_ENABLE_USB
+	}
 
-	// Wait until the endpoint is ready for another packet
-	Endpoint_WaitUntilReady();
+void DrainDebugBuffer(void)
+	{
+#ifdef DEBUG_ENABLE_USB
+	uint16_t left = DebugSend(1);
+	uint8_t waited = 0;
 
-	// Send an empty packet to ensure that the host does not buffer data sent to it
-	Endpoint_ClearIN();
+	while (left > 0 && waited < DEBUG_DRAIN_TIMEOUT_MS)
+		{
+		HalDelayMs(1);
+		uint16_t now = DebugSend(1);
+		if (now < left)
+			waited = 0;
+		else
+			waited++;
+		left = now;
+		}
 #endif // DEBUG_ENABLE_USB
 	}
 
@@ -30,7 +30,10 @@
 #ifndef _DEBUG_H_
 #define _DEBUG_H_
 
-#include "main.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hal.h"
 
 // Method of debugging
 extern const uint8_t DEBUG_TO_NONE;
@@ -48,7 +51,9 @@ bool DoDebug(const uint8_t type);
 //#define DEBUG_ENABLE_UART
 //#define DEBUG_ENABLE_USB
 
-#define DEBUG_BUFFER_SIZE 512
+#define DEBUG_BUFFER_SIZE 512	// power of two
+#define DEBUG_FLUSH_MS 2
+#define DEBUG_DRAIN_TIMEOUT_MS 100
 
 // Debugging utilities
 
@@ -70,11 +75,18 @@ void LogBinaryLf(const void *data, uint16_t len);	// Adds linefeed
 void LogData(const char *text, uint8_t reportId, const void *data, uint16_t len);
 void LogDataLf(const char *text, uint8_t reportId, const void *data, uint16_t len);	// Adds linefeed
 
-// Log all reports found in the given data (may have one or more)
-// The <text> must point to string in program memory.
-void LogReport(const char *text, const uint16_t *reportSizeArray, uint8_t *data, uint16_t len);
 
 // Debugging utils for USB-serial debugging
+
+// Sends the buffered debug data as far as the host has room for it without
+// waiting. Less than a USB packet is held back until it has waited
+// DEBUG_FLUSH_MS. Bytes logged while the buffer is full are discarded and
+// their count is logged once there is room again.
 void FlushDebugBuffer(void);
 
+// Waits until the buffered debug data has been sent, for long output on
+// request (e.g. listings and dumps) that would not fit otherwise. Gives up
+// if the host does not read any of it in DEBUG_DRAIN_TIMEOUT_MS.
+void DrainDebugBuffer(void);
+
 #endif // _DEBUG_H_
@@ -29,7 +29,7 @@
 #include "ffb-pro.h"
 #include "ffb.h"
 
-#include <util/delay.h>
+#include "hal.h"
 #include "debug.h"
 
 uint8_t FfbproUsbToMidiEffectType(uint8_t usb_effect_type)
@@ -55,52 +55,59 @@ uint8_t FfbproUsbToMidiEffectType(uint8_t usb_effect_type)
 	return usbToMidiEffectType[usb_effect_type];
 }
 
-uint8_t FfbproEffectMemFull(uint8_t new_midi_type)
+uint8_t FfbproDeviceMemFull(uint8_t new_midi_type)
 {
-	uint8_t count_waveform = 0,
-			count_spring = 0, count_damper = 0,
-			count_inertia = 0, count_friction = 0;
-	
-	uint8_t midi_type = new_midi_type; //count the new one first
-	
-	for (uint8_t id = 2; id <= (MAX_EFFECTS + 1); id++) {
-		switch (midi_type) {
-			case 0x12:
-			case 0x06:
-			case 0x05:
-			case 0x02:
-			case 0x08:
-			case 0x0A:
-			case 0x0B:
-				count_waveform++;
-				break;
-			case 0x0D:
-				count_spring++;
-				break;		
-			case 0x0E:
-				count_damper++;
-				break;	
-			case 0x0F:
-				count_inertia++;
-				break;	
-			case 0x10:
-				count_friction++;
-				break;
-//			case 0x01:
-//				count_custom++; //limit of 4
+	switch (new_midi_type) {
+		case 0x12:
+		case 0x06:
+		case 0x05:
+		case 0x02:
+		case 0x03:
+		case 0x08:
+		case 0x0A:
+		case 0x0B: {
+			uint8_t count_waveform = 1 + //count the new one first
+				GetDeviceMidiEffectCount(0x12) + GetDeviceMidiEffectCount(0x06) +
+				GetDeviceMidiEffectCount(0x05) + GetDeviceMidiEffectCount(0x02) +
+				GetDeviceMidiEffectCount(0x03) + GetDeviceMidiEffectCount(0x08) +
+				GetDeviceMidiEffectCount(0x0A) + GetDeviceMidiEffectCount(0x0B);
+			return (count_waveform > 10);
 		}
-		midi_type = GetMidiEffectType(id);
-	}
-	
-	if (count_waveform > 10 || count_spring > 2 || count_damper > 2 || 
-		count_inertia > 2 || count_friction > 2) {
-		return 1;
-	} else {
-		return 0;
+		case 0x0D:	// spring
+		case 0x0E:	// damper
+		case 0x0F:	// inertia
+		case 0x10:	// friction
+			return (GetDeviceMidiEffectCount(new_midi_type) + 1 > 2);
+//		case 0x01:
+//			count_custom++; //limit of 4
 	}
+	return 0;
 	//The FFP limit on all loaded effects is 32 total, but we can't get there with the USB PID supported effects only!
 }
 
+// Returns the group of effect types that share a limit in FfbproDeviceMemFull():
+// the waveforms together, each condition on its own and 0 for the unlimited ones
+uint8_t FfbproDeviceMemGroup(uint8_t midi_type)
+{
+	switch (midi_type) {
+		case 0x12:
+		case 0x06:
+		case 0x05:
+		case 0x02:
+		case 0x03:
+		case 0x08:
+		case 0x0A:
+		case 0x0B:
+			return 1;
+		case 0x0D:	// spring
+		case 0x0E:	// damper
+		case 0x0F:	// inertia
+		case 0x10:	// friction
+			return midi_type;
+	}
+	return 0;
+}
+
 static void FfbproInitPulses(uint8_t count)
 {
 	while (count--) {
@@ -109,7 +116,7 @@ static void FfbproInitPulses(uint8_t count)
 	}
 }
 
-void FfbproEnableInterrupts(void)
+uint8_t FfbproStartupStep(uint8_t step)
 {
 	const uint8_t startupFfbData_0[] = {
 		0xc5, 0x01        // <ProgramChange> 0x01
@@ -155,42 +162,45 @@ void FfbproEnableInterrupts(void)
 		0xa5, 0x7e, 0x01,
 	};
 
-    WaitMs(100);
-
-	FfbPulseX1();
-    WaitMs(7);
-
-	FfbproInitPulses(4);
-	WaitMs(35);
-
-	FfbproInitPulses(3);
-	WaitMs(14);
-
-	FfbproInitPulses(2);
-	WaitMs(78);
-
-	FfbproInitPulses(2);
-    WaitMs(4);
-
-	FfbproInitPulses(3);
-	WaitMs(59);
-
-	FfbproInitPulses(2);
-	
-	// -- START MIDI
-	FfbSendData(startupFfbData_0, sizeof(startupFfbData_0));	// Program change
-	WaitMs(20);
-
-	FfbSendData(startupFfbData_1, sizeof(startupFfbData_1));	// Init
-	WaitMs(57);
-
-	FfbSendData(startupFfbData_2, sizeof(startupFfbData_2));	// Initialize effects data memory
-	FfbSendData(startupFfbData_3, sizeof(startupFfbData_3));	// Initialize effects data memory
-
-	FfbproDeviceControl(USB_DCTRL_RESET); // Leave auto centre on
-	WaitMs(70);
-	
+	switch (step) {
+		case 0:
+			return 100;
+		case 1:
+			FfbPulseX1();
+			return 7;
+		case 2:
+			FfbproInitPulses(4);
+			return 35;
+		case 3:
+			FfbproInitPulses(3);
+			return 14;
+		case 4:
+			FfbproInitPulses(2);
+			return 78;
+		case 5:
+			FfbproInitPulses(2);
+			return 4;
+		case 6:
+			FfbproInitPulses(3);
+			return 59;
+		case 7:
+			FfbproInitPulses(2);
+
+			// -- START MIDI
+			FfbSendData(startupFfbData_0, sizeof(startupFfbData_0));	// Program change
+			return 20;
+		case 8:
+			FfbSendData(startupFfbData_1, sizeof(startupFfbData_1));	// Init
+			return 57;
+		case 9:
+			FfbSendData(startupFfbData_2, sizeof(startupFfbData_2));	// Initialize effects data memory
+			FfbSendData(startupFfbData_3, sizeof(startupFfbData_3));	// Initialize effects data memory
+
+			FfbproDeviceControl(USB_DCTRL_RESET); // Leave auto centre on
+			return 70;
 	}
+	return FFB_STARTUP_DONE;
+}
 
 uint8_t FfbproDeviceControl(uint8_t usb_control)
 {
@@ -216,7 +226,10 @@ uint8_t FfbproDeviceControl(uint8_t usb_control)
 	
 	uint8_t command[2] = {0xc5};
 	command[1] = usbToMidiControl[usb_control-1];
-	FfbSendData(command, sizeof(command));
+	// Reset and Stop All overtake what FfbHandle_DeviceControl() left queued,
+	// the others go after the operations queued before them
+	uint8_t prio = (usb_control == USB_DCTRL_RESET || usb_control == USB_DCTRL_STOPALL) ? MIDI_PRIO_CONTROL : MIDI_PRIO_IN_ORDER;
+	FfbSendMidi(prio, 0, command, sizeof(command));
 	//Is a wait needed here?
 	return 1; //supported command
 }
@@ -230,28 +243,28 @@ const uint8_t* FfbproGetSysExHeader(uint8_t* hdr_len)
 
 // effect operations ---------------------------------------------------------
 
-static void FfbproSendEffectOper(uint8_t effectId, uint8_t operation)
+static void FfbproSendEffectOper(uint8_t effectId, uint8_t operation, uint8_t prio, uint8_t flags)
 {
 	uint8_t midi_cmd[3];
 	midi_cmd[0] = 0xB5;
 	midi_cmd[1] = operation;
 	midi_cmd[2] = effectId;
-	FfbSendData(midi_cmd, 3);
+	FfbSendMidi(prio, effectId | flags, midi_cmd, 3);
 }
 
 void FfbproStartEffect(uint8_t effectId)
 {
-	FfbproSendEffectOper(effectId, 0x20);
+	FfbproSendEffectOper(effectId, 0x20, MIDI_PRIO_OPERATION, MIDI_EFFECT_START);
 }
 
 void FfbproStopEffect(uint8_t effectId)
 {
-	FfbproSendEffectOper(effectId, 0x30);
+	FfbproSendEffectOper(effectId, 0x30, MIDI_PRIO_OPERATION, 0);
 }
 
 void FfbproFreeEffect(uint8_t effectId)
 {
-	FfbproSendEffectOper(effectId, 0x10);
+	FfbproSendEffectOper(effectId, 0x10, MIDI_PRIO_FREE, 0);
 }
 
 // modify operations ---------------------------------------------------------
@@ -259,18 +272,20 @@ void FfbproFreeEffect(uint8_t effectId)
 // Send to MIDI effect data modification to the given address of the given effect
 void FfbproSendModify(uint8_t effectId, uint8_t address, uint16_t value)
 {
+	uint8_t midi_cmd[6];
+
 	// Modify + Address
-	uint8_t midi_cmd[3];
 	midi_cmd[0] = 0xB5;
 	midi_cmd[1] = address;
 	midi_cmd[2] = effectId;
-	FfbSendData(midi_cmd, 3);
 
 	// New value
-	midi_cmd[0] = 0xA5;
-	midi_cmd[1] = value & 0x7F;
-	midi_cmd[2] = (value & 0x7F00) >> 8;
-	FfbSendData(midi_cmd, 3);
+	midi_cmd[3] = 0xA5;
+	midi_cmd[4] = value & 0x7F;
+	midi_cmd[5] = (value & 0x7F00) >> 8;
+
+	// Sent as one message so nothing gets between the address and the value
+	FfbSendMidi(MIDI_PRIO_MODIFY, effectId, midi_cmd, sizeof(midi_cmd));
 }
 
 void FfbproModifyDuration(uint8_t effectState, uint16_t* midi_data_param, uint8_t effectId, uint16_t duration)
@@ -332,6 +347,8 @@ static uint8_t FfbproCalcLevel(uint8_t range, uint8_t usb_level)
 {
 	// Initial levels assume full range - but range is reduced by application of offset
 	// So compensate by increasing levels (attack, magnitude or fade)
+	if (range == 0)
+		range = 255;	// no Set Periodic yet (e.g. the envelope came first), so the full range
 	
 	uint16_t v = ((uint16_t) usb_level * 255) / range; //explicit cast was necessary here to avoid implicit to int16_t and overflow
 	
@@ -788,7 +805,7 @@ int FfbproSetEffect(
 	
 	// Data applying to all effects
 	uint16_t buttonBits = 0;
-	if (data->triggerButton != USB_TRIGGERBUTTON_NULL)		
+	if (data->triggerButton <= 8)	// else USB_TRIGGERBUTTON_NULL or out of range
 		buttonBits = (1 << data->triggerButton);
 	//Buttons 1-9 from LSB
 	FfbSetParamMidi_14bit(effect->state, &(midi_data->triggerButton), eid, 
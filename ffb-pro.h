@@ -94,7 +94,7 @@ typedef struct
 	uint8_t usb_gain;
 	} FFP_Share_Condition;
 
-void FfbproEnableInterrupts(void);
+uint8_t FfbproStartupStep(uint8_t step);
 uint8_t FfbproDeviceControl(uint8_t usb_control);
 const uint8_t* FfbproGetSysExHeader(uint8_t* hdr_len);
 
@@ -116,7 +116,8 @@ int  FfbproSetEffect(USB_FFBReport_SetEffect_Output_Data_t *data, volatile TEffe
 void FfbproCreateNewEffect(USB_FFBReport_CreateNewEffect_Feature_Data_t* inData, volatile TEffectState* effect);
 
 uint8_t FfbproUsbToMidiEffectType(uint8_t usb_effect_type);
-uint8_t FfbproEffectMemFull(uint8_t new_midi_type);
+uint8_t FfbproDeviceMemFull(uint8_t new_midi_type);
+uint8_t FfbproDeviceMemGroup(uint8_t midi_type);
 
 #define FFP_MIDI_MODIFY_DURATION		0x40
 #define FFP_MIDI_MODIFY_TRIGGERBUTTON	0x44
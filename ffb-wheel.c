@@ -23,8 +23,7 @@
 
 #include "ffb-wheel.h"
 
-#include <LUFA/Drivers/Board/LEDs.h>
-#include <util/delay.h>
+#include "hal.h"
 
 uint8_t FfbwheelUsbToMidiEffectType(uint8_t usb_effect_type)
 {
@@ -49,11 +48,16 @@ uint8_t FfbwheelUsbToMidiEffectType(uint8_t usb_effect_type)
 	return usbToMidiEffectType[usb_effect_type];
 }
 
-uint8_t FfbwheelEffectMemFull(uint8_t new_midi_type)
+uint8_t FfbwheelDeviceMemFull(uint8_t new_midi_type)
 {
 	return 0; //Supported quantities of each effect not yet known
 }
 
+uint8_t FfbwheelDeviceMemGroup(uint8_t midi_type)
+{
+	return 0;
+}
+
 /**
  * Initialize wheel for FF. Releases spring effect.
  *
@@ -61,7 +65,7 @@ uint8_t FfbwheelEffectMemFull(uint8_t new_midi_type)
  * X1 pulse groups during initialization, but
  * those are not needed for enabling FF.
  */
-void FfbwheelEnableInterrupts(void)
+uint8_t FfbwheelStartupStep(uint8_t step)
 	{
 	
 	const uint8_t startupFfbWheelData_0[] = {
@@ -75,13 +79,17 @@ void FfbwheelEnableInterrupts(void)
 		0xf1 ,0x0b ,0x46 ,0x01 ,0x7d ,0x00,
 	};
 	
-    WaitMs(100);
-
-	FfbSendData(startupFfbWheelData_0, sizeof(startupFfbWheelData_0));
-	FfbSendData(startupFfbWheelData_1, sizeof(startupFfbWheelData_1));
-	FfbwheelDeviceControl(USB_DCTRL_RESET); // Leave auto centre on
-	
-	WaitMs(100);
+	switch (step)
+		{
+		case 0:
+			return 100;
+		case 1:
+			FfbSendData(startupFfbWheelData_0, sizeof(startupFfbWheelData_0));
+			FfbSendData(startupFfbWheelData_1, sizeof(startupFfbWheelData_1));
+			FfbwheelDeviceControl(USB_DCTRL_RESET); // Leave auto centre on
+			return 100;
+		}
+	return FFB_STARTUP_DONE;
 	}
 
 uint8_t FfbwheelDeviceControl(uint8_t usb_control)
@@ -104,7 +112,7 @@ uint8_t FfbwheelDeviceControl(uint8_t usb_control)
 		return 0; //not supported
 	}
 
-	FfbSendData(command, sizeof(command));
+	FfbSendMidi(MIDI_PRIO_CONTROL, 0, command, sizeof(command));
 	//Is a wait needed?
 	return 1; //supported command
 }
@@ -118,7 +126,7 @@ const uint8_t* FfbwheelGetSysExHeader(uint8_t* hdr_len)
 
 // effect operations ---------------------------------------------------------
 
-static void FfbwheelSendEffectOper(uint8_t effectId, uint8_t operation)
+static void FfbwheelSendEffectOper(uint8_t effectId, uint8_t operation, uint8_t prio, uint8_t flags)
 {
 	cmd_f2_t op;
 	
@@ -132,22 +140,22 @@ static void FfbwheelSendEffectOper(uint8_t effectId, uint8_t operation)
 	op.operation_and_checksum &= 0xf0;
 	op.operation_and_checksum |= sum;
 	
-	FfbSendData((const uint8_t*)&op, sizeof(op));
+	FfbSendMidi(prio, effectId | flags, (const uint8_t*)&op, sizeof(op));
 }
 
 void FfbwheelStartEffect(uint8_t effectId)
 {
-	FfbwheelSendEffectOper(effectId, 2);
+	FfbwheelSendEffectOper(effectId, 2, MIDI_PRIO_OPERATION, MIDI_EFFECT_START);
 }
 
 void FfbwheelStopEffect(uint8_t effectId)
 {
-	FfbwheelSendEffectOper(effectId, 3);
+	FfbwheelSendEffectOper(effectId, 3, MIDI_PRIO_OPERATION, 0);
 }
 
 void FfbwheelFreeEffect(uint8_t effectId)
 {
-	FfbwheelSendEffectOper(effectId, 1);
+	FfbwheelSendEffectOper(effectId, 1, MIDI_PRIO_FREE, 0);
 }
 
 // modify operations ---------------------------------------------------------
@@ -165,7 +173,7 @@ void FfbwheelSendModify(uint8_t effectId, uint8_t address, uint16_t value)
 	uint8_t sum = d[0] + (d[2] & ~0x40) + d[3] + d[4] + d[5];
 	op.checksum = (0x80 - sum) & 0x7f;
 	
-	FfbSendData(d, sizeof(op));
+	FfbSendMidi(MIDI_PRIO_MODIFY, effectId, d, sizeof(op));
 }
 
 void FfbwheelModifyDuration(uint8_t effectState, uint16_t* midi_data_param, uint8_t effectId, uint16_t duration)
@@ -177,7 +185,7 @@ void FfbwheelModifyDuration(uint8_t effectState, uint16_t* midi_data_param, uint
 void FfbwheelModifyDeviceGain(uint8_t gain)
 { // TO IMPLEMENT: CHANGED FOR COMPATIBILITY - NOT TESTED FOR WHEEL
 	static const uint8_t gainCommand[] = {0xf1, 0x10, 0x40, 0x00, 0x7f, 0x00}; // only sends max gain for now
-	FfbSendData(gainCommand, sizeof(gainCommand));
+	FfbSendMidi(MIDI_PRIO_MODIFY, 0, gainCommand, sizeof(gainCommand));
 
 }
 
@@ -97,7 +97,7 @@ typedef struct
 	uint8_t 	force_direction;
 } cmd_f0_constant_force_t;
 
-void FfbwheelEnableInterrupts(void);
+uint8_t FfbwheelStartupStep(uint8_t step);
 uint8_t FfbwheelDeviceControl(uint8_t usb_control);
 const uint8_t* FfbwheelGetSysExHeader(uint8_t* hdr_len);
 
@@ -119,6 +119,7 @@ int  FfbwheelSetEffect(USB_FFBReport_SetEffect_Output_Data_t *data, volatile TEf
 void FfbwheelCreateNewEffect(USB_FFBReport_CreateNewEffect_Feature_Data_t* inData, volatile TEffectState* effect);
 
 uint8_t FfbwheelUsbToMidiEffectType(uint8_t usb_effect_type);
-uint8_t FfbwheelEffectMemFull(uint8_t new_midi_type);
+uint8_t FfbwheelDeviceMemFull(uint8_t new_midi_type);
+uint8_t FfbwheelDeviceMemGroup(uint8_t midi_type);
 
 #endif // _FFB_WHEEL_
\ No newline at end of file
@@ -29,13 +29,12 @@
 #include "ffb.h"
 
 #include <stdint.h>
-#include <avr/io.h>
-#include <util/delay.h>
-#include <LUFA/Drivers/Board/LEDs.h>
+#include <string.h>
 
-#include "Joystick.h"
+#include "hal.h"
 #include "debug.h"
-#include "3DPro.h"
+#include "latency.h"
+#include "trace.h"
 
 #include "ffb-pro.h"
 #include "ffb-wheel.h"
@@ -45,11 +44,12 @@
 const FFB_Driver ffb_drivers[2] =
 	{
 		{
-		.EnableInterrupts = FfbproEnableInterrupts,
+		.StartupStep = FfbproStartupStep,
 		.GetSysExHeader = FfbproGetSysExHeader,
 		.DeviceControl = FfbproDeviceControl,
 		.UsbToMidiEffectType = FfbproUsbToMidiEffectType,
-		.EffectMemFull = FfbproEffectMemFull,
+		.DeviceMemFull = FfbproDeviceMemFull,
+		.DeviceMemGroup = FfbproDeviceMemGroup,
 		.StartEffect = FfbproStartEffect,
 		.StopEffect = FfbproStopEffect,
 		.FreeEffect = FfbproFreeEffect,
@@ -65,11 +65,12 @@ const FFB_Driver ffb_drivers[2] =
 		.SendModify = FfbproSendModify,
 		},
 		{
-		.EnableInterrupts = FfbwheelEnableInterrupts,
+		.StartupStep = FfbwheelStartupStep,
 		.GetSysExHeader = FfbwheelGetSysExHeader,
 		.DeviceControl = FfbwheelDeviceControl,
 		.UsbToMidiEffectType = FfbwheelUsbToMidiEffectType,
-		.EffectMemFull = FfbwheelEffectMemFull,
+		.DeviceMemFull = FfbwheelDeviceMemFull,
+		.DeviceMemGroup = FfbwheelDeviceMemGroup,
 		.StartEffect = FfbwheelStartEffect,
 		.StopEffect = FfbwheelStopEffect,
 		.FreeEffect = FfbwheelFreeEffect,
@@ -89,7 +90,19 @@ const FFB_Driver ffb_drivers[2] =
 static const FFB_Driver* ffb;
 
 // Effect management
-volatile uint8_t nextEID = 2;	// FFP effect indexes starts from 2 (yes, we waste memory for two effects...)
+
+#if MAX_EFFECTS > 31 || MAX_DEVICE_EFFECTS > 30
+#error "Effect ids must fit into the 32-bit free effect bitmaps"
+#endif
+
+#define EFFECT_BIT(id) ((uint32_t) 1 << (id))
+
+// Free effect ids as set bits so that the lowest free id is found in constant time.
+// FFP effect indexes starts from 2 (yes, we waste memory for two effects...)
+#define ALL_EFFECTS_FREE		(EFFECT_BIT(MAX_EFFECTS) - EFFECT_BIT(2))
+#define ALL_DEVICE_EFFECTS_FREE	(EFFECT_BIT(MAX_DEVICE_EFFECTS + 1) - EFFECT_BIT(2))
+
+static uint32_t gFreeEffects = ALL_EFFECTS_FREE;
 volatile USB_FFBReport_PIDStatus_Input_Data_t pidState;	// For holding device status flags
 
 void SendPidStateForEffect(uint8_t eid, uint8_t effectState);
@@ -104,12 +117,50 @@ static volatile TEffectState gEffectStates[MAX_EFFECTS+1];	// one for each effec
 
 volatile TDisabledEffectTypes gDisabledEffects;
 
+volatile TEffectDownloadStats gEffectDownloadStats;
+
+// Effects in the joystick. The joystick gives each downloaded effect the lowest
+// free effect id of its own. That is mirrored here so that the effects can be
+// downloaded in any order.
+#define MDeviceEffect_Free		0x00
+#define MDeviceEffect_Used		0x01	// holds our effect <effectId>
+#define MDeviceEffect_Cached	0x02	// holds a freed effect whose data hashes to <hash>
+
+typedef struct
+	{
+	uint8_t state;	// see constants <MDeviceEffect_*>
+	uint8_t effectId;	// our effect when used
+	uint8_t midiType;	// waveform of the downloaded effect
+	uint16_t lastUse;	// <gDeviceEffectClock> when last downloaded, started or freed
+	uint32_t hash;
+	} TDeviceEffect;
+
+static TDeviceEffect gDeviceEffects[MAX_DEVICE_EFFECTS+1];	// indexed by the joystick's effect id
+static uint32_t gFreeDeviceEffects = ALL_DEVICE_EFFECTS_FREE;
+static uint8_t gDeviceEffectTypeCounts[MIDI_EFFECT_TYPES];	// effects in the joystick by waveform
+static uint16_t gDeviceEffectClock = 0;	// counts uses of the joystick's effects
+static int16_t gDeviceGain = -1;	// last device gain from the host, -1 if none
+
+// Re-initialization of the joystick by FfbReinitJoystick(): the next step
+// of the start-up sequence + 1 (0 if not running) and the wait before it
+static uint8_t gReinitStep = 0;
+static uint8_t gReinitWait;
+static uint16_t gReinitWaitStart;	// HalMillis()
+
 uint8_t GetNextFreeEffect(void);
 void StartEffect(uint8_t id);
 void StopEffect(uint8_t id);
 void StopAllEffects(void);
 void FreeEffect(uint8_t id);
 void FreeAllEffects(void);
+static uint8_t DeviceEffectId(uint8_t id);
+static uint8_t SysExLength(uint8_t len);
+static uint32_t EffectDataHash(volatile uint8_t *data, uint8_t len);
+static void ReleaseDeviceEffect(uint8_t did);
+static uint8_t EvictDeviceEffect(uint8_t group);
+static uint8_t DeviceHasRoom(uint8_t midiType);
+static void DownloadEffect(uint8_t id);
+static void ReinitTask(void);
 
 void FfbSetDriver(uint8_t id)
 {
@@ -118,18 +169,11 @@ void FfbSetDriver(uint8_t id)
 
 uint8_t GetNextFreeEffect(void)
 	{
-	if (nextEID == MAX_EFFECTS)
+	if (gFreeEffects == 0)
 		return 0;
 
-	uint8_t id = nextEID++;
-
-	// Find the next free effect ID for next time
-	while (gEffectStates[nextEID].state != 0)
-		{
-		if (nextEID >= MAX_EFFECTS)
-			break;	// the last spot was taken
-		nextEID++;
-		}
+	uint8_t id = __builtin_ctzl(gFreeEffects);
+	gFreeEffects &= ~EFFECT_BIT(id);
 
 	gEffectStates[id].state = MEffectState_Allocated;
 	memset((void*) &gEffectStates[id].data, 0, sizeof(gEffectStates[id].data));
@@ -145,6 +189,16 @@ void StopAllEffects(void)
 
 void StartEffect(uint8_t id)
 	{
+	if (id == 0x7F)
+		{
+		for (id = 2; id <= MAX_EFFECTS; id++)
+			{
+			if (gEffectStates[id].state != MEffectState_Free)
+				StartEffect(id);
+			}
+		return;
+		}
+
 	if (id > MAX_EFFECTS)
 		return;
 	gEffectStates[id].state |= MEffectState_Playing;
@@ -155,8 +209,9 @@ void StopEffect(uint8_t id)
 	if (id > MAX_EFFECTS)
 		return;
 	gEffectStates[id].state &= ~MEffectState_Playing;
-	if (!gDisabledEffects.effectId[id])
-		ffb->StopEffect(id);
+	uint8_t did = gEffectStates[id].deviceId;
+	if (did && !gDisabledEffects.effectId[id])
+		ffb->StopEffect(did);
 	}
 
 void FreeEffect(uint8_t id)
@@ -164,17 +219,272 @@ void FreeEffect(uint8_t id)
 	if (id > MAX_EFFECTS)
 		return;
 
-	gEffectStates[id].state = 0;
-	if (id < nextEID)
-		nextEID = id;
-		
-	ffb->FreeEffect(id);
+	volatile TEffectState* effect = &gEffectStates[id];
+	uint8_t did = effect->deviceId;
+
+	if ((effect->state & (MEffectState_Staged | MEffectState_SentToJoystick)) == MEffectState_Staged)
+		gEffectDownloadStats.bytesSaved += SysExLength(effect->dataLen);
+
+	uint8_t discarded = FfbDiscardModifies(id);
+	if (did)
+		{	// Nothing to free in the joystick if the effect was never downloaded
+#if FFB_REUSE_EFFECTS
+		if (!discarded)
+			{	// The joystick has the same data as we do - keep it there for reuse
+			gDeviceEffects[did].state = MDeviceEffect_Cached;
+			gDeviceEffects[did].lastUse = gDeviceEffectClock++;
+			gDeviceEffects[did].hash = EffectDataHash(effect->data, effect->dataLen);
+			ffb->StopEffect(did);
+			}
+		else
+#endif
+			{
+			ReleaseDeviceEffect(did);
+			ffb->FreeEffect(did);
+			}
+		}
+
+	if (effect->state != MEffectState_Free)
+		gFreeEffects |= EFFECT_BIT(id);
+	effect->state = 0;
+	effect->deviceId = 0;
 	}
 
 void FreeAllEffects(void)
 	{
-	nextEID = 2;
+	FfbDiscardModifies(0x7F);
+	for (uint8_t id = 2; id <= MAX_EFFECTS; id++)
+		{
+		if ((gEffectStates[id].state & (MEffectState_Staged | MEffectState_SentToJoystick)) == MEffectState_Staged)
+			gEffectDownloadStats.bytesSaved += SysExLength(gEffectStates[id].dataLen);
+		}
+	gFreeEffects = ALL_EFFECTS_FREE;
 	memset((void*) gEffectStates, 0, sizeof(gEffectStates));
+	gFreeDeviceEffects = ALL_DEVICE_EFFECTS_FREE;
+	memset(gDeviceEffects, 0, sizeof(gDeviceEffects));
+	memset(gDeviceEffectTypeCounts, 0, sizeof(gDeviceEffectTypeCounts));
+	}
+
+// Marks the given joystick effect id free
+static void ReleaseDeviceEffect(uint8_t did)
+	{
+	TDeviceEffect *d = &gDeviceEffects[did];
+	if (d->state == MDeviceEffect_Free)
+		return;
+
+	d->state = MDeviceEffect_Free;
+	gFreeDeviceEffects |= EFFECT_BIT(did);
+	if (d->midiType < MIDI_EFFECT_TYPES)
+		gDeviceEffectTypeCounts[d->midiType]--;
+	}
+
+// Returns the number of effects of the given waveform in the joystick
+uint8_t GetDeviceMidiEffectCount(uint8_t midiType)
+	{
+	if (midiType >= MIDI_EFFECT_TYPES)
+		return 0;
+	return gDeviceEffectTypeCounts[midiType];
+	}
+
+// Returns the waveform of the effect with the given joystick effect id (0xFF if none)
+uint8_t GetDeviceMidiEffectType(uint8_t did)
+	{
+	if (did > MAX_DEVICE_EFFECTS || gDeviceEffects[did].state == MDeviceEffect_Free)
+		return 0xFF;
+	return gDeviceEffects[did].midiType;
+	}
+
+// Returns the joystick's id for the given effect (0 if not in the joystick)
+static uint8_t DeviceEffectId(uint8_t id)
+	{
+	if (id == 0x7F)
+		return 0x7F;	// all effects
+	if (id > MAX_EFFECTS)
+		return 0;
+
+	uint8_t did = gEffectStates[id].deviceId;
+	if (did)
+		gDeviceEffects[did].lastUse = gDeviceEffectClock++;
+	return did;
+	}
+
+// Returns the number of MIDI bytes needed to download effect data of the given length
+static uint8_t SysExLength(uint8_t len)
+	{
+	uint8_t hdr_len;
+	ffb->GetSysExHeader(&hdr_len);
+	return hdr_len + len + 2;	// + checksum and SysEx end
+	}
+
+// FNV-1a hash of the effect data for finding identical effects in the joystick
+static uint32_t EffectDataHash(volatile uint8_t *data, uint8_t len)
+	{
+	uint32_t hash = 2166136261UL ^ len;
+	while (len--)
+		{
+		hash ^= *data++;
+		hash *= 16777619UL;
+		}
+	return hash;
+	}
+
+// True if the given joystick effect can be removed: a freed effect kept for
+// reuse or one that is not playing. The host may still count on a started
+// effect, however long ago that was.
+static uint8_t DeviceEffectEvictable(uint8_t did)
+	{
+	TDeviceEffect *d = &gDeviceEffects[did];
+	if (d->state == MDeviceEffect_Cached)
+		return 1;
+	return d->state == MDeviceEffect_Used && !(gEffectStates[d->effectId].state & MEffectState_Playing);
+	}
+
+// Returns the effect least worth keeping in the joystick among those of the
+// given limit group (0 for any): first the freed effects kept for reuse, then
+// the effects not playing, each in least recently used order. 0 if none.
+static uint8_t EvictionVictim(uint8_t group)
+	{
+	uint8_t victim = 0, victimRank = 0;
+	uint16_t victimAge = 0;
+
+	for (uint8_t did = 2; did <= MAX_DEVICE_EFFECTS; did++)
+		{
+		if (!DeviceEffectEvictable(did))
+			continue;
+		if (group != 0 && ffb->DeviceMemGroup(gDeviceEffects[did].midiType) != group)
+			continue;
+
+		TDeviceEffect *d = &gDeviceEffects[did];
+		uint8_t rank = (d->state == MDeviceEffect_Cached) ? 2 : 1;
+
+		uint16_t age = gDeviceEffectClock - d->lastUse;
+		if (rank > victimRank || (rank == victimRank && age > victimAge))
+			{
+			victim = did;
+			victimRank = rank;
+			victimAge = age;
+			}
+		}
+	return victim;
+	}
+
+// True if an effect of the given waveform fits into the joystick, now or
+// after removing effects with EvictDeviceEffect(). When the joystick has no
+// memory left for the type, only an effect of the same limit group makes room.
+static uint8_t DeviceHasRoom(uint8_t midiType)
+	{
+	uint8_t full = ffb->DeviceMemFull(midiType);
+	if (gFreeDeviceEffects != 0 && !full)
+		return 1;
+	return EvictionVictim(full ? ffb->DeviceMemGroup(midiType) : 0) != 0;
+	}
+
+// Makes room in the joystick by removing the effect least worth keeping there
+// among those of the given limit group (0 for any). Removing one of the same
+// group frees both an id and the memory for its type. Returns 0 if nothing
+// could be removed.
+static uint8_t EvictDeviceEffect(uint8_t group)
+	{
+	uint8_t victim = EvictionVictim(group);
+	if (victim == 0)
+		return 0;
+
+	Trace1(TRACE_EVICT, victim);
+
+	TDeviceEffect *d = &gDeviceEffects[victim];
+	if (d->state == MDeviceEffect_Used)
+		{	// Back to RAM only - downloaded again when next started
+		volatile TEffectState* effect = &gEffectStates[d->effectId];
+		FfbDiscardModifies(d->effectId);
+		effect->state &= ~MEffectState_SentToJoystick;
+		effect->state |= MEffectState_Evicted;
+		effect->deviceId = 0;
+		}
+
+	ReleaseDeviceEffect(victim);
+	ffb->FreeEffect(victim);
+	gEffectDownloadStats.evicted++;
+	return 1;
+	}
+
+// Downloads the given effect (0x7F for all effects) to the joystick if its
+// data has been set but it is not in the joystick yet.
+static void DownloadEffect(uint8_t id)
+	{
+	if (id == 0x7F)
+		{
+		for (id = 2; id <= MAX_EFFECTS; id++)
+			DownloadEffect(id);
+		return;
+		}
+
+	if (id > MAX_EFFECTS)
+		return;
+
+	if (gReinitStep != 0)
+		return;	// the joystick is being set up, downloaded once it is done
+
+	volatile TEffectState* effect = &gEffectStates[id];
+	if ((effect->state & (MEffectState_Staged | MEffectState_SentToJoystick)) != MEffectState_Staged)
+		return;
+
+	uint8_t did;
+	uint8_t midiType = ((midi_data_common_t*)effect->data)->waveForm;
+
+#if FFB_REUSE_EFFECTS
+	// Take over an identical effect if the joystick still has one
+	uint32_t hash = EffectDataHash(effect->data, effect->dataLen);
+	for (did = 2; did <= MAX_DEVICE_EFFECTS; did++)
+		{
+		if (gDeviceEffects[did].state == MDeviceEffect_Cached && gDeviceEffects[did].hash == hash)
+			{
+			gDeviceEffects[did].state = MDeviceEffect_Used;
+			gDeviceEffects[did].effectId = id;
+			gDeviceEffects[did].lastUse = gDeviceEffectClock++;
+			effect->deviceId = did;
+			effect->state |= MEffectState_SentToJoystick;
+			effect->state &= ~MEffectState_Evicted;
+			gEffectDownloadStats.reused++;
+			gEffectDownloadStats.bytesSaved += SysExLength(effect->dataLen);
+			return;
+			}
+		}
+#endif
+
+	// The joystick takes the lowest free id. Make room if there is none
+	// or if the joystick has no memory left for this type of effect.
+	for (;;)
+		{
+		uint8_t full = ffb->DeviceMemFull(midiType);
+		if (gFreeDeviceEffects != 0 && !full)
+			break;
+
+		if (!EvictDeviceEffect(full ? ffb->DeviceMemGroup(midiType) : 0))
+			{	// Everything in the joystick is playing - can't play this one
+			gEffectDownloadStats.noRoom++;
+			return;
+			}
+		}
+
+	did = __builtin_ctzl(gFreeDeviceEffects);
+	gFreeDeviceEffects &= ~EFFECT_BIT(did);
+	if (midiType < MIDI_EFFECT_TYPES)
+		gDeviceEffectTypeCounts[midiType]++;
+
+	gDeviceEffects[did].state = MDeviceEffect_Used;
+	gDeviceEffects[did].effectId = id;
+	gDeviceEffects[did].midiType = midiType;
+	gDeviceEffects[did].lastUse = gDeviceEffectClock++;
+	effect->deviceId = did;
+	Trace2(TRACE_DOWNLOAD, id, did);
+	FfbSendSysEx(did, (const uint8_t*)effect->data, effect->dataLen);
+	effect->state |= MEffectState_SentToJoystick;
+	gEffectDownloadStats.downloaded++;
+	if (effect->state & MEffectState_Evicted)
+		{
+		effect->state &= ~MEffectState_Evicted;
+		gEffectDownloadStats.redownloaded++;
+		}
 	}
 
 // Utilities
@@ -189,22 +499,24 @@ uint8_t GetMidiEffectType(uint8_t id)
 	}
 }
 
-void FfbSendSysEx(const uint8_t* midi_data, uint8_t len)
+void FfbSendSysEx(uint8_t effectId, const uint8_t* midi_data, uint8_t len)
 {	
 	uint8_t hdr_len;
 	const uint8_t*	hdr = ffb->GetSysExHeader(&hdr_len); // header includes the first 0xF0
-	FfbSendData(hdr, hdr_len);
+	FfbBeginMidi(MIDI_PRIO_DOWNLOAD, effectId, hdr_len + len + 2);
+	FfbAppendMidi(hdr, hdr_len);
 	
-	FfbSendData((uint8_t*) midi_data, len);
+	FfbAppendMidi(midi_data, len);
 	
 	uint8_t checksum = 0;
 	while (len--)
 		checksum += *midi_data++;
 	checksum = (0x80-checksum) & 0x7f;
-	FfbSendData(&checksum, 1);
+	FfbAppendMidi(&checksum, 1);
 
 	uint8_t mark = 0xF7;	// SysEx End
-	FfbSendData(&mark, 1);
+	FfbAppendMidi(&mark, 1);
+	FfbEndMidi();
 }
 
 uint8_t FfbSetParamMidi_14bit(uint8_t effectState, volatile uint16_t* midi_data_param, uint8_t effectId, uint8_t address, uint16_t value)
@@ -215,7 +527,7 @@ uint8_t FfbSetParamMidi_14bit(uint8_t effectState, volatile uint16_t* midi_data_
 		{
 		*midi_data_param = value;
 		if (effectState & MEffectState_SentToJoystick)
-			ffb->SendModify(effectId, address, value);
+			FfbQueueModify(effectId, address, value);
 		return 1;
 		}
 	}
@@ -228,11 +540,129 @@ uint8_t FfbSetParamMidi_7bit(uint8_t effectState, volatile uint8_t* midi_data_pa
 		{
 		*midi_data_param = value;
 		if (effectState & MEffectState_SentToJoystick)
-			ffb->SendModify(effectId, address, value);
+			FfbQueueModify(effectId, address, value);
 		return 1;
 		}
 	}	
 
+// ----------------------------------------------
+// Coalescing queue for effect parameter modifies
+// ----------------------------------------------
+
+// Modifies are held here until the MIDI line is idle. A newer value for the
+// same effect and address replaces the queued one, so a burst of updates to
+// e.g. a constant force magnitude only sends the latest value to the joystick.
+
+#if MIDI_MODIFY_QUEUE_SIZE > 0
+
+typedef struct
+	{
+	uint8_t effectId;
+	uint8_t address;
+	uint16_t value;
+	} TPendingModify;
+
+static TPendingModify gPendingModifies[MIDI_MODIFY_QUEUE_SIZE];
+static uint8_t gPendingModifyCount = 0;
+
+#endif
+
+volatile TModifyQueueStats gModifyQueueStats;
+
+#if MIDI_MODIFY_QUEUE_SIZE > 0
+// Sends the oldest pending modify
+static void SendFirstPendingModify(void)
+	{
+	ffb->SendModify(DeviceEffectId(gPendingModifies[0].effectId), gPendingModifies[0].address, gPendingModifies[0].value);
+	gPendingModifyCount--;
+	for (uint8_t i = 0; i < gPendingModifyCount; i++)
+		gPendingModifies[i] = gPendingModifies[i+1];
+	}
+#endif
+
+void FfbQueueModify(uint8_t effectId, uint8_t address, uint16_t value)
+	{
+	gModifyQueueStats.queued++;
+
+#if MIDI_MODIFY_QUEUE_SIZE > 0
+	for (uint8_t i = 0; i < gPendingModifyCount; i++)
+		{
+		if (gPendingModifies[i].effectId == effectId && gPendingModifies[i].address == address)
+			{
+			gPendingModifies[i].value = value;
+			gModifyQueueStats.coalesced++;
+			return;
+			}
+		}
+
+	if (gPendingModifyCount >= MIDI_MODIFY_QUEUE_SIZE)
+		SendFirstPendingModify();	// waits for room if needed
+
+	gPendingModifies[gPendingModifyCount].effectId = effectId;
+	gPendingModifies[gPendingModifyCount].address = address;
+	gPendingModifies[gPendingModifyCount].value = value;
+	gPendingModifyCount++;
+#else
+	ffb->SendModify(DeviceEffectId(effectId), address, value);
+#endif
+	}
+
+void FfbFlushModifies(void)
+	{
+#if MIDI_MODIFY_QUEUE_SIZE > 0
+	// Move only what fits into the MIDI buffer without waiting - the rest
+	// stay here and can still be merged with newer values.
+	while (gPendingModifyCount > 0 && FfbMidiQueueFree(MIDI_PRIO_MODIFY) >= MIDI_MODIFY_MAX_LEN)
+		SendFirstPendingModify();
+#endif
+	}
+
+// Sends all pending modifies of the given effect (0x7F for all effects),
+// waiting for room in the MIDI buffer if needed. Its start then goes out
+// behind them (see FfbBeginMidi).
+static void SendEffectModifies(uint8_t effectId)
+	{
+#if MIDI_MODIFY_QUEUE_SIZE > 0
+	uint8_t n = 0;
+	for (uint8_t i = 0; i < gPendingModifyCount; i++)
+		{
+		TPendingModify *m = &gPendingModifies[i];
+		if (effectId == 0x7F || m->effectId == effectId)
+			ffb->SendModify(DeviceEffectId(m->effectId), m->address, m->value);
+		else
+			gPendingModifies[n++] = *m;
+		}
+	gPendingModifyCount = n;
+#endif
+	}
+
+uint8_t FfbDiscardModifies(uint8_t effectId)
+	{
+#if MIDI_MODIFY_QUEUE_SIZE > 0
+	uint8_t n = 0;
+	for (uint8_t i = 0; i < gPendingModifyCount; i++)
+		{
+		if (effectId != 0x7F && gPendingModifies[i].effectId != effectId)
+			gPendingModifies[n++] = gPendingModifies[i];
+		}
+	uint8_t discarded = gPendingModifyCount - n;
+	gPendingModifyCount = n;
+	return discarded;
+#else
+	return 0;
+#endif
+	}
+
+void FfbMidiTask(void)
+	{
+	ReinitTask();
+
+	// Only send the pending modifies once the earlier modifies have left,
+	// so that new values arriving meanwhile can still be merged.
+	if (FfbMidiQueueUsed(MIDI_PRIO_MODIFY) == 0)
+		FfbFlushModifies();
+	}
+
 uint16_t UsbUint16ToMidiUint14_Time(uint16_t inUsbValue)
 	{ //Only use for Time conversion from ms. Includes /2 as MIDI duration is in units of 2ms and USB 1ms
 	if (inUsbValue == 0xFFFF)
@@ -276,116 +706,142 @@ int8_t CalcGainCoeff(int8_t usbValue, uint8_t gain)
 	return ((v * gain) / 255);
 	}
 
-// Lengths of each report type
-const uint16_t OutReportSize[] = {
-	sizeof(USB_FFBReport_SetEffect_Output_Data_t),		// 1
-	sizeof(USB_FFBReport_SetEnvelope_Output_Data_t),	// 2
-	sizeof(USB_FFBReport_SetCondition_Output_Data_t),	// 3
-	sizeof(USB_FFBReport_SetPeriodic_Output_Data_t),	// 4
-	sizeof(USB_FFBReport_SetConstantForce_Output_Data_t),	// 5
-	sizeof(USB_FFBReport_SetRampForce_Output_Data_t),	// 6
-	sizeof(USB_FFBReport_SetCustomForceData_Output_Data_t),	// 7
-	sizeof(USB_FFBReport_SetDownloadForceSample_Output_Data_t),	// 8
-	0,	// 9
-	sizeof(USB_FFBReport_EffectOperation_Output_Data_t),	// 10
-	sizeof(USB_FFBReport_BlockFree_Output_Data_t),	// 11
-	sizeof(USB_FFBReport_DeviceControl_Output_Data_t),	// 12
-	sizeof(USB_FFBReport_DeviceGain_Output_Data_t),	// 13
-	sizeof(USB_FFBReport_SetCustomForce_Output_Data_t),	// 14
-	sizeof(USB_FFBReport_CreateNewEffect_Feature_Data_t),	// 15 SPOOFED ID
+static void FfbHandle_SetEffect(void *report, volatile TEffectState* effect);
+static void FfbHandle_SetEnvelope(void *report, volatile TEffectState* effect);
+static void FfbHandle_SetCondition(void *report, volatile TEffectState* effect);
+static void FfbHandle_SetPeriodic(void *report, volatile TEffectState* effect);
+static void FfbHandle_SetConstantForce(void *report, volatile TEffectState* effect);
+static void FfbHandle_SetRampForce(void *report, volatile TEffectState* effect);
+static void FfbHandle_SetCustomForceData(void *report, volatile TEffectState* effect);
+static void FfbHandle_SetDownloadForceSample(void *report, volatile TEffectState* effect);
+static void FfbHandle_EffectOperation(void *report, volatile TEffectState* effect);
+static void FfbHandle_BlockFree(void *report, volatile TEffectState* effect);
+static void FfbHandle_DeviceControl(void *report, volatile TEffectState* effect);
+static void FfbHandle_DeviceGain(void *report, volatile TEffectState* effect);
+static void FfbHandle_SetCustomForce(void *report, volatile TEffectState* effect);
+#ifdef DEBUG_ENABLE_USB
+static void FfbHandle_CreateNewEffect(void *report, volatile TEffectState* effect);
+#endif
+
+// Where the effect block index of an output report is and which values it accepts
+#define FFB_REPORT_EFFECT_NONE	0	// no effect index in the report
+#define FFB_REPORT_EFFECT_ONE	1	// data[1] is an effect 1..MAX_EFFECTS
+#define FFB_REPORT_EFFECT_ALL	2	// as above or 0xFF for all effects
+
+typedef void (*TFfbReportHandler)(void *report, volatile TEffectState* effect);
+
+typedef struct
+	{
+	uint8_t size;			// length of the report including the report id
+	uint8_t effectIndex;	// FFB_REPORT_EFFECT_xxx
+	TFfbReportHandler handler;	// NULL for report ids that are not handled
+	} TFfbReportDesc;
+
+// Output reports indexed by report id - 1
+static const TFfbReportDesc PROGMEM gOutReports[OUT_REPORT_COUNT] = {
+	{ sizeof(USB_FFBReport_SetEffect_Output_Data_t), FFB_REPORT_EFFECT_ONE, FfbHandle_SetEffect },	// 1
+	{ sizeof(USB_FFBReport_SetEnvelope_Output_Data_t), FFB_REPORT_EFFECT_ONE, FfbHandle_SetEnvelope },	// 2
+	{ sizeof(USB_FFBReport_SetCondition_Output_Data_t), FFB_REPORT_EFFECT_ONE, FfbHandle_SetCondition },	// 3
+	{ sizeof(USB_FFBReport_SetPeriodic_Output_Data_t), FFB_REPORT_EFFECT_ONE, FfbHandle_SetPeriodic },	// 4
+	{ sizeof(USB_FFBReport_SetConstantForce_Output_Data_t), FFB_REPORT_EFFECT_ONE, FfbHandle_SetConstantForce },	// 5
+	{ sizeof(USB_FFBReport_SetRampForce_Output_Data_t), FFB_REPORT_EFFECT_ONE, FfbHandle_SetRampForce },	// 6
+	{ sizeof(USB_FFBReport_SetCustomForceData_Output_Data_t), FFB_REPORT_EFFECT_ONE, FfbHandle_SetCustomForceData },	// 7
+	{ sizeof(USB_FFBReport_SetDownloadForceSample_Output_Data_t), FFB_REPORT_EFFECT_NONE, FfbHandle_SetDownloadForceSample },	// 8
+	{ 0, FFB_REPORT_EFFECT_NONE, NULL },	// 9
+	{ sizeof(USB_FFBReport_EffectOperation_Output_Data_t), FFB_REPORT_EFFECT_ALL, FfbHandle_EffectOperation },	// 10
+	{ sizeof(USB_FFBReport_BlockFree_Output_Data_t), FFB_REPORT_EFFECT_ALL, FfbHandle_BlockFree },	// 11
+	{ sizeof(USB_FFBReport_DeviceControl_Output_Data_t), FFB_REPORT_EFFECT_NONE, FfbHandle_DeviceControl },	// 12
+	{ sizeof(USB_FFBReport_DeviceGain_Output_Data_t), FFB_REPORT_EFFECT_NONE, FfbHandle_DeviceGain },	// 13
+	{ sizeof(USB_FFBReport_SetCustomForce_Output_Data_t), FFB_REPORT_EFFECT_ONE, FfbHandle_SetCustomForce },	// 14
+#ifdef DEBUG_ENABLE_USB	// only want to allow this behaviour when debugging since it should not be triggered otherwise
+	{ sizeof(USB_FFBReport_CreateNewEffect_Feature_Data_t), FFB_REPORT_EFFECT_NONE, FfbHandle_CreateNewEffect },	// 15 SPOOFED ID
+#else
+	{ 0, FFB_REPORT_EFFECT_NONE, NULL },	// 15
+#endif
 	};
 
-void FfbHandle_EffectOperation(USB_FFBReport_EffectOperation_Output_Data_t *data);
-void FfbHandle_BlockFree(USB_FFBReport_BlockFree_Output_Data_t *data);
-void FfbHandle_DeviceControl(USB_FFBReport_DeviceControl_Output_Data_t *data);
-void FfbHandle_DeviceGain(USB_FFBReport_DeviceGain_Output_Data_t *data);
-void FfbHandle_SetCustomForceData(USB_FFBReport_SetCustomForceData_Output_Data_t* data);
-void FfbHandle_SetDownloadForceSample(USB_FFBReport_SetDownloadForceSample_Output_Data_t* data);
-void FfbHandle_SetCustomForce(USB_FFBReport_SetCustomForce_Output_Data_t* data);
-void FfbHandle_SetEffect(USB_FFBReport_SetEffect_Output_Data_t *data);
+TFfbReportRejects gFfbReportRejects;
+
+uint8_t FfbOutReportSize(uint8_t reportId)
+	{
+	// Unsigned wrap-around takes care of report id 0
+	if ((uint8_t) (reportId - 1) >= OUT_REPORT_COUNT)
+		return 0;
+
+	return pgm_read_byte(&gOutReports[reportId - 1].size);
+	}
 
 // Handle incoming data from USB and convert it to MIDI data to joystick
-void FfbOnUsbData(uint8_t *data, uint16_t len)
+uint8_t FfbOnUsbData(uint8_t *data, uint16_t len)
 	{
-	// Parse incoming USB data and convert it to MIDI data for the joystick
-	LEDs_SetAllLEDs(LEDS_ALL_LEDS);
+	// Validate the report before any of it is used as an index
+	uint8_t size = (len > 0) ? FfbOutReportSize(data[0]) : 0;
+	if (size == 0)
+		{
+		gFfbReportRejects.unknownId++;
+		Trace2(TRACE_USB_REJECT, (len > 0) ? data[0] : 0, TRACE_REJECT_UNKNOWN_ID);
+		return 0;
+		}
 
-	LogReport(PSTR("Usb  =>"), OutReportSize, data, len);
+	if (len < size)
+		{
+		gFfbReportRejects.truncated++;
+		Trace2(TRACE_USB_REJECT, data[0], TRACE_REJECT_TRUNCATED);
+		return 0;
+		}
 
-	uint8_t effectId = data[1]; // effectBlockIndex is always the second byte.
-	
+	const TFfbReportDesc *desc = &gOutReports[data[0] - 1];
+	volatile TEffectState* effect = NULL;
+	uint8_t effectIndex = pgm_read_byte(&desc->effectIndex);
 
-	
-	switch (data[0])	// reportID
+	if (effectIndex != FFB_REPORT_EFFECT_NONE)
 		{
-		case 1:
-			FfbHandle_SetEffect((USB_FFBReport_SetEffect_Output_Data_t *) data);
-			break;
-		case 2:
-			ffb->SetEnvelope((USB_FFBReport_SetEnvelope_Output_Data_t*) data, &gEffectStates[effectId]);
-			break;
-		case 3:
-			ffb->SetCondition((USB_FFBReport_SetCondition_Output_Data_t*) data, &gEffectStates[effectId]);
-			break;
-		case 4:
-			ffb->SetPeriodic((USB_FFBReport_SetPeriodic_Output_Data_t*) data, &gEffectStates[effectId]);
-			break;
-		case 5:
-			ffb->SetConstantForce((USB_FFBReport_SetConstantForce_Output_Data_t*) data, &gEffectStates[effectId]);
-			break;
-		case 6:
-			ffb->SetRampForce((USB_FFBReport_SetRampForce_Output_Data_t*)data, &gEffectStates[effectId]);
-			break;
-		case 7:
-			FfbHandle_SetCustomForceData((USB_FFBReport_SetCustomForceData_Output_Data_t*) data);
-			break;
-		case 8:
-			FfbHandle_SetDownloadForceSample((USB_FFBReport_SetDownloadForceSample_Output_Data_t*) data);
-			break;
-		case 9:
-			break;
-		case 10:
-			FfbHandle_EffectOperation((USB_FFBReport_EffectOperation_Output_Data_t*) data);
-			break;
-		case 11:
-			FfbHandle_BlockFree((USB_FFBReport_BlockFree_Output_Data_t *) data);
-			break;
-		case 12:
-			FfbHandle_DeviceControl((USB_FFBReport_DeviceControl_Output_Data_t*) data);
-			break;
-		case 13:
-			FfbHandle_DeviceGain((USB_FFBReport_DeviceGain_Output_Data_t*) data);
-			break;
-		case 14:
-			FfbHandle_SetCustomForce((USB_FFBReport_SetCustomForce_Output_Data_t*) data);
-			break;
-		#ifdef DEBUG_ENABLE_USB	// only want to allow this behaviour when debugging since it should not be triggered otherwise
-		case 15: 
-			{// This is a spoofed ID to allow CreateNewEffect to be triggered over USB virtual COM PORT, since it is a Feature Report not an Output Report
-			USB_FFBReport_PIDBlockLoad_Feature_Data_t pidBlockLoadData; // do nothing with this
-			FfbOnCreateNewEffect((USB_FFBReport_CreateNewEffect_Feature_Data_t*) data, &pidBlockLoadData);
-			break;
+		uint8_t eid = data[1]; // effectBlockIndex is always the second byte.
+		if (eid >= 1 && eid <= MAX_EFFECTS)
+			effect = &gEffectStates[eid];
+		else if (eid != 0xFF || effectIndex != FFB_REPORT_EFFECT_ALL)
+			{
+			gFfbReportRejects.badEffect++;
+			Trace2(TRACE_USB_REJECT, data[0], TRACE_REJECT_BAD_EFFECT);
+			return 0;
 			}
-		#endif // DEBUG_ENABLE_USB	
-		default:
-			break;
-		};
+		}
+
+	// Parse incoming USB data and convert it to MIDI data for the joystick
+	HalSetLeds(HAL_LEDS_ALL);
+
+	Trace3(TRACE_USB_OUT, data[0], data[1], (size > 2) ? data[2] : 0);
+	if (DoDebug(DEBUG_DETAIL))
+		LogDataLf("Usb  =>", data[0], &data[1], size - 1);
+
+	LatencyDecodeBegin(data[0]);
+
+	TFfbReportHandler handler = (TFfbReportHandler) HalReadPgmPtr(&desc->handler);
+	handler(data, effect);
+
+	LatencyDecodeEnd();
 
-	LEDs_SetAllLEDs(LEDS_NO_LEDS);
+	HalSetLeds(HAL_LEDS_NONE);
+
+	return 1;
 	}
 
 void FfbOnCreateNewEffect(USB_FFBReport_CreateNewEffect_Feature_Data_t* inData, USB_FFBReport_PIDBlockLoad_Feature_Data_t *outData)
 {
 	outData->reportId = 6;
 	
+	uint8_t known_type = (inData->effectType >= 1 && inData->effectType <= USB_EFFECT_CUSTOM);
 	uint8_t midi_effect_type = ffb->UsbToMidiEffectType(inData->effectType - 1);
-	if (ffb->EffectMemFull(midi_effect_type)) {
-		outData->effectBlockIndex = 0;
-	} else {
+	// Only the effects being played need to fit into the joystick. It is
+	// full when it has no room that the effects playing there could give.
+	if (known_type && DeviceHasRoom(midi_effect_type))
 		outData->effectBlockIndex = GetNextFreeEffect(); // can also return 0 if adapter full
-	}
+	else
+		outData->effectBlockIndex = 0;
 
-	if (outData->effectBlockIndex == 0) {
+	if (!known_type) {
+		outData->loadStatus = 3;	// 1=Success,2=Full,3=Error
+	} else if (outData->effectBlockIndex == 0) {
 		outData->loadStatus = 2;	// 1=Success,2=Full,3=Error
 	} else {
 		outData->loadStatus = 1;	// 1=Success,2=Full,3=Error
@@ -408,15 +864,17 @@ void FfbOnCreateNewEffect(USB_FFBReport_CreateNewEffect_Feature_Data_t* inData,
 		FlushDebugBuffer();
 		}
 
-	LogDataLf("Usb <=", outData->reportId, outData, sizeof(USB_FFBReport_PIDBlockLoad_Feature_Data_t));
+	Trace3(TRACE_CREATE_EFFECT, inData->effectType, outData->effectBlockIndex, outData->loadStatus);
+	if (DoDebug(DEBUG_DETAIL))
+		LogDataLf("Usb <=", outData->reportId, outData, sizeof(USB_FFBReport_PIDBlockLoad_Feature_Data_t));
 
 	WaitMs(5);
 }
 
-void FfbHandle_SetEffect(USB_FFBReport_SetEffect_Output_Data_t *data)
+static void FfbHandle_SetEffect(void *report, volatile TEffectState* effect)
 {
-	volatile TEffectState* effect = &gEffectStates[data->effectBlockIndex];
-	
+	USB_FFBReport_SetEffect_Output_Data_t *data = report;
+
 	if (DoDebug(DEBUG_DETAIL))
 		{
 		LogTextP(PSTR("Set Effect:"));
@@ -457,8 +915,16 @@ void FfbHandle_SetEffect(USB_FFBReport_SetEffect_Output_Data_t *data)
 	
 	// Send full effect data to MIDI if this effect has not been sent yet
 	if (!(effect->state & MEffectState_SentToJoystick)) {
-		FfbSendSysEx((const uint8_t*)effect->data, midi_data_len);
-		effect->state |= MEffectState_SentToJoystick;
+		effect->dataLen = midi_data_len;
+#if FFB_LAZY_DOWNLOAD
+		// Wait for the first start - until then the data only changes here
+		if (!(effect->state & MEffectState_Staged))
+			gEffectDownloadStats.deferred++;
+		effect->state |= MEffectState_Staged;
+#else
+		effect->state |= MEffectState_Staged;
+		DownloadEffect(data->effectBlockIndex);
+#endif
 	}
 
 }
@@ -474,28 +940,80 @@ void FfbOnPIDPool(USB_FFBReport_PIDPool_Feature_Data_t *data)
 
 	data->reportId = 7;
 	data->ramPoolSize = 0xFFFF;
-	data->maxSimultaneousEffects = 0x10;	// FFP supports playing up to 16 simultaneous effects
+	data->maxSimultaneousEffects = MAX_EFFECTS - 2;	// only the effects being played need to fit into the joystick
 	data->memoryManagement = 3;
 	}
 
-void FfbHandle_SetCustomForceData(USB_FFBReport_SetCustomForceData_Output_Data_t *data)
+uint32_t FfbPlayingEffects(void)
+	{
+	uint32_t playing = 0;
+	for (uint8_t id = MAX_EFFECTS; id > 0; id--)
+		{
+		playing <<= 1;
+		if (gEffectStates[id].state & MEffectState_Playing)
+			playing |= 1;
+		}
+	return playing;
+	}
+
+uint8_t FfbDeviceGain(void)
+	{
+	return (gDeviceGain >= 0) ? gDeviceGain : 255;
+	}
+
+static void FfbHandle_SetEnvelope(void *report, volatile TEffectState* effect)
+	{
+	ffb->SetEnvelope(report, effect);
+	}
+
+static void FfbHandle_SetCondition(void *report, volatile TEffectState* effect)
+	{
+	ffb->SetCondition(report, effect);
+	}
+
+static void FfbHandle_SetPeriodic(void *report, volatile TEffectState* effect)
+	{
+	ffb->SetPeriodic(report, effect);
+	}
+
+static void FfbHandle_SetConstantForce(void *report, volatile TEffectState* effect)
+	{
+	ffb->SetConstantForce(report, effect);
+	}
+
+static void FfbHandle_SetRampForce(void *report, volatile TEffectState* effect)
+	{
+	ffb->SetRampForce(report, effect);
+	}
+
+#ifdef DEBUG_ENABLE_USB
+static void FfbHandle_CreateNewEffect(void *report, volatile TEffectState* effect)
+	{
+	// This is a spoofed ID to allow CreateNewEffect to be triggered over USB virtual COM PORT, since it is a Feature Report not an Output Report
+	USB_FFBReport_PIDBlockLoad_Feature_Data_t pidBlockLoadData; // do nothing with this
+	FfbOnCreateNewEffect(report, &pidBlockLoadData);
+	}
+#endif // DEBUG_ENABLE_USB
+
+static void FfbHandle_SetCustomForceData(void *report, volatile TEffectState* effect)
 	{
 	if (DoDebug(DEBUG_DETAIL))
-		LogTextLf("Set Custom Force Data");
+		LogTextLfP(PSTR("Set Custom Force Data"));
 	}
 
 
 
-void FfbHandle_SetDownloadForceSample(USB_FFBReport_SetDownloadForceSample_Output_Data_t *data)
+static void FfbHandle_SetDownloadForceSample(void *report, volatile TEffectState* effect)
 	{
 	if (DoDebug(DEBUG_DETAIL))
-		LogTextLf("Set Download Force Sample");
+		LogTextLfP(PSTR("Set Download Force Sample"));
 	}
 
 
 
-void FfbHandle_EffectOperation(USB_FFBReport_EffectOperation_Output_Data_t *data)
+static void FfbHandle_EffectOperation(void *report, volatile TEffectState* effect)
 	{
+	USB_FFBReport_EffectOperation_Output_Data_t *data = report;
 	uint8_t eid = data->effectBlockIndex;
 
 	if (DoDebug(DEBUG_DETAIL))
@@ -512,9 +1030,24 @@ void FfbHandle_EffectOperation(USB_FFBReport_EffectOperation_Output_Data_t *data
 		if (DoDebug(DEBUG_DETAIL))
 			LogTextLfP(PSTR(" Start"));
 
-		StartEffect(data->effectBlockIndex);
-		if (!gDisabledEffects.effectId[eid])
-			ffb->StartEffect(eid);
+		StartEffect(eid);
+		DownloadEffect(eid);
+		SendEffectModifies(eid);	// start with the latest parameters
+		if (eid == 0x7F)
+			{	// Start one by one - freed effects left in the joystick must not start
+			for (uint8_t id = 2; id <= MAX_EFFECTS; id++)
+				{
+				uint8_t did = DeviceEffectId(id);
+				if (did && !gDisabledEffects.effectId[id])
+					ffb->StartEffect(did);
+				}
+			}
+		else
+			{
+			uint8_t did = DeviceEffectId(eid);
+			if (did && !gDisabledEffects.effectId[eid])
+				ffb->StartEffect(did);
+			}
 		}
 	else if (data->operation == 2)
 		{	// StartSolo
@@ -523,14 +1056,18 @@ void FfbHandle_EffectOperation(USB_FFBReport_EffectOperation_Output_Data_t *data
 
 		// Stop all first
 		StopAllEffects();
-		if (!gDisabledEffects.effectId[eid])
-			ffb->StopEffect(0x7F); // TODO: wheel ?
+		ffb->StopEffect(0x7F); // TODO: wheel ?
 
 		// Then start the given effect
-		StartEffect(data->effectBlockIndex);
-
-		if (!gDisabledEffects.effectId[eid])
-			ffb->StartEffect(0x7F);	// TODO: wheel ?
+		StartEffect(eid);
+		DownloadEffect(eid);
+		SendEffectModifies(eid);
+
+		// Only the given one - freed effects left in the joystick must not start.
+		// All effects (0xFF) is not one.
+		uint8_t did = (eid <= MAX_EFFECTS) ? DeviceEffectId(eid) : 0;
+		if (did && !gDisabledEffects.effectId[eid])
+			ffb->StartEffect(did);
 		}
 	else if (data->operation == 3)
 		{	// Stop
@@ -550,9 +1087,9 @@ void FfbHandle_EffectOperation(USB_FFBReport_EffectOperation_Output_Data_t *data
 	}
 
 
-void FfbHandle_BlockFree(USB_FFBReport_BlockFree_Output_Data_t *data)
+static void FfbHandle_BlockFree(void *report, volatile TEffectState* effect)
 	{
-	uint8_t eid = data->effectBlockIndex;
+	uint8_t eid = ((USB_FFBReport_BlockFree_Output_Data_t *) report)->effectBlockIndex;
 
 	if (DoDebug(DEBUG_DETAIL))
 		{
@@ -571,8 +1108,10 @@ void FfbHandle_BlockFree(USB_FFBReport_BlockFree_Output_Data_t *data)
 		}
 	}
 
-void FfbHandle_DeviceControl(USB_FFBReport_DeviceControl_Output_Data_t *data)
+static void FfbHandle_DeviceControl(void *report, volatile TEffectState* effect)
 {
+	USB_FFBReport_DeviceControl_Output_Data_t *data = report;
+
 //	LogTextP(PSTR("Device Control: "));
 
 	uint8_t control = data->control;
@@ -590,45 +1129,68 @@ void FfbHandle_DeviceControl(USB_FFBReport_DeviceControl_Output_Data_t *data)
 	pidState.status |= 1 << 4; //Actuator Power: on
 	pidState.effectBlockIndex = 0;
 
-	success = ffb->DeviceControl(control);
+	// Reset and Stop All go out ahead of the queued messages. Drop what
+	// they would overtake: after a Reset the joystick has no effects for
+	// them and a queued start must not undo a Stop All.
+	if (control == USB_DCTRL_RESET && !FfbReinitPending())
+		{
+		FfbDiscardQueuedMidi();
+		FfbDiscardModifies(0x7F);
+		}
+	else if (control == USB_DCTRL_STOPALL)
+		{
+		FfbDiscardQueuedStarts();
+		for (uint8_t id = 2; id <= MAX_EFFECTS; id++)
+			gEffectStates[id].state &= ~MEffectState_Playing;
+		}
+
+	// While the joystick is being set up again only the state changes here:
+	// its start-up sequence ends with a Reset and then only the effects
+	// still playing are started again
+	if (FfbReinitPending())
+		success = 1;
+	else
+		success = ffb->DeviceControl(control);
+
+	Trace2(TRACE_DEVICE_CONTROL, control, success);
 
 	switch (control)
 	{
 		case USB_DCTRL_ACTUATORS_ENABLE:
-			LogTextLf("Enable Actuators");
+			LogTextLfP(PSTR("Enable Actuators"));
 			if (success)
 				pidState.status |= (1 << 1);
 			break;
 		case USB_DCTRL_ACTUATORS_DISABLE:
-			LogTextLf("Disable Actuators");
+			LogTextLfP(PSTR("Disable Actuators"));
 			if (success)
 				pidState.status &= ~(1 << 1);
 			break;
 		case USB_DCTRL_STOPALL:
-			LogTextLf("Stop All Effects");
+			LogTextLfP(PSTR("Stop All Effects"));
 			if (success)
 				pidState.effectBlockIndex = 0;
-				//need to update all effect states to not playing? Maybe not needed since adapter doesn't track when effects finish anyway
 			break;
 		case USB_DCTRL_RESET:
-			LogTextLf("Reset");
+			LogTextLfP(PSTR("Reset"));
 			// Reset (e.g. FFB-application out of focus)
 			//Enables auto centre, continues, enables actuators, stop and free all effects, resets device gain (for FFP at least)
 			if (success)
 				{
 				WaitMs(75);
 				FreeAllEffects();
+				gDeviceGain = -1;
 				pidState.status |= (1 << 1); //actuators
 				pidState.status &= ~1; //continue
 				}
 			break;
 		case USB_DCTRL_PAUSE:		
-			LogTextLf("Pause");
+			LogTextLfP(PSTR("Pause"));
 			if (success)
 				pidState.status |= 1;
 			break;
 		case USB_DCTRL_CONTINUE:
-			LogTextLf("Continue");
+			LogTextLfP(PSTR("Continue"));
 			if (success)
 				pidState.status &= ~1;
 			break;
@@ -647,45 +1209,45 @@ void FfbHandle_DeviceControl(USB_FFBReport_DeviceControl_Output_Data_t *data)
 
 
 
-void FfbHandle_DeviceGain(USB_FFBReport_DeviceGain_Output_Data_t *data)
+static void FfbHandle_DeviceGain(void *report, volatile TEffectState* effect)
 	{
-	LogTextP(PSTR("Device Gain: "));
-	LogBinaryLf(&data->gain, 1);
+	USB_FFBReport_DeviceGain_Output_Data_t *data = report;
+
+	Trace1(TRACE_DEVICE_GAIN, data->gain);
+	if (DoDebug(DEBUG_DETAIL))
+		{
+		LogTextP(PSTR("Device Gain: "));
+		LogBinaryLf(&data->gain, 1);
+		}
 	
-	ffb->ModifyDeviceGain(data->gain);
+	gDeviceGain = data->gain;
+	if (!FfbReinitPending())	// otherwise sent once the joystick is set up
+		ffb->ModifyDeviceGain(data->gain);
 	}
 
 
-void FfbHandle_SetCustomForce(USB_FFBReport_SetCustomForce_Output_Data_t *data)
+static void FfbHandle_SetCustomForce(void *report, volatile TEffectState* effect)
 	{
-	LogTextLf("Set Custom Force");
+	if (DoDebug(DEBUG_DETAIL))
+		LogTextLfP(PSTR("Set Custom Force"));
 //	LogBinary(&data, sizeof(USB_FFBReport_SetCustomForce_Output_Data_t));
 	}
 
 //------------------------------------------------------------------------------
 // Trigger the stick
 
-#define X1_pull()	__WRAP__( {				\
-				clr_bit( TRGDDR, TRGX1BIT ) ;	\
-				clr_bit( TRGDDR, TRGY2BIT ) ;	\
-			} )
-#define X1_rel()	__WRAP__( {				\
-				set_bit( TRGDDR, TRGX1BIT ) ;	\
-				set_bit( TRGDDR, TRGY2BIT ) ;	\
-			} )
-
 void _delay_us10(uint8_t delay)
 {
 	while (delay--) {
-		_delay_us(9); // .. compensate for loop handling
+		HalDelayUs(9); // .. compensate for loop handling
 	}
 }
 
 void FA_NOINLINE( FfbPulseX1 ) ( void )
 {
-    X1_pull() ;
+    HalStickTrigger(1);
 	_delay_us10(5);
-    X1_rel() ;
+    HalStickTrigger(0);
 	_delay_us10(1);
 }
 
@@ -693,51 +1255,118 @@ void WaitMs(int ms)
 	{
 	while (ms--)
 		{
-		wdt_reset() ;
-		_delay_ms(1);
+		HalWatchdogReset();
+		HalDelayMs(1);
 		}
 	}
 
+static void FfbResetMidiBuffer(void);
+
 // Initializes and enables MIDI to joystick using USART1 TX
 void FfbInitMidi()
 	{
 	// Initialize some states
 	memset((void*) &gDisabledEffects, 0, sizeof(gDisabledEffects));
 
-	// Check TX-pin (PD3) settings
-	DDRD = DDRD | 0b00001000;
-	
-	// Set baud rate
-	UCSR1A = 0;	
-	UBRR1 = ((F_CPU/(31250ul<<4))-1);
+	HalUartInit(31250);
 
-	// Set frame format to 8 data bits, no parity, 1 stop bit, 1 start bit
-	UCSR1C = (1<<7)|(1<<UCSZ11)|(1<<UCSZ10);
-	// Enable transmitter only
-	//UCSR1B = (1 << TXCIE1) | (1<<TXEN1);
-	UCSR1B = (1<<TXEN1);
+	HalUartTx(0);	// write something to get things going
 
-	UDR1 = 0;	// write something to get things going
+	FfbResetMidiBuffer();
+	memset((void*) gMidiBufferStats, 0, sizeof(gMidiBufferStats));
+	FfbDiscardModifies(0x7F);
+	memset((void*) &gModifyQueueStats, 0, sizeof(gModifyQueueStats));
 
-	memset((void*) gEffectStates, 0, sizeof(gEffectStates));
+	FreeAllEffects();
+	gDeviceGain = -1;
 	memset((void*) &pidState, 0, sizeof(pidState));
-	nextEID = 2;
 
-	ffb->EnableInterrupts();
+	gReinitStep = 0;
+	uint8_t wait;
+	for (uint8_t step = 0; (wait = ffb->StartupStep(step)) != FFB_STARTUP_DONE; step++)
+		WaitMs(wait);
 	}
 
-void FfbSendByte(uint8_t data);
+void FfbReinitJoystick(void)
+	{
+	Trace0(TRACE_REINIT);
 
-void FfbSendData(const uint8_t *data, uint16_t len)
+	// Whatever was on its way to the joystick is lost with its state
+	FfbResetMidiBuffer();
+	FfbDiscardModifies(0x7F);
+
+	gFreeDeviceEffects = ALL_DEVICE_EFFECTS_FREE;
+	memset(gDeviceEffects, 0, sizeof(gDeviceEffects));
+	memset(gDeviceEffectTypeCounts, 0, sizeof(gDeviceEffectTypeCounts));
+
+	// Keep the effect data for downloading again. Effects with a finite
+	// duration have probably finished by now and are left stopped.
+	for (uint8_t id = 2; id <= MAX_EFFECTS; id++)
+		{
+		volatile TEffectState* effect = &gEffectStates[id];
+		if (effect->state & MEffectState_SentToJoystick)
+			{
+			effect->state &= ~MEffectState_SentToJoystick;
+			effect->state |= MEffectState_Evicted;
+			}
+		effect->deviceId = 0;
+		if (((midi_data_common_t*)effect->data)->duration != MIDI_DURATION_INFINITE)
+			effect->state &= ~MEffectState_Playing;
+		}
+
+	// The main loop keeps running meanwhile, see ReinitTask()
+	gReinitStep = 1;
+	gReinitWait = 0;
+	gReinitWaitStart = HalMillis();
+	}
+
+uint8_t FfbReinitPending(void)
 	{
-	if (gDebugMode)
+	return gReinitStep != 0;
+	}
+
+// Runs the next step of the start-up sequence of FfbReinitJoystick() once
+// the previous one has waited long enough. After the last one, brings back
+// what the host has set up.
+static void ReinitTask(void)
+	{
+	if (gReinitStep == 0 || (uint16_t) (HalMillis() - gReinitWaitStart) <= gReinitWait)
+		return;
+
+	gReinitWait = ffb->StartupStep(gReinitStep - 1);
+	gReinitWaitStart = HalMillis();
+	if (gReinitWait != FFB_STARTUP_DONE)
 		{
-		LogTextP(PSTR(" => Midi:")); LogBinaryLf(data, len);
+		gReinitStep++;
+		return;
 		}
+	gReinitStep = 0;
 
-	uint16_t i = 0;
-	for (i = 0; i < len; i++)
-		FfbSendByte(data[i]);
+	if (gDeviceGain >= 0)
+		ffb->ModifyDeviceGain(gDeviceGain);
+
+	for (uint8_t id = 2; id <= MAX_EFFECTS; id++)
+		{
+		if (!(gEffectStates[id].state & MEffectState_Playing))
+			continue;
+
+		DownloadEffect(id);
+		uint8_t did = DeviceEffectId(id);
+		if (did && !gDisabledEffects.effectId[id])
+			ffb->StartEffect(did);
+		}
+	}
+
+void FfbSendData(const uint8_t *data, uint16_t len)
+	{
+	// Raw data has no priority. Split it to what fits into the download queue.
+	while (len)
+		{
+		uint8_t count = (len > MIDI_MESSAGE_MAX_LEN) ? MIDI_MESSAGE_MAX_LEN : len;
+		FfbSendMidi(MIDI_PRIO_DOWNLOAD, 0, data, count);
+		data += count;
+		len -= count;
+		}
 	}
 	
 void FfbSendPackets(const uint8_t *data, uint16_t len)
@@ -745,78 +1374,477 @@ void FfbSendPackets(const uint8_t *data, uint16_t len)
 	uint16_t i = 0;
 	while (i < len)
 		{
+		FfbWaitMidiSent();
 		WaitMs(1);
 		uint8_t count = data[i++];
-		while (count--)
-			FfbSendByte(data[i++]);
+		FfbSendMidi(MIDI_PRIO_DOWNLOAD, 0, &data[i], count);
+		i += count;
 		}
 	}
 
+void FfbSendMidi(uint8_t prio, uint8_t effectId, const uint8_t *data, uint8_t len)
+	{
+	FfbBeginMidi(prio, effectId, len);
+	FfbAppendMidi(data, len);
+	FfbEndMidi();
+	}
+
 // ----------------------------------------------
-// Ring buffer for sending MIDI data to joystick
+// Prioritized MIDI output to joystick
 // ----------------------------------------------
 
-// Buffer for sending data to MIDI
-//#define MIDI_BUFFER_SIZE 128
-
-#ifndef MIDI_BUFFER_SIZE
+// Each priority class has its own ring buffer holding whole messages as
+// [length][effect id][data...]. The USART1 data register empty interrupt picks
+// the highest priority message available whenever the previous message has
+// been completely sent, so e.g. a Stop never waits for more than the one
+// message already on the wire, and messages are never interleaved.
+//
+// A message for an effect whose download or other messages are still waiting
+// in the download queue is put to the download queue too, so that e.g. a
+// Start can not overtake the SysEx that creates the effect. For the same
+// reason a free goes to the download queue while it has anything for an
+// effect (MIDI_PRIO_FREE).
+//
+// Only Reset and Stop All overtake the rest. FfbHandle_DeviceControl() first
+// drops what they would overtake and what they make pointless: everything
+// for a Reset, the starts for a Stop All.
+//
+// Before interrupts are enabled (e.g. while FfbInitMidi() runs the joystick
+// start-up sequence) the bytes are pushed out by polling instead, which keeps
+// the start-up timing exactly as before.
+
+volatile TMidiBufferStats gMidiBufferStats[MIDI_PRIO_COUNT];
+
+#if MIDI_BUFFER_SIZE == 0
 
 // Non-buffered MIDI
-void FfbSendByte(uint8_t data)
+static void FfbSendByte(uint8_t data)
 	{
 	// Wait if a byte is being transmitted
-	while((UCSR1A & (1<<UDRE1)) == 0);
+	while (!HalUartTxReady())
+		HalIdle();
 	// Transmit data
-	UDR1 = data;
+	HalUartTx(data);
+	}
+
+static void FfbResetMidiBuffer(void)
+	{
+	}
+
+uint8_t FfbMidiBufferUsed(void)
+	{
+	return 0;
+	}
+
+uint8_t FfbMidiQueueUsed(uint8_t prio)
+	{
+	return 0;
+	}
+
+uint8_t FfbMidiQueueFree(uint8_t prio)
+	{
+	return 0xFF;
+	}
+
+void FfbBeginMidi(uint8_t prio, uint8_t effectId, uint8_t len)
+	{
+	if (prio == MIDI_PRIO_IN_ORDER)
+		prio = MIDI_PRIO_OPERATION;
+	Trace3(TRACE_MIDI, prio, effectId & ~MIDI_EFFECT_START, len);
+	}
+
+void FfbAppendMidi(const uint8_t *data, uint8_t len)
+	{
+	if (DoDebug(DEBUG_DETAIL))
+		{
+		LogTextP(PSTR(" => Midi:")); LogBinaryLf(data, len);
+		}
+
+	while (len--)
+		FfbSendByte(*data++);
+	}
+
+void FfbEndMidi(void)
+	{
+	}
+
+void FfbWaitMidiSent(void)
+	{
+	while (!HalUartTxReady())
+		HalIdle();
+	}
+
+void FfbDiscardQueuedMidi(void)
+	{
+	}
+
+void FfbDiscardQueuedStarts(void)
+	{
 	}
 
 #else
 
 // Buffered MIDI
 
-volatile uint8_t gMidiBuffer[MIDI_BUFFER_SIZE];
-volatile unit8_t *midi_buffer_head = gMidiBuffer;
-volatile unit8_t *midi_buffer_tail = gMidiBuffer;
+#if (MIDI_BUFFER_SIZE & (MIDI_BUFFER_SIZE - 1)) || MIDI_BUFFER_SIZE > 128 || \
+	(MIDI_CONTROL_BUFFER_SIZE & (MIDI_CONTROL_BUFFER_SIZE - 1)) || MIDI_CONTROL_BUFFER_SIZE > 128 || \
+	(MIDI_OPERATION_BUFFER_SIZE & (MIDI_OPERATION_BUFFER_SIZE - 1)) || MIDI_OPERATION_BUFFER_SIZE > 128 || \
+	(MIDI_MODIFY_BUFFER_SIZE & (MIDI_MODIFY_BUFFER_SIZE - 1)) || MIDI_MODIFY_BUFFER_SIZE > 128
+#error "MIDI buffer sizes must be powers of two no larger than 128"
+#endif
+
+#define MIDI_QUEUE_HEADER_LEN 2	// length + effect id
 
-void FfbSendByte(uint8_t data)
+typedef struct
 	{
-	cli();
+	volatile uint8_t *buffer;
+	uint8_t mask;
+	volatile uint8_t head;	// end of committed messages, written only by FfbEndMidi()
+	volatile uint8_t tail;	// next byte to transmit, written only by the UDRE interrupt
+	} TMidiQueue;
+
+static volatile uint8_t gMidiControlBuffer[MIDI_CONTROL_BUFFER_SIZE];
+static volatile uint8_t gMidiOperationBuffer[MIDI_OPERATION_BUFFER_SIZE];
+static volatile uint8_t gMidiModifyBuffer[MIDI_MODIFY_BUFFER_SIZE];
+static volatile uint8_t gMidiDownloadBuffer[MIDI_BUFFER_SIZE];
+
+static TMidiQueue gMidiQueues[MIDI_PRIO_COUNT] =
+	{
+		{ gMidiControlBuffer, MIDI_CONTROL_BUFFER_SIZE - 1 },
+		{ gMidiOperationBuffer, MIDI_OPERATION_BUFFER_SIZE - 1 },
+		{ gMidiModifyBuffer, MIDI_MODIFY_BUFFER_SIZE - 1 },
+		{ gMidiDownloadBuffer, MIDI_BUFFER_SIZE - 1 },
+	};
+
+// Message currently being transmitted by the interrupt
+static volatile uint8_t gMidiTxPrio;
+static volatile uint8_t gMidiTxRemaining = 0;
+static volatile uint8_t gMidiTxEffectId;
 
-	*gMidiBufferHead++ = data;
+// Number of messages of each effect waiting in the download queue
+static volatile uint8_t gMidiDownloadsPending[MAX_DEVICE_EFFECTS+1];
 
-	if (gMidiBufferHead == gMidiBufferTail)
-		{	// Ouch - buffer overflown!
+// Message currently being written by FfbBeginMidi() .. FfbEndMidi()
+static TMidiQueue *gMidiWriteQueue;
+static uint8_t gMidiWriteStart, gMidiWriteHead;
 
+// Moves the next byte of the current (or next highest priority) message
+// to the USART. Must be called only when the data register is empty.
+// Returns false once there is nothing to send.
+static uint8_t MidiTransmitNext(void)
+	{
+	TMidiQueue *q;
+	uint8_t tail;
+
+	if (gMidiTxRemaining == 0)
+		{
+		uint8_t prio = 0;
+		while (gMidiQueues[prio].tail == gMidiQueues[prio].head)
+			{
+			if (++prio >= MIDI_PRIO_COUNT)
+				return 0;
+			}
+
+		q = &gMidiQueues[prio];
+		tail = q->tail;
+		gMidiTxRemaining = q->buffer[tail];
+		tail = (tail + 1) & q->mask;
+		gMidiTxEffectId = q->buffer[tail];
+		q->tail = (tail + 1) & q->mask;
+		gMidiTxPrio = prio;
+		}
+	else
+		q = &gMidiQueues[gMidiTxPrio];
+
+	tail = q->tail;
+	HalUartTx(q->buffer[tail]);
+	q->tail = tail = (tail + 1) & q->mask;
+	LatencyMidiSent(gMidiTxPrio, tail);
+
+	uint8_t did = gMidiTxEffectId & ~MIDI_EFFECT_START;
+	if (--gMidiTxRemaining == 0 && gMidiTxPrio == MIDI_PRIO_DOWNLOAD && did <= MAX_DEVICE_EFFECTS)
+		gMidiDownloadsPending[did]--;
+
+	return 1;
+	}
+
+static void FfbResetMidiBuffer(void)
+	{
+	HalUartTxIrq(0);
+	for (uint8_t prio = 0; prio < MIDI_PRIO_COUNT; prio++)
+		gMidiQueues[prio].head = gMidiQueues[prio].tail = 0;
+	gMidiTxRemaining = 0;
+	memset((void*) gMidiDownloadsPending, 0, sizeof(gMidiDownloadsPending));
+	LatencyMidiDiscarded();
+	}
+
+// Index of the first queued message of the given queue after the one on the wire
+static uint8_t MidiQueuedStart(uint8_t prio)
+	{
+	TMidiQueue *q = &gMidiQueues[prio];
+	if (gMidiTxRemaining && gMidiTxPrio == prio)
+		return (q->tail + gMidiTxRemaining) & q->mask;
+	return q->tail;
+	}
+
+void FfbDiscardQueuedMidi(void)
+	{
+	HalUartTxIrq(0);	// the interrupt leaves the queues alone
+
+	for (uint8_t prio = MIDI_PRIO_OPERATION; prio < MIDI_PRIO_COUNT; prio++)
+		gMidiQueues[prio].head = MidiQueuedStart(prio);
+
+	memset((void*) gMidiDownloadsPending, 0, sizeof(gMidiDownloadsPending));
+	uint8_t did = gMidiTxEffectId & ~MIDI_EFFECT_START;
+	if (gMidiTxRemaining && gMidiTxPrio == MIDI_PRIO_DOWNLOAD && did <= MAX_DEVICE_EFFECTS)
+		gMidiDownloadsPending[did] = 1;
+	LatencyMidiDiscarded();
+
+	if (FfbMidiBufferUsed())
+		HalUartTxIrq(1);
+	}
+
+// True if the given queue holds a message of the given joystick effect
+// behind the one on the wire
+static uint8_t MidiQueueHolds(uint8_t prio, uint8_t did)
+	{
+	HalUartTxIrq(0);	// the interrupt leaves the queues alone
+
+	TMidiQueue *q = &gMidiQueues[prio];
+	uint8_t found = 0;
+	for (uint8_t i = MidiQueuedStart(prio); i != q->head; i = (i + q->buffer[i] + MIDI_QUEUE_HEADER_LEN) & q->mask)
+		{
+		if ((q->buffer[(i + 1) & q->mask] & ~MIDI_EFFECT_START) == did)
+			{
+			found = 1;
+			break;
+			}
+		}
+
+	if (FfbMidiBufferUsed())
+		HalUartTxIrq(1);
+	return found;
+	}
+
+// Removes the queued starts of the given queue, moving the other messages
+// over them
+static void MidiDropStarts(uint8_t prio)
+	{
+	TMidiQueue *q = &gMidiQueues[prio];
+	uint8_t from = MidiQueuedStart(prio), to = from;
+	while (from != q->head)
+		{
+		uint8_t len = q->buffer[from] + MIDI_QUEUE_HEADER_LEN;
+		uint8_t effectId = q->buffer[(from + 1) & q->mask];
+		if (effectId & MIDI_EFFECT_START)
+			{
+			uint8_t did = effectId & ~MIDI_EFFECT_START;
+			if (prio == MIDI_PRIO_DOWNLOAD && did <= MAX_DEVICE_EFFECTS)
+				gMidiDownloadsPending[did]--;
+			from = (from + len) & q->mask;
+			continue;
+			}
+
+		while (len--)
+			{
+			q->buffer[to] = q->buffer[from];
+			to = (to + 1) & q->mask;
+			from = (from + 1) & q->mask;
+			}
+		}
+	q->head = to;
+	}
+
+void FfbDiscardQueuedStarts(void)
+	{
+	HalUartTxIrq(0);	// the interrupt leaves the queues alone
+
+	// Starts go out as operations, or behind the modifies or the download
+	// of their effect
+	MidiDropStarts(MIDI_PRIO_OPERATION);
+	MidiDropStarts(MIDI_PRIO_MODIFY);
+	MidiDropStarts(MIDI_PRIO_DOWNLOAD);
+	LatencyMidiDiscarded();
+
+	if (FfbMidiBufferUsed())
+		HalUartTxIrq(1);
+	}
+
+uint8_t FfbMidiQueueUsed(uint8_t prio)
+	{
+	TMidiQueue *q = &gMidiQueues[prio];
+	return (q->head - q->tail) & q->mask;
+	}
+
+uint8_t FfbMidiQueueFree(uint8_t prio)
+	{
+	TMidiQueue *q = &gMidiQueues[prio];
+	uint8_t room = q->mask - ((q->head - q->tail) & q->mask);
+	return (room > MIDI_QUEUE_HEADER_LEN) ? room - MIDI_QUEUE_HEADER_LEN : 0;
+	}
+
+uint8_t FfbMidiBufferUsed(void)
+	{
+	uint8_t used = gMidiTxRemaining;
+	for (uint8_t prio = 0; prio < MIDI_PRIO_COUNT; prio++)
+		used += FfbMidiQueueUsed(prio);
+	return used;
+	}
+
+// Waits until the given queue has <room> free bytes
+static void MidiWaitRoom(TMidiQueue *q, uint8_t room)
+	{
+	while (q->mask - ((q->head - q->tail) & q->mask) < room)
+		{
+		// With interrupts disabled nobody else will drain the queue so do it here
+		if (!HalInterruptsEnabled() && HalUartTxReady())
+			MidiTransmitNext();
+		HalIdle();
+		}
+	}
+
+void FfbBeginMidi(uint8_t prio, uint8_t effectId, uint8_t len)
+	{
+	// Keep e.g. a free in order with all pending downloads
+	if (prio == MIDI_PRIO_IN_ORDER)
+		{
+		prio = MIDI_PRIO_OPERATION;
+		for (uint8_t id = 0; id <= MAX_DEVICE_EFFECTS; id++)
+			{
+			if (gMidiDownloadsPending[id])
+				{
+				prio = MIDI_PRIO_DOWNLOAD;
+				break;
+				}
+			}
+		}
+
+	// Keep the messages of an effect in order with its pending download,
+	// and a start behind the modifies of its effect
+	uint8_t did = effectId & ~MIDI_EFFECT_START;
+	if (did <= MAX_DEVICE_EFFECTS && gMidiDownloadsPending[did])
+		prio = MIDI_PRIO_DOWNLOAD;
+	else if ((effectId & MIDI_EFFECT_START) && prio < MIDI_PRIO_MODIFY && MidiQueueHolds(MIDI_PRIO_MODIFY, did))
+		prio = MIDI_PRIO_MODIFY;
+
+	TMidiQueue *q = &gMidiQueues[prio];
+	uint8_t room = len + MIDI_QUEUE_HEADER_LEN;
+
+	gMidiWriteQueue = NULL;
+	if (room > q->mask)
+		{	// Can never fit
+		gMidiBufferStats[prio].overflows++;
+		Trace2(TRACE_MIDI_OVERFLOW, prio, len);
 		return;
 		}
 
-	if (gMidiBufferHead - gMidiBuffer >= MIDI_BUFFER_SIZE)
-		gMidiBufferHead = gMidiBuffer;
+	if (q->mask - ((q->head - q->tail) & q->mask) < room)
+		{	// Queue full
+		gMidiBufferStats[prio].overflows++;
+		Trace2(TRACE_MIDI_OVERFLOW, prio, len);
 
-	sei();
+#ifdef MIDI_BUFFER_DROP_ON_OVERFLOW
+		return;
+#else
+		MidiWaitRoom(q, room);
+#endif
+		}
+
+	gMidiWriteQueue = q;
+	gMidiWriteStart = q->head;
+	q->buffer[gMidiWriteStart] = len;
+	q->buffer[(gMidiWriteStart + 1) & q->mask] = effectId;
+	gMidiWriteHead = (gMidiWriteStart + MIDI_QUEUE_HEADER_LEN) & q->mask;
 	}
 
+void FfbAppendMidi(const uint8_t *data, uint8_t len)
+	{
+	TMidiQueue *q = gMidiWriteQueue;
+	if (q == NULL)
+		return;	// dropped
+
+	if (DoDebug(DEBUG_DETAIL))
+		{
+		LogTextP(PSTR(" => Midi:")); LogBinaryLf(data, len);
+		}
+
+	uint8_t head = gMidiWriteHead;
+	while (len--)
+		{
+		q->buffer[head] = *data++;
+		head = (head + 1) & q->mask;
+		}
+	gMidiWriteHead = head;
+	}
 
-ISR(USART1_UDRE_vect)
+void FfbEndMidi(void)
 	{
-	cli();
+	TMidiQueue *q = gMidiWriteQueue;
+	if (q == NULL)
+		return;	// dropped
+	gMidiWriteQueue = NULL;
 
-	uint8_t i;
+	uint8_t prio = q - gMidiQueues;
+	uint8_t effectId = q->buffer[(gMidiWriteStart + 1) & q->mask] & ~MIDI_EFFECT_START;
 
-	if (gMidiBufferHead == gMidiBufferTail)
+	// Fix the length to what was actually appended
+	uint8_t len = ((gMidiWriteHead - gMidiWriteStart) & q->mask) - MIDI_QUEUE_HEADER_LEN;
+	if (len == 0)
+		return;
+	q->buffer[gMidiWriteStart] = len;
+
+	CRITICAL_VAR();
+	ENTER_CRITICAL();
+	if (prio == MIDI_PRIO_DOWNLOAD && effectId <= MAX_DEVICE_EFFECTS)
+		gMidiDownloadsPending[effectId]++;
+	q->head = gMidiWriteHead;	// commit the message
+	LatencyMidiQueued(prio, gMidiWriteHead);
+	EXIT_CRITICAL();
+
+	Trace3(TRACE_MIDI, prio, effectId, len);
+
+	uint8_t used = FfbMidiQueueUsed(prio);
+	if (used > gMidiBufferStats[prio].highWater)
+		gMidiBufferStats[prio].highWater = used;
+
+	if (HalInterruptsEnabled())
 		{
-		// Buffer is empty, disable transmit interrupt
-		UCSR1B = (1<<TXCIE1) | (1<<TXEN1);
+		HalUartTxIrq(1);	// let the interrupt drain the queues
 		}
-	else 
+	else
+		{	// Interrupts are not running yet - send synchronously
+		for (;;)
+			{
+			while (!HalUartTxReady())
+				HalIdle();
+			if (!MidiTransmitNext())
+				break;
+			}
+		}
+	}
+
+void FfbWaitMidiSent(void)
+	{
+	while (FfbMidiBufferUsed())
 		{
-		i = gMidiBufferTail + 1;
-		if (i >= MIDI_BUFFER_SIZE) i = 0;
-		UDR1 = gMidiBuffer[i];
-		gMidiBufferTail = i;
+		if (!HalInterruptsEnabled() && HalUartTxReady())
+			MidiTransmitNext();
+		HalIdle();
 		}
+	while (!HalUartTxReady())
+		HalIdle();
+	}
 
-	sei();
+// Runs with the other interrupts enabled, as anything delaying INT0 causes
+// problems reading data from the FFP joystick (see ADC_vect in Joystick.c).
+// Picking the next message can take a while with all the queues to look at.
+// The main program, the only other user of the queues, does not run before
+// this returns.
+HAL_UART_TX_ISR()
+	{
+	HalUartTxIsrNest();
+	if (MidiTransmitNext())
+		HalUartTxIrq(1);	// more to send, otherwise the queues are empty
 	}
 #endif // MIDI_BUFFER_SIZE
 
@@ -877,6 +1905,52 @@ uint8_t FfbDebugListEffects(uint8_t *index)
 	return 1;
 	}
 
+void FfbDebugListStats(void)
+	{
+	LogTextP(PSTR("Midi buffer used="));
+	uint8_t used = FfbMidiBufferUsed();
+	LogBinaryLf(&used, 1);
+
+	for (uint8_t prio = 0; prio < MIDI_PRIO_COUNT; prio++)
+		{
+		LogTextP(PSTR(" Prio "));
+		LogBinary(&prio, 1);
+		LogTextP(PSTR(": used="));
+		used = FfbMidiQueueUsed(prio);
+		LogBinary(&used, 1);
+		LogTextP(PSTR(", max="));
+		LogBinary((const void*) &gMidiBufferStats[prio].highWater, 1);
+		LogTextP(PSTR(", overflows="));
+		LogBinaryLf((const void*) &gMidiBufferStats[prio].overflows, 2);
+		}
+
+	LogTextP(PSTR("Downloads deferred="));
+	LogBinary((const void*) &gEffectDownloadStats.deferred, 2);
+	LogTextP(PSTR(", sent="));
+	LogBinary((const void*) &gEffectDownloadStats.downloaded, 2);
+	LogTextP(PSTR(", reused="));
+	LogBinary((const void*) &gEffectDownloadStats.reused, 2);
+	LogTextP(PSTR(", evicted="));
+	LogBinary((const void*) &gEffectDownloadStats.evicted, 2);
+	LogTextP(PSTR(", redownloaded="));
+	LogBinary((const void*) &gEffectDownloadStats.redownloaded, 2);
+	LogTextP(PSTR(", no room="));
+	LogBinary((const void*) &gEffectDownloadStats.noRoom, 2);
+	LogTextP(PSTR(", bytes saved="));
+	LogBinaryLf((const void*) &gEffectDownloadStats.bytesSaved, 4);
+
+	LogTextP(PSTR("Usb reports rejected: unknown="));
+	LogBinary(&gFfbReportRejects.unknownId, 2);
+	LogTextP(PSTR(", truncated="));
+	LogBinary(&gFfbReportRejects.truncated, 2);
+	LogTextP(PSTR(", bad effect="));
+	LogBinaryLf(&gFfbReportRejects.badEffect, 2);
+
+	LogTextP(PSTR("Modifies queued="));
+	LogBinary((const void*) &gModifyQueueStats.queued, 2);
+	LogTextP(PSTR(", coalesced="));
+	LogBinaryLf((const void*) &gModifyQueueStats.coalesced, 2);
+	}
 
 void FfbEnableSprings(uint8_t inEnable)
 	{
@@ -31,7 +31,7 @@
 #ifndef _FFB_
 #define _FFB_
 
-#include <avr/io.h>
+#include <stdint.h>
 
 
 /* Type Defines: */
@@ -39,8 +39,17 @@
  *  This mirrors the layout described to the host in the HID report descriptor, in Descriptors.c.
  */
 
-// Maximum number of parallel effects in memory
-#define MAX_EFFECTS 19  //Actually Max Effect ID , but effects IDs start at 0x02 so 1 less than this
+// Maximum number of parallel effects in memory. Only the effects being played
+// need to fit into the joystick at a time, the rest wait in RAM (~40 bytes each).
+#ifndef MAX_EFFECTS
+#define MAX_EFFECTS 22  //Actually Max Effect ID , but effects IDs start at 0x02 so 1 less than this
+#endif
+
+// Maximum effect ID in the joystick
+#define MAX_DEVICE_EFFECTS 19
+
+// Number of different MIDI waveform values (see midi_data_common_t)
+#define MIDI_EFFECT_TYPES 0x20
 //FFP can support 10 waveforms + 2 of each conditional = 18 not including other unsupported effect types
 //Wheel limits?
 
@@ -194,8 +203,24 @@ typedef struct
 	uint8_t		memoryManagement;	// Bits: 0=DeviceManagedPool, 1=SharedParameterBlocks
 	} USB_FFBReport_PIDPool_Feature_Data_t;
 
-// Lengths of each report type
-extern const uint16_t OutReportSize[];
+// Output reports with ids 1..OUT_REPORT_COUNT
+#define OUT_REPORT_COUNT 15
+
+// Longest feature report taken by SET_REPORT, longer requests are stalled
+#define FFB_FEATURE_REPORT_MAX 16
+
+// Returns the length of the given output report including the report id or 0 if the id is not handled
+uint8_t FfbOutReportSize(uint8_t reportId);
+
+// Output reports rejected by FfbOnUsbData()
+typedef struct
+	{
+	uint16_t unknownId;	// report id not handled
+	uint16_t truncated;	// shorter than the report
+	uint16_t badEffect;	// effect block index out of range
+	} TFfbReportRejects;
+
+extern TFfbReportRejects gFfbReportRejects;
 
 // Handles Force Feeback data manipulation from USB reports to joystick's MIDI channel
 
@@ -204,19 +229,36 @@ void FfbSetDriver(uint8_t id);
 // Initializes and enables MIDI to joystick using USART1 TX
 void FfbInitMidi(void);
 
+// Sets the joystick up again after it has lost its state (e.g. a loose
+// cable) keeping the effects of the host. Only starts the start-up sequence,
+// FfbMidiTask() runs it over the next ~450 ms and then downloads and starts
+// the playing effects again.
+void FfbReinitJoystick(void);
+
+// True while FfbReinitJoystick() is running the start-up sequence, which
+// pulses the lines the stick is read with
+uint8_t FfbReinitPending(void);
+
 // Send "enable FFB" to joystick
 void FfbSendEnable(void);
 
 // Send "disable FFB" to joystick
 void FfbSendDisable(void);
 
-// Handle incoming data from USB
-void FfbOnUsbData(uint8_t *data, uint16_t len);
+// Handle incoming data from USB, one output report at a time. Returns 0 if the report was rejected.
+uint8_t FfbOnUsbData(uint8_t *data, uint16_t len);
 
 // Handle incoming feature requests
+// (load status 3 for an effect type that is not 1..USB_EFFECT_CUSTOM)
 void FfbOnCreateNewEffect(USB_FFBReport_CreateNewEffect_Feature_Data_t* inData, USB_FFBReport_PIDBlockLoad_Feature_Data_t *outData);
 void FfbOnPIDPool(USB_FFBReport_PIDPool_Feature_Data_t *data);
 
+// Effects being played, bit <id>-1 for effect <id>
+uint32_t FfbPlayingEffects(void);
+
+// Last device gain from the host, 255 (full) if none yet
+uint8_t FfbDeviceGain(void);
+
 // Utility to wait any amount of milliseconds.
 // Resets watchdog for each 1ms wait.
 void WaitMs(int ms);
@@ -226,7 +268,130 @@ void WaitMs(int ms);
 // max delay 2560us.
 void _delay_us10(uint8_t delay);
 
-// Send raw data to the
+// MIDI messages are sent in priority order. A message already on the wire is
+// always completed first, so a higher priority message waits at most one message.
+#define MIDI_PRIO_CONTROL	0	// device control: reset and stop all
+#define MIDI_PRIO_OPERATION	1	// effect start/stop/free
+#define MIDI_PRIO_MODIFY	2	// effect parameter modifies and device gain
+#define MIDI_PRIO_DOWNLOAD	3	// effect downloads (SysEx) and raw data
+#define MIDI_PRIO_COUNT		4
+
+// For FfbSendMidi(), a message that must not overtake anything queued before
+// it: goes out as an operation when no download is waiting, otherwise it
+// keeps its order with the downloads. E.g. the other device controls, and
+// an effect free, as the joystick gives a downloaded effect the lowest free
+// id at the time the download gets there.
+#define MIDI_PRIO_IN_ORDER	MIDI_PRIO_COUNT
+#define MIDI_PRIO_FREE		MIDI_PRIO_IN_ORDER
+
+// Returned by the StartupStep() of a driver after the last step
+#define FFB_STARTUP_DONE	0xFF
+
+// Set in the effect id given to FfbSendMidi() for a message that starts
+// effects: it goes out behind the modifies of its effect still queued, and
+// Stop All can drop it while queued
+#define MIDI_EFFECT_START	0x80
+
+// Size of the interrupt driven MIDI transmit buffer for effect downloads and
+// raw data in bytes (power of two, max 128). Define as 0 to transmit each byte
+// synchronously instead, without any prioritization.
+#ifndef MIDI_BUFFER_SIZE
+#define MIDI_BUFFER_SIZE 64
+#endif
+
+// Sizes of the buffers of the higher priority classes (power of two, max 128)
+#ifndef MIDI_CONTROL_BUFFER_SIZE
+#define MIDI_CONTROL_BUFFER_SIZE 16
+#endif
+
+#ifndef MIDI_OPERATION_BUFFER_SIZE
+#define MIDI_OPERATION_BUFFER_SIZE 32
+#endif
+
+#ifndef MIDI_MODIFY_BUFFER_SIZE
+#define MIDI_MODIFY_BUFFER_SIZE 32
+#endif
+
+// Longest single message that fits into the download buffer
+#if MIDI_BUFFER_SIZE == 0
+#define MIDI_MESSAGE_MAX_LEN 64
+#else
+#define MIDI_MESSAGE_MAX_LEN (MIDI_BUFFER_SIZE - 3)
+#endif
+
+// When a buffer is full FfbBeginMidi() waits for the line to make room.
+// Define MIDI_BUFFER_DROP_ON_OVERFLOW to discard the message instead.
+//#define MIDI_BUFFER_DROP_ON_OVERFLOW
+
+typedef struct
+	{
+	uint16_t overflows;	// messages that found the buffer full
+	uint8_t highWater;	// most bytes ever waiting in the buffer
+	} TMidiBufferStats;
+
+extern volatile TMidiBufferStats gMidiBufferStats[MIDI_PRIO_COUNT];
+
+// Number of bytes waiting in all MIDI transmit buffers
+uint8_t FfbMidiBufferUsed(void);
+
+// Number of bytes waiting in / longest message that fits now into the given class buffer
+uint8_t FfbMidiQueueUsed(uint8_t prio);
+uint8_t FfbMidiQueueFree(uint8_t prio);
+
+// Waits until all buffered MIDI data has been handed to the USART
+void FfbWaitMidiSent(void);
+
+// Drops the operations, modifies and downloads waiting for the MIDI line,
+// for a Reset that empties the joystick. The message on the wire is finished.
+void FfbDiscardQueuedMidi(void);
+
+// Drops the starts waiting for the MIDI line, for a Stop All sent ahead of
+// them. The downloads and frees stay, the joystick's effect ids depend on them.
+void FfbDiscardQueuedStarts(void);
+
+// Sends one MIDI message of the given priority class. <effectId> is the
+// effect the message is about (0 if none); its messages keep their order
+// with an earlier download of the same effect.
+void FfbSendMidi(uint8_t prio, uint8_t effectId, const uint8_t *data, uint8_t len);
+
+// Same as FfbSendMidi() for a message built from several pieces: the
+// message of max <len> bytes is sent only after FfbEndMidi().
+void FfbBeginMidi(uint8_t prio, uint8_t effectId, uint8_t len);
+void FfbAppendMidi(const uint8_t *data, uint8_t len);
+void FfbEndMidi(void);
+
+// Number of effect parameter modifies that can wait for the MIDI line.
+// A newer value for the same effect and address replaces the queued one.
+// Define as 0 to send each modify immediately.
+#ifndef MIDI_MODIFY_QUEUE_SIZE
+#define MIDI_MODIFY_QUEUE_SIZE 8
+#endif
+
+// Longest modify message of the supported devices
+#define MIDI_MODIFY_MAX_LEN 6
+
+typedef struct
+	{
+	uint16_t queued;	// modifies requested by the USB reports
+	uint16_t coalesced;	// of those, replaced a still pending value
+	} TModifyQueueStats;
+
+extern volatile TModifyQueueStats gModifyQueueStats;
+
+// Queues a modify of the given effect parameter, merging with a pending one
+void FfbQueueModify(uint8_t effectId, uint8_t address, uint16_t value);
+
+// Moves as many pending modifies to MIDI as fit into its buffer now
+void FfbFlushModifies(void);
+
+// Drops the pending modifies of the given effect (0x7F for all effects).
+// Returns the number of modifies dropped.
+uint8_t FfbDiscardModifies(uint8_t effectId);
+
+// Called from the main loop - sends the pending modifies once the earlier ones have been sent
+void FfbMidiTask(void);
+
+// Send raw data to the joystick (lowest priority)
 void FfbSendData(const uint8_t *data, uint16_t len);
 void FfbSendPackets(const uint8_t *data, uint16_t len);
 void FfbPulseX1( void );
@@ -236,6 +401,9 @@ void FfbPulseX1( void );
 //	Returns 0 when no more effects
 uint8_t FfbDebugListEffects(uint8_t *index);
 
+// Debugging: logs the adapter's runtime statistics (MIDI buffer usage etc.)
+void FfbDebugListStats(void);
+
 // Effect manipulations
 
 typedef struct 
@@ -245,13 +413,42 @@ typedef struct
 	uint8_t constants;
 	uint8_t triangles;
 	uint8_t sines;
-	uint8_t effectId[MAX_EFFECTS];
+	uint8_t effectId[MAX_EFFECTS+1];	// by effect id 1..MAX_EFFECTS
 	} TDisabledEffectTypes;
 
 extern volatile TDisabledEffectTypes gDisabledEffects;
 
+// Define as 1 to download an effect to the joystick only when it is first
+// started instead of when its Set Effect report arrives. Games often create
+// many more effects than they ever play e.g. when loading a level.
+#ifndef FFB_LAZY_DOWNLOAD
+#define FFB_LAZY_DOWNLOAD 1
+#endif
+
+// Define as 1 to leave freed effects in the joystick for as long as their
+// room is not needed. A new effect with identical data then just takes over
+// the joystick's effect instead of being downloaded again.
+#ifndef FFB_REUSE_EFFECTS
+#define FFB_REUSE_EFFECTS 1
+#endif
+
+typedef struct
+	{
+	uint16_t deferred;	// effects whose download waited for the first start
+	uint16_t downloaded;	// effect downloads sent to the joystick
+	uint16_t reused;	// downloads avoided by taking over an identical freed effect in the joystick
+	uint16_t evicted;	// effects removed from the joystick to make room
+	uint16_t redownloaded;	// downloads of effects evicted earlier
+	uint16_t noRoom;	// effects that could not be downloaded as all in the joystick were playing
+	uint32_t bytesSaved;	// MIDI bytes of downloads never sent or avoided by reuse
+	} TEffectDownloadStats;
+
+extern volatile TEffectDownloadStats gEffectDownloadStats;
+
 uint8_t GetMidiEffectType(uint8_t id);
-void FfbSendSysEx(const uint8_t* midi_data, uint8_t len);
+uint8_t GetDeviceMidiEffectType(uint8_t did);
+uint8_t GetDeviceMidiEffectCount(uint8_t midiType);
+void FfbSendSysEx(uint8_t effectId, const uint8_t* midi_data, uint8_t len);
 uint8_t FfbSetParamMidi_14bit(uint8_t effectState, volatile uint16_t *midi_data_param, uint8_t effectId, uint8_t address, uint16_t value);
 uint8_t FfbSetParamMidi_7bit(uint8_t effectState, volatile uint8_t *midi_data_param, uint8_t effectId, uint8_t address, uint8_t value);
 uint16_t UsbUint16ToMidiUint14_Time(uint16_t inUsbValue);
@@ -271,6 +468,8 @@ void FfbEnableEffectId(uint8_t inId, uint8_t inEnable);
 #define MEffectState_Allocated		0x01
 #define MEffectState_Playing		0x02
 #define MEffectState_SentToJoystick	0x04
+#define MEffectState_Staged			0x08	// effect data set, can be downloaded
+#define MEffectState_Evicted		0x10	// removed from the joystick to make room
 
 #define USB_DURATION_INFINITE	0xFFFF
 #define MIDI_DURATION_INFINITE	0x0000
@@ -314,15 +513,18 @@ typedef struct {
 	uint8_t state;	// see constants <MEffectState_*>
 	uint8_t share_data[MAX_SHARE_DATA]; // All data to be shared between Output reports for calculating MIDI parameters coupled to multiple USB parameters
 	volatile uint8_t	data[MAX_MIDI_MSG_LEN];
+	uint8_t dataLen;	// length of <data> to download
+	uint8_t deviceId;	// effect id in the joystick when downloaded
 	} TEffectState;
 
 typedef struct
 	{
-	void (*EnableInterrupts)(void);
+	uint8_t (*StartupStep)(uint8_t step);	// runs a step of the start-up sequence, returns ms to wait after it
 	const uint8_t* (*GetSysExHeader)(uint8_t* hdr_len);
 	uint8_t (*DeviceControl)(uint8_t usb_control);
 	uint8_t (*UsbToMidiEffectType)(uint8_t usb_effect_type);
-	uint8_t (*EffectMemFull)(uint8_t new_midi_type);
+	uint8_t (*DeviceMemFull)(uint8_t new_midi_type);	// checks the effects in the joystick
+	uint8_t (*DeviceMemGroup)(uint8_t midi_type);	// effect types sharing a DeviceMemFull() limit, 0 if none
 	
 	void (*StartEffect)(uint8_t eid);
 	void (*StopEffect)(uint8_t eid);
@@ -0,0 +1,117 @@
+/*
+  Force Feedback Joystick
+  Binary framed commands for the virtual serial port.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+
+#include "frame.h"
+
+#define FRAME_STATE_IDLE	0
+#define FRAME_STATE_LENGTH	1
+#define FRAME_STATE_BODY	2
+#define FRAME_STATE_CRC		3
+
+void FrameInit(TFrameParser *parser)
+	{
+	parser->state = FRAME_STATE_IDLE;
+	parser->stats.ok = 0;
+	parser->stats.crcErrors = 0;
+	parser->stats.tooLong = 0;
+	parser->stats.empty = 0;
+	}
+
+uint8_t FrameBusy(const TFrameParser *parser)
+	{
+	return parser->state != FRAME_STATE_IDLE;
+	}
+
+uint8_t FrameParse(TFrameParser *parser, uint8_t data)
+	{
+	switch (parser->state)
+		{
+		case FRAME_STATE_IDLE:
+			if (data != FRAME_START)
+				return FRAME_ERROR;
+			parser->state = FRAME_STATE_LENGTH;
+			return FRAME_MORE;
+
+		case FRAME_STATE_LENGTH:
+			if (data == 0)
+				{
+				parser->stats.empty++;
+				parser->state = FRAME_STATE_IDLE;
+				return FRAME_ERROR;
+				}
+			parser->len = data;
+			parser->pos = 0;
+			parser->crc = FrameCrc8(0, data);
+			parser->state = FRAME_STATE_BODY;
+			return FRAME_MORE;
+
+		case FRAME_STATE_BODY:
+			parser->crc = FrameCrc8(parser->crc, data);
+			if (parser->pos == 0)
+				parser->command = data;
+			else if (parser->pos <= FRAME_DATA_MAX)
+				parser->data[parser->pos - 1] = data;
+			if (++parser->pos == parser->len)
+				parser->state = FRAME_STATE_CRC;
+			return FRAME_MORE;
+
+		default:
+			parser->state = FRAME_STATE_IDLE;
+			if (parser->len - 1 > FRAME_DATA_MAX)
+				{	// skipped to its end to stay in sync
+				parser->stats.tooLong++;
+				return FRAME_ERROR;
+				}
+			if (data != parser->crc)
+				{
+				parser->stats.crcErrors++;
+				return FRAME_ERROR;
+				}
+			parser->stats.ok++;
+			return FRAME_DONE;
+		}
+	}
+
+uint8_t FrameEncode(uint8_t *out, uint8_t command, const void *data, uint8_t len)
+	{
+	const uint8_t *p = (const uint8_t*) data;
+	uint8_t crc;
+
+	out[0] = FRAME_START;
+	out[1] = len + 1;
+	out[2] = command;
+	crc = FrameCrc8(FrameCrc8(0, out[1]), command);
+	for (uint8_t i = 0; i < len; i++)
+		{
+		out[3 + i] = p[i];
+		crc = FrameCrc8(crc, p[i]);
+		}
+	out[3 + len] = crc;
+
+	return len + FRAME_OVERHEAD;
+	}
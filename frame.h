@@ -0,0 +1,92 @@
+/*
+  Force Feedback Joystick
+  Binary framed commands for the virtual serial port.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include <stdint.h>
+
+// An alternative to the ASCII commands of main.c for tools that stream
+// them. A frame is
+//	FRAME_START, length, command, data..., crc
+// where <length> counts the command and data bytes and <command> is one of
+// the command letters with its data in binary instead of hex, e.g. 'u'
+// followed by an output report. <crc> is the CRC-8 with polynomial 0x07
+// and initial value 0 of the length, command and data bytes.
+//
+// Frames may follow each other and span USB packets freely. They are
+// recognized where the ASCII parser waits for the next command letter.
+
+#define FRAME_START			0x02
+#define FRAME_DATA_MAX		64		// the largest output report fits
+#define FRAME_OVERHEAD		4		// start, length, command, crc
+
+typedef struct
+	{
+	uint16_t	ok;
+	uint16_t	crcErrors;
+	uint16_t	tooLong;	// more data than FRAME_DATA_MAX
+	uint16_t	empty;		// length 0
+	} TFrameStats;
+
+typedef struct
+	{
+	uint8_t		state;		// internal
+	uint8_t		len;		// command and data bytes
+	uint8_t		pos;		// of them received
+	uint8_t		crc;
+	uint8_t		command;
+	uint8_t		data[FRAME_DATA_MAX];
+	TFrameStats	stats;
+	} TFrameParser;
+
+// Results of FrameParse()
+#define FRAME_MORE			0	// part of a frame
+#define FRAME_DONE			1	// a valid frame in <command> and <data>, <len> - 1 data bytes
+#define FRAME_ERROR			2	// the frame was dropped and counted in the stats
+
+void FrameInit(TFrameParser *parser);
+
+// True if a frame has been started. Otherwise only FRAME_START starts one.
+uint8_t FrameBusy(const TFrameParser *parser);
+
+uint8_t FrameParse(TFrameParser *parser, uint8_t data);
+
+static inline uint8_t FrameCrc8(uint8_t crc, uint8_t data)
+	{
+	crc ^= data;
+	for (uint8_t bit = 0; bit < 8; bit++)
+		crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+	return crc;
+	}
+
+// Writes the frame of <command> and <len> (up to FRAME_DATA_MAX) bytes of
+// <data> to <out>, which needs room for len + FRAME_OVERHEAD bytes. Returns
+// the frame length.
+uint8_t FrameEncode(uint8_t *out, uint8_t command, const void *data, uint8_t len);
+
+#endif // _FRAME_H_
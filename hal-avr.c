@@ -0,0 +1,153 @@
+/*
+  Force Feedback Joystick
+  Hardware abstraction for the ATmega32U4. See hal.h.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#include "hal.h"
+
+#include "main.h"
+
+volatile uint32_t gHalMicrosHigh = 0;
+
+#ifdef FFB_BENCH
+
+volatile uint16_t gHalBenchMidiBytes = 0;
+
+// Timer 1 counts the cycles (see bench.c), HalMicros() returns them halved
+void HalMicrosInit(void)
+	{
+	}
+
+uint16_t HalMillis(void)
+	{
+	return 0;
+	}
+
+// No USB in the benchmark build
+uint16_t HalLogWrite(const void *data, uint16_t len)
+	{
+	return len;
+	}
+
+#else
+
+// The milliseconds of the overflows so far and the microseconds left over,
+// kept along so that HalMillis() needs no 32-bit division
+static volatile uint16_t gHalMillisHigh = 0;
+static volatile uint16_t gHalMillisFraction = 0;	// 0..999 us
+
+// Timer 1 is the one time base of the firmware: Joystick.c times the reads
+// of the stick from the start of frame with it, the trace and the latency
+// probes stamp with it and HalMillis() counts with it, USB running or not.
+// Joystick_Init() starts it once init_hw() of 3DPro.c is done with the
+// timer. The gameport code resets the prescaler it shares with Timer 0,
+// which loses less than 0.5 us each time.
+void HalMicrosInit(void)
+	{
+	TCCR1A = 0;
+	TCCR1B = (1<<CS11);	// F_CPU/8, two counts per microsecond
+	TCNT1 = 0;
+	gHalMicrosHigh = 0;
+	gHalMillisHigh = 0;
+	gHalMillisFraction = 0;
+	TIFR1 = (1<<TOV1);
+	TIMSK1 = (1<<TOIE1);
+	}
+
+ISR(TIMER1_OVF_vect)
+	{
+	gHalMicrosHigh += 0x8000;
+	gHalMillisHigh += 32;	// 0x8000 us = 32 ms + 768 us
+	gHalMillisFraction += 768;
+	if (gHalMillisFraction >= 1000)
+		{
+		gHalMillisFraction -= 1000;
+		gHalMillisHigh++;
+		}
+	}
+
+uint16_t HalMillis(void)
+	{
+	CRITICAL_VAR();
+	ENTER_CRITICAL();
+	uint16_t ticks = TCNT1;
+	uint16_t ms = gHalMillisHigh;
+	uint16_t us = gHalMillisFraction;
+	if ((TIFR1 & (1<<TOV1)) && ticks < 0x8000)
+		{	// overflowed after entering, the interrupt is still pending
+		ms += 32;
+		us += 768;
+		}
+	EXIT_CRITICAL();
+	us += ticks >> 1;	// at most 999 + 768 + 32767
+	return ms + us / 1000;
+	}
+
+#if HAL_LOG_PACKET_SIZE != CDC_TXRX_EPSIZE
+#error "HAL_LOG_PACKET_SIZE must match CDC_TXRX_EPSIZE"
+#endif
+
+static uint8_t gHalLogFullPacket = 0;	// the last packet sent was full
+
+// The debug log goes to the second virtual serial port, a packet into each
+// free bank of its endpoint
+uint16_t HalLogWrite(const void *data, uint16_t len)
+	{
+	if (USB_DeviceState != DEVICE_STATE_Configured)
+		return 0;
+
+	// Called from the control request handlers too
+	uint8_t endpoint = Endpoint_GetCurrentEndpoint();
+	Endpoint_SelectEndpoint(CDC1_TX_EPNUM);
+
+	const uint8_t *p = (const uint8_t*) data;
+	uint16_t sent = 0;
+
+	if (len == 0)
+		{
+		// The host holds a full packet back until a shorter one follows
+		if (gHalLogFullPacket && Endpoint_IsINReady())
+			{
+			Endpoint_ClearIN();
+			gHalLogFullPacket = 0;
+			}
+		}
+	else
+		{
+		while (sent < len && Endpoint_IsINReady())
+			{
+			uint8_t n = (len - sent < CDC_TXRX_EPSIZE) ? len - sent : CDC_TXRX_EPSIZE;
+			for (uint8_t i = 0; i < n; i++)
+				Endpoint_Write_8(*p++);
+			Endpoint_ClearIN();
+			sent += n;
+			gHalLogFullPacket = (n == CDC_TXRX_EPSIZE);
+			}
+		}
+
+	Endpoint_SelectEndpoint(endpoint);
+	return sent;
+	}
+
+#endif // FFB_BENCH
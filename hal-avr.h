@@ -0,0 +1,178 @@
+/*
+  Force Feedback Joystick
+  Hardware abstraction for the ATmega32U4. See hal.h.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#ifndef _HAL_AVR_H_
+#define _HAL_AVR_H_
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#include <util/delay.h>
+#include <LUFA/Drivers/Board/LEDs.h>
+
+#include "3DPro.h"
+
+// ---- MIDI UART, USART1 with TX on PD3
+
+#ifdef FFB_BENCH
+// Benchmark build (see bench.c): the bytes go to GPIOR2 at CPU speed and
+// the core always sends synchronously, so that the cycle counts include
+// the work per byte but not the waiting for the line
+extern volatile uint16_t gHalBenchMidiBytes;
+#endif
+
+static inline void HalUartInit(uint32_t baud)
+	{
+	// Check TX-pin (PD3) settings
+	DDRD = DDRD | 0b00001000;
+
+	// Set baud rate
+	UCSR1A = 0;
+	UBRR1 = ((F_CPU/(baud<<4))-1);
+
+	// Set frame format to 8 data bits, no parity, 1 stop bit, 1 start bit
+	UCSR1C = (1<<7)|(1<<UCSZ11)|(1<<UCSZ10);
+	// Enable transmitter only
+	UCSR1B = (1<<TXEN1);
+	}
+
+static inline uint8_t HalUartTxReady(void)
+	{
+#ifdef FFB_BENCH
+	return 1;
+#else
+	return UCSR1A & (1<<UDRE1);
+#endif
+	}
+
+static inline void HalUartTx(uint8_t data)
+	{
+#ifdef FFB_BENCH
+	GPIOR2 = data;
+	gHalBenchMidiBytes++;
+#else
+	UDR1 = data;
+#endif
+	}
+
+static inline void HalUartTxIrq(uint8_t enable)
+	{
+	if (enable)
+		UCSR1B |= (1<<UDRIE1);
+	else
+		UCSR1B &= ~(1<<UDRIE1);
+	}
+
+#define HAL_UART_TX_ISR()	ISR(USART1_UDRE_vect)
+
+// The transmit interrupt stays pending while UDR1 is empty, so it is
+// disabled before the others are let in
+static inline void HalUartTxIsrNest(void)
+	{
+	UCSR1B &= ~(1<<UDRIE1);
+	sei();
+	}
+
+static inline uint8_t HalInterruptsEnabled(void)
+	{
+#ifdef FFB_BENCH
+	return 0;	// the interrupts only run the cycle counter
+#else
+	return bit_is_set(SREG, SREG_I);
+#endif
+	}
+
+// The hardware runs on its own while we spin
+static inline void HalIdle(void)
+	{
+	}
+
+// ---- Time
+
+// Milliseconds from Timer 1 like HalMicros(), running whether or not USB is
+uint16_t HalMillis(void);
+
+// Microseconds counted by Timer 1 at F_CPU/8 (see HalMicrosInit), the
+// overflow interrupt adding the high part
+extern volatile uint32_t gHalMicrosHigh;
+
+void HalMicrosInit(void);
+
+static inline uint32_t HalMicros(void)
+	{
+	CRITICAL_VAR();
+	ENTER_CRITICAL();
+	uint16_t ticks = TCNT1;
+	uint32_t high = gHalMicrosHigh;
+	if ((TIFR1 & (1<<TOV1)) && ticks < 0x8000)
+		high += 0x8000;	// overflowed after entering, the interrupt is still pending
+	EXIT_CRITICAL();
+	return high + (ticks >> 1);
+	}
+
+#define HalDelayUs(us)	_delay_us(us)
+#define HalDelayMs(ms)	_delay_ms(ms)
+
+static inline void HalWatchdogReset(void)
+	{
+	wdt_reset();
+	}
+
+// ---- Board
+
+#define HAL_LEDS_ALL	LEDS_ALL_LEDS
+#define HAL_LEDS_NONE	LEDS_NO_LEDS
+
+static inline void HalSetLeds(uint8_t leds)
+	{
+	LEDs_SetAllLEDs(leds);
+	}
+
+// Pulls the X1 and Y2 gameport lines low or releases them
+static inline void HalStickTrigger(uint8_t pull)
+	{
+	if (pull)
+		{
+		clr_bit( TRGDDR, TRGX1BIT ) ;
+		clr_bit( TRGDDR, TRGY2BIT ) ;
+		}
+	else
+		{
+		set_bit( TRGDDR, TRGX1BIT ) ;
+		set_bit( TRGDDR, TRGY2BIT ) ;
+		}
+	}
+
+// ---- Program memory
+
+#define HalReadPgmPtr(p)	((void*) pgm_read_word(p))
+
+// ---- Debug log, CDC_TXRX_EPSIZE of the second virtual serial port
+
+#define HAL_LOG_PACKET_SIZE	16
+
+#endif // _HAL_AVR_H_
@@ -0,0 +1,232 @@
+/*
+  Force Feedback Joystick
+  Hardware abstraction for running the force feedback core natively on
+  Linux against virtual time. See hal.h.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#include "hal.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Defined by HAL_UART_TX_ISR() when the core is built with MIDI buffering
+void HalUartTxIsr(void) __attribute__((weak));
+
+static uint32_t gNowUs = 0;
+
+static uint32_t gByteUs = 320;		// 31250 baud, 8N1
+static uint32_t gShiftEndUs = 0;	// when the shift register is free
+static uint8_t gTxPending = 0;		// byte waiting for the shift register
+static uint8_t gTxData = 0;
+static uint8_t gTxIrq = 0;
+static uint8_t gInterrupts = 0;
+
+static uint8_t gLeds = 0;
+static THalLinuxStats gStats;
+
+static THalUartSink gUartSink = NULL;
+static void *gUartSinkContext = NULL;
+
+static void DefaultLogSink(const void *data, uint16_t len)
+	{
+	fwrite(data, 1, len, stderr);
+	}
+
+static THalLogSink gLogSink = DefaultLogSink;
+
+static void UartShift(uint32_t startUs, uint8_t data)
+	{
+	gShiftEndUs = startUs + gByteUs;
+	gStats.uartBytes++;
+	if (gUartSink)
+		gUartSink(gUartSinkContext, data, gShiftEndUs);
+	}
+
+// Moves the waiting byte to the shift register if it has become free
+static void UartUpdate(void)
+	{
+	if (gTxPending && gNowUs >= gShiftEndUs)
+		{
+		gTxPending = 0;
+		UartShift(gShiftEndUs, gTxData);
+		}
+	}
+
+void HalUartInit(uint32_t baud)
+	{
+	gByteUs = (10 * 1000000UL + baud / 2) / baud;
+	gTxPending = 0;
+	gTxIrq = 0;
+	gShiftEndUs = gNowUs;
+	}
+
+uint8_t HalUartTxReady(void)
+	{
+	UartUpdate();
+	return !gTxPending;
+	}
+
+void HalUartTx(uint8_t data)
+	{
+	UartUpdate();
+	if (gTxPending)
+		gStats.uartOverruns++;	// the AVR would lose one of them as well
+	else if (gNowUs >= gShiftEndUs)
+		UartShift(gNowUs, data);
+	else
+		{
+		gTxPending = 1;
+		gTxData = data;
+		}
+	}
+
+void HalUartTxIrq(uint8_t enable)
+	{
+	gTxIrq = enable;
+	}
+
+uint8_t HalInterruptsEnabled(void)
+	{
+	return gInterrupts;
+	}
+
+void HalLinuxAdvance(uint32_t us)
+	{
+	uint32_t targetUs = gNowUs + us;
+
+	for (;;)
+		{
+		UartUpdate();
+		if (gTxIrq && gInterrupts && !gTxPending && HalUartTxIsr)
+			{
+			gStats.uartInterrupts++;
+			HalUartTxIsr();
+			continue;
+			}
+
+		if (!gTxPending || gShiftEndUs > targetUs)
+			break;
+		gNowUs = gShiftEndUs;
+		}
+
+	gNowUs = targetUs;
+	}
+
+// Skips to when the UART can take the next byte
+void HalIdle(void)
+	{
+	if (gShiftEndUs > gNowUs)
+		HalLinuxAdvance(gShiftEndUs - gNowUs);
+	else
+		HalLinuxAdvance(1);
+	}
+
+uint16_t HalMillis(void)
+	{
+	return gNowUs / 1000;
+	}
+
+void HalMicrosInit(void)
+	{
+	}
+
+uint32_t HalMicros(void)
+	{
+	return gNowUs;
+	}
+
+void HalDelayUs(uint16_t us)
+	{
+	HalLinuxAdvance(us);
+	}
+
+void HalDelayMs(uint16_t ms)
+	{
+	HalLinuxAdvance(ms * 1000UL);
+	}
+
+void HalWatchdogReset(void)
+	{
+	gStats.watchdogResets++;
+	}
+
+void HalSetLeds(uint8_t leds)
+	{
+	gLeds = leds;
+	}
+
+void HalStickTrigger(uint8_t pull)
+	{
+	if (pull)
+		gStats.stickTriggers++;
+	}
+
+uint16_t HalLogWrite(const void *data, uint16_t len)
+	{
+	if (gLogSink && len > 0)
+		gLogSink(data, len);
+	return len;
+	}
+
+void HalLinuxSetUartSink(THalUartSink sink, void *context)
+	{
+	gUartSink = sink;
+	gUartSinkContext = context;
+	}
+
+void HalLinuxSetLogSink(THalLogSink sink)
+	{
+	gLogSink = sink;
+	}
+
+void HalLinuxSetInterrupts(uint8_t enable)
+	{
+	gInterrupts = enable;
+	}
+
+uint32_t HalLinuxMicros(void)
+	{
+	return gNowUs;
+	}
+
+uint8_t HalLinuxLeds(void)
+	{
+	return gLeds;
+	}
+
+const THalLinuxStats* HalLinuxGetStats(void)
+	{
+	return &gStats;
+	}
+
+void HalLinuxReset(void)
+	{
+	gNowUs = 0;
+	gShiftEndUs = 0;
+	gTxPending = 0;
+	gTxIrq = 0;
+	gInterrupts = 0;
+	gLeds = 0;
+	memset(&gStats, 0, sizeof(gStats));
+	}
@@ -0,0 +1,121 @@
+/*
+  Force Feedback Joystick
+  Hardware abstraction for running the force feedback core natively on
+  Linux against virtual time. See hal.h.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#ifndef _HAL_LINUX_H_
+#define _HAL_LINUX_H_
+
+#include <stdint.h>
+
+// Time only moves when the core waits (HalIdle, HalDelayUs, HalDelayMs) or
+// when the program calls HalLinuxAdvance(). The UART takes 10 bit times per
+// byte and, like the AVR, holds one byte in the shift register and one
+// waiting behind it. The transmit interrupt runs only while time advances.
+
+// ---- MIDI UART
+
+void HalUartInit(uint32_t baud);
+uint8_t HalUartTxReady(void);
+void HalUartTx(uint8_t data);
+void HalUartTxIrq(uint8_t enable);
+uint8_t HalInterruptsEnabled(void);
+void HalIdle(void);
+
+#define HAL_UART_TX_ISR()	void HalUartTxIsr(void)
+#define HalUartTxIsrNest()	HalUartTxIrq(0)
+
+// ---- Time
+
+uint16_t HalMillis(void);
+void HalMicrosInit(void);
+uint32_t HalMicros(void);
+void HalDelayUs(uint16_t us);
+void HalDelayMs(uint16_t ms);
+void HalWatchdogReset(void);
+
+// ---- Board
+
+#define HAL_LEDS_ALL	0x0F
+#define HAL_LEDS_NONE	0x00
+
+void HalSetLeds(uint8_t leds);
+void HalStickTrigger(uint8_t pull);
+
+// ---- Program memory is ordinary memory
+
+#define PROGMEM
+#define PSTR(s)				(s)
+#define pgm_read_byte(p)	(*(const uint8_t*) (p))
+#define pgm_read_word(p)	(*(const uint16_t*) (p))
+#define HalReadPgmPtr(p)	(*(void* const*) (p))
+
+// ---- Debug log, taken a byte at a time as it comes
+
+#define HAL_LOG_PACKET_SIZE	1
+
+// ---- Critical sections, nothing interrupts the core between waits
+
+#define CRITICAL_VAR()
+#define ENTER_CRITICAL()	do { } while (0)
+#define EXIT_CRITICAL()		do { } while (0)
+
+#define FA_NOINLINE( _f )	__attribute__((__noinline__)) _f
+
+// ---- Control of the virtual hardware
+
+// Receives each byte sent by the UART at <timeUs> when its stop bit ends
+typedef void (*THalUartSink)(void *context, uint8_t data, uint32_t timeUs);
+
+// Receives the debug log. By default it goes to stderr.
+typedef void (*THalLogSink)(const void *data, uint16_t len);
+
+typedef struct
+	{
+	uint32_t uartBytes;
+	uint32_t uartOverruns;		// bytes written when HalUartTxReady() was false
+	uint32_t uartInterrupts;
+	uint32_t watchdogResets;
+	uint32_t stickTriggers;
+	} THalLinuxStats;
+
+void HalLinuxSetUartSink(THalUartSink sink, void *context);
+void HalLinuxSetLogSink(THalLogSink sink);
+
+// Interrupts are disabled at reset as in the AVR, making the core send
+// MIDI synchronously by polling
+void HalLinuxSetInterrupts(uint8_t enable);
+
+// Runs the virtual time forward, sending the UART and running its interrupt
+void HalLinuxAdvance(uint32_t us);
+uint32_t HalLinuxMicros(void);
+
+uint8_t HalLinuxLeds(void);
+const THalLinuxStats* HalLinuxGetStats(void);
+
+// Back to the power up state with time at 0
+void HalLinuxReset(void);
+
+#endif // _HAL_LINUX_H_
@@ -0,0 +1,78 @@
+/*
+  Force Feedback Joystick
+  Hardware abstraction for the force feedback core (ffb*.c, debug.c) so that
+  it runs both in the AVR and natively on a PC.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#ifndef _HAL_H_
+#define _HAL_H_
+
+#include <stdint.h>
+
+// Each platform provides the following, as functions or as macros where
+// the AVR needs compile time constants or inlining:
+//
+// MIDI UART (transmit only)
+//	void HalUartInit(uint32_t baud)		8N1, transmitter enabled
+//	uint8_t HalUartTxReady(void)		true if HalUartTx() can take a byte
+//	void HalUartTx(uint8_t data)
+//	void HalUartTxIrq(uint8_t enable)	the "transmit buffer empty" interrupt
+//	HAL_UART_TX_ISR()					defines its handler
+//	void HalUartTxIsrNest(void)			lets other interrupts in during the
+//										handler, the transmit interrupt off
+//	uint8_t HalInterruptsEnabled(void)
+//	void HalIdle(void)					called from busy-wait loops
+//
+// Time
+//	uint16_t HalMillis(void)			free running millisecond clock
+//	void HalMicrosInit(void)			starts the microsecond clock
+//	uint32_t HalMicros(void)			free running microsecond clock
+//	HalDelayUs(us), HalDelayMs(ms)		busy-wait, AVR needs constant values
+//	void HalWatchdogReset(void)
+//
+// Board
+//	void HalSetLeds(uint8_t leds)		HAL_LEDS_ALL or HAL_LEDS_NONE
+//	void HalStickTrigger(uint8_t pull)	gameport X1/Y2 lines for the FFP
+//
+// Program memory
+//	PROGMEM, PSTR(), pgm_read_byte(), pgm_read_word()
+//	HalReadPgmPtr(p)					reads a pointer from program memory
+//
+// Critical sections
+//	CRITICAL_VAR(), ENTER_CRITICAL(), EXIT_CRITICAL(), FA_NOINLINE()
+
+#ifdef __AVR__
+#include "hal-avr.h"
+#else
+#include "hal-linux.h"
+#endif
+
+// Sink of the debug log (see FlushDebugBuffer). Takes as much of the data
+// as it can without waiting and returns the number of bytes taken. It sends
+// HAL_LOG_PACKET_SIZE bytes at a time, the debug log holds smaller
+// remainders back for a while. A call with <len> 0 ends the transfer so
+// that the host passes on what it has received.
+uint16_t HalLogWrite(const void *data, uint16_t len);
+
+#endif // _HAL_H_
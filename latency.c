@@ -0,0 +1,280 @@
+/*
+  Force Feedback Joystick
+  Latency of the force feedback reports from the USB endpoint to the MIDI
+  wire, collected as histograms on the device. See latency.h.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+#include "latency.h"
+
+#if LATENCY_PROBES
+
+#include <string.h>
+
+#include "ffb.h"
+#include "debug.h"
+
+// Time to send one MIDI byte at 31250 baud
+#define LATENCY_MIDI_BYTE_US 320
+
+#define LATENCY_RECEIVED	0x01	// came from the endpoint at <receivedUs>
+#define LATENCY_DECODING	0x02	// in FfbOnUsbData()
+#define LATENCY_QUEUED		0x04	// has queued MIDI, the last at <queuedUs>
+
+typedef struct
+	{
+	uint8_t		reportId;	// 0 if free
+	uint8_t		flags;		// LATENCY_xxx
+	uint8_t		queues;		// bit for each MIDI queue still sending the report
+	uint8_t		marks[MIDI_PRIO_COUNT];	// queue tail once the report has been sent
+	uint32_t	receivedUs, decodedUs, queuedUs, sentUs;
+	} TLatencySlot;
+
+static TLatencySlot gLatencySlots[LATENCY_TRACKED];
+static TLatencySlot gLatencySpare;	// for the report being decoded when all slots are in use
+static TLatencySlot *gLatencyDecoding = NULL;
+
+static uint8_t gLatencyReceived = 0;
+static uint32_t gLatencyReceivedUs;
+
+static uint8_t gLatencyBins[OUT_REPORT_COUNT][LATENCY_STAGES][LATENCY_BINS];
+static uint8_t gLatencyShift[OUT_REPORT_COUNT][LATENCY_STAGES];
+static uint16_t gLatencyUntracked = 0;	// reports with MIDI not followed to the wire
+static uint8_t gLatencySelected = 0;	// histogram of the next feature report
+
+static void LatencyRecord(uint8_t reportId, uint8_t stage, uint32_t us)
+	{
+	uint8_t bin = 0;
+	if (us >= LATENCY_BIN0_US)
+		{
+		bin = 1;
+		for (us /= 2 * LATENCY_BIN0_US; us && bin < LATENCY_BINS - 1; us >>= 1)
+			bin++;
+		}
+
+	uint8_t *bins = gLatencyBins[reportId - 1][stage];
+	if (bins[bin] == 0xFF)
+		{	// Halve the histogram keeping its shape
+		for (uint8_t i = 0; i < LATENCY_BINS; i++)
+			bins[i] = (bins[i] + 1) >> 1;
+		gLatencyShift[reportId - 1][stage]++;
+		}
+	bins[bin]++;
+	}
+
+// Records the stages after decoding and frees the slot. Must be called with
+// interrupts disabled.
+static void LatencyFinish(TLatencySlot *slot)
+	{
+	if (slot->flags & LATENCY_QUEUED)
+		LatencyRecord(slot->reportId, LATENCY_STAGE_MIDI, slot->sentUs - slot->queuedUs);
+	if (slot->flags & LATENCY_RECEIVED)
+		LatencyRecord(slot->reportId, LATENCY_STAGE_TOTAL, slot->sentUs - slot->receivedUs);
+	slot->reportId = 0;
+	}
+
+void LatencyInit(void)
+	{
+	memset(gLatencySlots, 0, sizeof(gLatencySlots));
+	gLatencyDecoding = NULL;
+	LatencyClear();
+	}
+
+void LatencyClear(void)
+	{
+	CRITICAL_VAR();
+	ENTER_CRITICAL();
+	memset(gLatencyBins, 0, sizeof(gLatencyBins));
+	memset(gLatencyShift, 0, sizeof(gLatencyShift));
+	gLatencyUntracked = 0;
+	gLatencySelected = 0;
+	EXIT_CRITICAL();
+	}
+
+void LatencyReceived(uint32_t receivedUs)
+	{
+	gLatencyReceivedUs = receivedUs;
+	gLatencyReceived = 1;
+	}
+
+void LatencyDecodeBegin(uint8_t reportId)
+	{
+	TLatencySlot *slot = &gLatencySpare;
+	for (uint8_t i = 0; i < LATENCY_TRACKED; i++)
+		{
+		if (gLatencySlots[i].reportId == 0)
+			{
+			slot = &gLatencySlots[i];
+			break;
+			}
+		}
+
+	slot->flags = LATENCY_DECODING;
+	if (gLatencyReceived)
+		slot->flags |= LATENCY_RECEIVED;
+	gLatencyReceived = 0;
+
+	slot->queues = 0;
+	slot->receivedUs = gLatencyReceivedUs;
+	slot->decodedUs = LatencyNow();
+	slot->reportId = reportId;	// the slot is taken from here on
+	gLatencyDecoding = slot;
+	}
+
+void LatencyDecodeEnd(void)
+	{
+	TLatencySlot *slot = gLatencyDecoding;
+	if (slot == NULL)
+		return;
+	gLatencyDecoding = NULL;
+
+	uint32_t now = LatencyNow();
+
+	CRITICAL_VAR();
+	ENTER_CRITICAL();
+	slot->flags &= ~LATENCY_DECODING;
+
+	if (slot->flags & LATENCY_RECEIVED)
+		LatencyRecord(slot->reportId, LATENCY_STAGE_QUEUE, slot->decodedUs - slot->receivedUs);
+
+	if (!(slot->flags & LATENCY_QUEUED))
+		slot->queuedUs = slot->sentUs = now;	// nothing to send or it was sent already
+	LatencyRecord(slot->reportId, LATENCY_STAGE_DECODE, slot->queuedUs - slot->decodedUs);
+
+	if (slot == &gLatencySpare && (slot->flags & LATENCY_QUEUED))
+		{	// Nobody followed its MIDI
+		gLatencyUntracked++;
+		slot->reportId = 0;
+		}
+	else if (slot->queues == 0)
+		LatencyFinish(slot);
+	EXIT_CRITICAL();
+	}
+
+void LatencyMidiQueued(uint8_t queue, uint8_t head)
+	{
+	TLatencySlot *slot = gLatencyDecoding;
+	if (slot == NULL)
+		return;	// not from a report
+
+	slot->flags |= LATENCY_QUEUED;
+	slot->queues |= 1 << queue;
+	slot->marks[queue] = head;
+	slot->queuedUs = LatencyNow();
+	}
+
+void LatencyMidiSent(uint8_t queue, uint8_t tail)
+	{
+	for (uint8_t i = 0; i < LATENCY_TRACKED; i++)
+		{
+		TLatencySlot *slot = &gLatencySlots[i];
+		if (!(slot->queues & (1 << queue)) || slot->marks[queue] != tail)
+			continue;
+
+		slot->queues &= ~(1 << queue);
+		if (slot->queues)
+			continue;
+
+		// The byte before is still in the shift register
+		slot->sentUs = LatencyNow() + 2 * LATENCY_MIDI_BYTE_US;
+		if (!(slot->flags & LATENCY_DECODING))
+			LatencyFinish(slot);
+		}
+	}
+
+void LatencyMidiDiscarded(void)
+	{
+	CRITICAL_VAR();
+	ENTER_CRITICAL();
+	for (uint8_t i = 0; i < LATENCY_TRACKED; i++)
+		{
+		gLatencySlots[i].queues = 0;
+		if (&gLatencySlots[i] != gLatencyDecoding)
+			gLatencySlots[i].reportId = 0;
+		}
+
+	if (gLatencyDecoding)
+		{	// Timed as if it had no MIDI
+		gLatencyDecoding->flags &= ~LATENCY_QUEUED;
+		gLatencyDecoding->queues = 0;
+		}
+	EXIT_CRITICAL();
+	}
+
+void LatencyGetReport(TLatencyReport *report)
+	{
+	uint8_t type = gLatencySelected / LATENCY_STAGES;
+	uint8_t stage = gLatencySelected % LATENCY_STAGES;
+
+	report->reportId = LATENCY_REPORT_ID;
+	report->type = type + 1;
+	report->stage = stage;
+
+	CRITICAL_VAR();
+	ENTER_CRITICAL();
+	report->shift = gLatencyShift[type][stage];
+	memcpy(report->bins, gLatencyBins[type][stage], LATENCY_BINS);
+	EXIT_CRITICAL();
+
+	if (++gLatencySelected >= OUT_REPORT_COUNT * LATENCY_STAGES)
+		gLatencySelected = 0;
+	}
+
+void LatencySetReport(const TLatencyReport *report)
+	{
+	if (report->type == 0)
+		LatencyClear();
+	else if (report->type <= OUT_REPORT_COUNT && report->stage < LATENCY_STAGES)
+		gLatencySelected = (report->type - 1) * LATENCY_STAGES + report->stage;
+	}
+
+void LatencyDump(void)
+	{
+	LogTextP(PSTR("Latency reports not timed to the wire="));
+	LogBinaryLf(&gLatencyUntracked, sizeof(gLatencyUntracked));
+	DrainDebugBuffer();
+
+	uint8_t selected = gLatencySelected;
+	gLatencySelected = 0;
+
+	for (uint8_t i = 0; i < OUT_REPORT_COUNT * LATENCY_STAGES; i++)
+		{
+		TLatencyReport report;
+		LatencyGetReport(&report);
+
+		uint8_t used = report.shift;
+		for (uint8_t bin = 0; bin < LATENCY_BINS; bin++)
+			used |= report.bins[bin];
+		if (!used)
+			continue;
+
+		LogTextP(PSTR("Lat:"));
+		LogBinaryLf(&report.type, sizeof(report) - 1);
+		DrainDebugBuffer();
+		}
+
+	gLatencySelected = selected;
+	}
+
+#endif // LATENCY_PROBES
@@ -0,0 +1,128 @@
+/*
+  Force Feedback Joystick
+  Latency of the force feedback reports from the USB endpoint to the MIDI
+  wire, collected as histograms on the device.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+#include <stdint.h>
+
+// Each output report is timed with HalMicros() at four probe points:
+//	received	read from the endpoint (HID_Task)
+//	decoded		FfbOnUsbData() starts
+//	queued		the last of its MIDI messages is queued (FfbEndMidi)
+//	sent		the last byte of those messages has left the UART
+// and the times between them go to the histograms of its report id.
+//
+// The last byte is taken to leave the UART two byte times after it was
+// handed over: one for the byte in the shift register, one for itself.
+// Reports without MIDI, and all reports when MIDI_BUFFER_SIZE is 0 (the
+// bytes go out during decoding), end when FfbOnUsbData() returns.
+
+#define LATENCY_STAGE_QUEUE		0	// received .. decoded, waiting in the report queue
+#define LATENCY_STAGE_DECODE	1	// decoded .. queued
+#define LATENCY_STAGE_MIDI		2	// queued .. sent
+#define LATENCY_STAGE_TOTAL		3	// received .. sent
+#define LATENCY_STAGES			4
+
+// Bin 0 counts times below 32 us, bin n times from 16 << n us and the last
+// bin everything from 32768 us (32.8 ms) on
+#define LATENCY_BINS			12
+#define LATENCY_BIN0_US			32
+
+// Reports followed on their way to the wire at the same time. Reports
+// decoded while all are in use are not timed beyond the decode stage.
+#define LATENCY_TRACKED			4
+
+// Vendor defined feature report with one histogram. Reading it returns the
+// selected histogram and selects the next one, so that reading it
+// OUT_REPORT_COUNT * LATENCY_STAGES times returns all of them. Writing it
+// selects the histogram with <type> and <stage>, or clears all of them
+// when <type> is 0.
+#define LATENCY_REPORT_ID		0x10
+
+typedef struct
+	{
+	uint8_t	reportId;	// =LATENCY_REPORT_ID
+	uint8_t	type;		// output report id 1..OUT_REPORT_COUNT
+	uint8_t	stage;		// LATENCY_STAGE_xxx
+	uint8_t	shift;		// the counts are bins[] << shift
+	uint8_t	bins[LATENCY_BINS];
+	} TLatencyReport;
+
+// Define LATENCY_PROBES as 1 to build the probes in. They take about 800
+// bytes of RAM, e.g. with smaller MIDI buffers.
+#ifndef LATENCY_PROBES
+#define LATENCY_PROBES 0
+#endif
+
+#if LATENCY_PROBES
+
+#include "hal.h"
+
+// Clears the histograms
+void LatencyInit(void);
+void LatencyClear(void);
+
+#define LatencyNow()	HalMicros()
+
+// Probe points, see above. <receivedUs> is from LatencyNow() when the report
+// was read from the endpoint. LatencyReceived() is called just before
+// FfbOnUsbData() for reports that came from the endpoint.
+void LatencyReceived(uint32_t receivedUs);
+void LatencyDecodeBegin(uint8_t reportId);
+void LatencyDecodeEnd(void);
+void LatencyMidiQueued(uint8_t queue, uint8_t head);
+void LatencyMidiSent(uint8_t queue, uint8_t tail);
+
+// Forgets the reports on their way to the wire when the MIDI queues are reset
+void LatencyMidiDiscarded(void);
+
+// Fills <report> from the selected histogram and selects the next one
+void LatencyGetReport(TLatencyReport *report);
+void LatencySetReport(const TLatencyReport *report);
+
+// Writes the histograms with counts to the debug log, one per line as
+// "Lat:" followed by the bytes of its report in hex without the report id
+void LatencyDump(void);
+
+#else
+
+#define LatencyInit()
+#define LatencyClear()
+#define LatencyNow()	0
+#define LatencyReceived(receivedUs)
+#define LatencyDecodeBegin(reportId)
+#define LatencyDecodeEnd()
+#define LatencyMidiQueued(queue, head)
+#define LatencyMidiSent(queue, tail)
+#define LatencyMidiDiscarded()
+#define LatencyDump()
+
+#endif // LATENCY_PROBES
+
+#endif // _LATENCY_H_
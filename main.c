@@ -33,6 +33,12 @@
 #include "main.h"
 #include "3DPro.h"
 #include "Joystick.h"
+#include "calibration.h"
+#include "capture.h"
+#include "latency.h"
+#include "trace.h"
+#include "frame.h"
+#include "telemetry.h"
 #include "ffb.h"
 #include "usb_hid.h"
 #include "debug.h"
@@ -40,6 +46,8 @@
 #include "Descriptors.h"
 
 void CDC1_Task(void);
+void Trace_Task(void);
+void Telemetry_Task(void);
 
 /** Contains the current baud rate and other settings of the first virtual serial port. While this demo does not use
  *  the physical USART and thus does not use these settings, they must still be retained and returned to the host
@@ -78,11 +86,16 @@ int main(void)
 			WaitMs(300);
 			}
 
+		Joystick_Task();
 		HID_Task();
+		FFB_Task();
+		FfbMidiTask();
 		FlushDebugBuffer();
 
 		CDC1_Task();
 		FlushDebugBuffer();
+		Trace_Task();
+		Telemetry_Task();
 
 		USB_USBTask();
 		FlushDebugBuffer();
@@ -105,6 +118,8 @@ void SetupHardware(void)
 	// Call the joystick's init and connection methods
 	Joystick_Init();
 
+	LatencyInit();
+
 	USB_Init();
 	}
 
@@ -126,6 +141,12 @@ void EVENT_USB_Device_Disconnect(void)
 	LEDs_SetAllLEDs(LEDS_NO_LEDS);
 }
 
+/** Event handler for the USB_StartOfFrame event, fired every millisecond in interrupt once the device is configured. */
+void EVENT_USB_Device_StartOfFrame(void)
+{
+	Joystick_OnStartOfFrame();
+}
+
 /** Event handler for the USB_ConfigurationChanged event. This is fired when the host set the current configuration
  *  of the USB device after enumeration - the device endpoints are configured and the joystick reporting task started.
  */
@@ -138,17 +159,23 @@ void EVENT_USB_Device_ConfigurationChanged(void)
 	                                            JOYSTICK_EPSIZE, ENDPOINT_BANK_SINGLE);
 
 	ConfigSuccess &= Endpoint_ConfigureEndpoint(FFB_EPNUM, EP_TYPE_INTERRUPT, ENDPOINT_DIR_OUT,
-	                                            FFB_EPSIZE, ENDPOINT_BANK_SINGLE);
+	                                            FFB_EPSIZE, ENDPOINT_BANK_DOUBLE);	// host can send the next packet while we process one
 #ifdef ENABLE_JOYSTICK_SERIAL
 	/* Setup first CDC Interface's Endpoints */
 	ConfigSuccess &= Endpoint_ConfigureEndpoint(CDC1_TX_EPNUM, EP_TYPE_BULK, ENDPOINT_DIR_IN,
-	                                            CDC_TXRX_EPSIZE, ENDPOINT_BANK_SINGLE);
+	                                            CDC_TXRX_EPSIZE, ENDPOINT_BANK_DOUBLE);	// the log can fill one bank while the host reads the other
 	ConfigSuccess &= Endpoint_ConfigureEndpoint(CDC1_RX_EPNUM, EP_TYPE_BULK, ENDPOINT_DIR_OUT,
-	                                            CDC_TXRX_EPSIZE, ENDPOINT_BANK_SINGLE);
+	                                            CDC_TXRX_EPSIZE, ENDPOINT_BANK_DOUBLE);	// streamed command frames
 	ConfigSuccess &= Endpoint_ConfigureEndpoint(CDC1_NOTIFICATION_EPNUM, EP_TYPE_INTERRUPT, ENDPOINT_DIR_IN,
 	                                            CDC_NOTIFICATION_EPSIZE, ENDPOINT_BANK_SINGLE);
 #endif // ENABLE_JOYSTICK_SERIAL
 
+	/* Joystick reads are timed from the start of frame */
+	USB_Device_EnableSOFEvents();
+
+	/* Default idle rate for joysticks is to send only changes, starting with the current state */
+	Joystick_SetIdle(0);
+
 	/* Reset line encoding baud rates so that the host knows to send new values */
 	LineEncoding1.BaudRateBPS = 0;
 
@@ -198,7 +225,7 @@ void EVENT_USB_Device_ControlRequest(void)
 
 		case HID_REQ_GetReport:
 			if (DoDebug(DEBUG_DETAIL))
-				LogTextLf("GetReport");
+				LogTextLfP(PSTR("GetReport"));
 			if (USB_ControlRequest.bmRequestType == (REQDIR_DEVICETOHOST | REQTYPE_CLASS | REQREC_INTERFACE))
 				{
 				LEDs_SetAllLEDs(LEDS_ALL_LEDS);
@@ -220,6 +247,7 @@ void EVENT_USB_Device_ControlRequest(void)
 					{	// Feature 3: PID Pool Feature Report
 					USB_FFBReport_PIDPool_Feature_Data_t featureData;
 					FfbOnPIDPool(&featureData);
+					CaptureRecord(CAPTURE_PID_POOL, &featureData, sizeof(featureData), NULL, 0);
 
 					Endpoint_ClearSETUP();
 
@@ -227,12 +255,26 @@ void EVENT_USB_Device_ControlRequest(void)
 					Endpoint_Write_Control_Stream_LE(&featureData, sizeof(USB_FFBReport_PIDPool_Feature_Data_t));
 					Endpoint_ClearOUT();
 					}
+#if LATENCY_PROBES
+				else if (USB_ControlRequest.wValue == (0x0300 | LATENCY_REPORT_ID))
+					{	// Vendor feature: latency histogram
+					TLatencyReport featureData;
+					LatencyGetReport(&featureData);
+
+					Endpoint_ClearSETUP();
+
+					// Write the report data to the control endpoint
+					Endpoint_Write_Control_Stream_LE(&featureData, sizeof(TLatencyReport));
+					Endpoint_ClearOUT();
+					}
+#endif
 				else
 					{
+					static uint8_t sequence;	// of the last report sent here
 					USB_JoystickReport_Data_t JoystickReportData;
 
-					/* Create the next HID report to send to the host */
-					Joystick_CreateInputReport(USB_ControlRequest.wValue & 0xFF, &JoystickReportData);
+					/* Get the latest HID report without waiting for the joystick */
+					Joystick_GetInputReport(&JoystickReportData, &sequence);
 
 					Endpoint_ClearSETUP();
 
@@ -246,25 +288,50 @@ void EVENT_USB_Device_ControlRequest(void)
 				LEDs_SetAllLEDs(LEDS_NO_LEDS);
 				}
 
+			break;
+		case HID_REQ_SetIdle:
+			if (USB_ControlRequest.bmRequestType == (REQDIR_HOSTTODEVICE | REQTYPE_CLASS | REQREC_INTERFACE))
+				{
+				Endpoint_ClearSETUP();
+				Endpoint_ClearStatusStage();
+
+				// Duration in the upper byte, the report ID in the lower byte can only be ours
+				Joystick_SetIdle(USB_ControlRequest.wValue >> 8);
+				}
+
+			break;
+		case HID_REQ_GetIdle:
+			if (USB_ControlRequest.bmRequestType == (REQDIR_DEVICETOHOST | REQTYPE_CLASS | REQREC_INTERFACE))
+				{
+				Endpoint_ClearSETUP();
+
+				Endpoint_Write_8(Joystick_GetIdle());
+
+				Endpoint_ClearIN();
+				Endpoint_ClearStatusStage();
+				}
+
 			break;
 		case HID_REQ_SetReport:
 			if (DoDebug(DEBUG_DETAIL))
-				LogTextLf("SetReport");
+				LogTextLfP(PSTR("SetReport"));
 
 			if (USB_ControlRequest.bmRequestType == (REQDIR_HOSTTODEVICE | REQTYPE_CLASS | REQREC_INTERFACE))
 				{
+				// None of our feature reports is longer. Leaving the SETUP
+				// uncleared makes LUFA stall the request.
+				uint8_t data[FFB_FEATURE_REPORT_MAX];
+				uint16_t len = USB_ControlRequest.wLength;
+				if (len > sizeof(data))
+					break;
+
 				LEDs_SetAllLEDs(LEDS_ALL_LEDS);
 
 				Endpoint_ClearSETUP();
 
-				uint8_t data[10];	// This is enough room for all reports
-				uint16_t len = 0;	// again, enough for all
-
-				len = USB_ControlRequest.wLength;
-				
-				// Read in the report data from host
-
-				// Read the report data from the control endpoint
+				// Read the report data from the control endpoint, a short
+				// report reads as zeros after its end
+				memset(data, 0, sizeof(data));
 				Endpoint_Read_Control_Stream_LE(&data, len);
 				Endpoint_ClearStatusStage();
 
@@ -274,8 +341,14 @@ void EVENT_USB_Device_ControlRequest(void)
 					_delay_us(500);	// Windows does not like to be answered too quickly
 //					LogData("    => SetReport CreateNewEffect:", USB_ControlRequest.wValue & 0xFF, data, len);
 
+					// Handle the queued reports first, e.g. a Block Free sent before this
+					while (FFB_Task())
+						;
+
 					USB_FFBReport_PIDBlockLoad_Feature_Data_t pidBlockLoadData;
 					FfbOnCreateNewEffect((USB_FFBReport_CreateNewEffect_Feature_Data_t*) data, &pidBlockLoadData);
+					CaptureRecord(CAPTURE_CREATE_EFFECT, data, sizeof(USB_FFBReport_CreateNewEffect_Feature_Data_t),
+						&pidBlockLoadData, sizeof(pidBlockLoadData));
 
 					Endpoint_ClearSETUP();
 
@@ -293,6 +366,12 @@ void EVENT_USB_Device_ControlRequest(void)
 //					LogData("    => SetReport PIDPool:", USB_ControlRequest.wValue & 0xFF, data, len);
 					// ???? What should be returned here?
 					}
+#if LATENCY_PROBES
+				else if (USB_ControlRequest.wValue == (0x0300 | LATENCY_REPORT_ID) && len >= 3)
+					{	// Vendor feature: select a latency histogram or clear them
+					LatencySetReport((TLatencyReport*) data);
+					}
+#endif
 /*				else
 					LogData("    => SetReport data: ", USB_ControlRequest.wValue & 0xFF, data, len);
 */
@@ -351,6 +430,34 @@ void EVENT_USB_Device_ControlRequest(void)
 
 
 
+// FFB OUT reports read from the endpoint, waiting for translation to MIDI
+#define FFB_REPORT_QUEUE_SIZE 4	// power of two
+#define FFB_REPORT_MAX_SIZE 16	// largest of FfbOutReportSize()
+
+typedef struct
+	{
+	uint8_t len;
+	uint8_t data[FFB_REPORT_MAX_SIZE];
+#if LATENCY_PROBES
+	uint32_t receivedUs;	// when its packet was first seen
+#endif
+	} TFfbReport;
+
+static TFfbReport gFfbReports[FFB_REPORT_QUEUE_SIZE];
+static uint8_t gFfbReportHead = 0, gFfbReportTail = 0;
+
+static struct
+	{
+	uint16_t received;	// reports queued
+	uint16_t malformed;	// packets with an unknown or truncated report
+	uint8_t highWater;	// most reports ever waiting in the queue
+	} gFfbReportStats;
+
+#if LATENCY_PROBES
+static uint8_t gFfbPacketTimed = 0;	// the packet in the endpoint bank has a time
+static uint32_t gFfbPacketUs;
+#endif
+
 /** Function to manage HID report generation and transmission to the host. */
 void HID_Task(void)
 	{
@@ -361,13 +468,13 @@ void HID_Task(void)
 	/* Select the Joystick Report Endpoint */
 	Endpoint_SelectEndpoint(JOYSTICK_EPNUM);
 
-	/* Check to see if the host is ready for another packet */
-	if (Endpoint_IsINReady())
-		{
-		USB_JoystickReport_Data_t JoystickReportData;
+	USB_JoystickReport_Data_t JoystickReportData;
 
-		/* Create the next HID report to send to the host */
-		Joystick_CreateInputReport(INPUT_REPORTID_ALL, &JoystickReportData);
+	/* Check to see if the host is ready for another packet. Only fresh reports
+	   that have changed (or are due by the idle rate) are sent so that the one
+	   waiting in the bank is not a frame old. */
+	if (Endpoint_IsINReady() && Joystick_GetChangedInputReport(&JoystickReportData))
+		{
 
 		/* Write Joystick Report Data */
 		Endpoint_Write_Stream_LE(&JoystickReportData, sizeof(USB_JoystickReport_Data_t), NULL);
@@ -381,54 +488,83 @@ void HID_Task(void)
 
 	if (Endpoint_IsOUTReceived())
 		{
-		LEDs_SetAllLEDs(LEDS_ALL_LEDS);
-
-		uint8_t out_ffbdata[64];	// enough for any single OUT-report
-		uint8_t total_bytes_read = 0;
-
-		while (Endpoint_BytesInEndpoint() && total_bytes_read < 64)
+#if LATENCY_PROBES
+		// The reports of a packet may wait in the bank over several passes
+		if (!gFfbPacketTimed)
 			{
-			uint16_t out_wait_report_bytes = 0, out_report_data_read = 0;
+			gFfbPacketUs = LatencyNow();
+			gFfbPacketTimed = 1;
+			}
+#endif
 
-			// Read the reportID from the package to determine amount of data to expect next
-			while (Endpoint_Read_Stream_LE(&out_ffbdata, 1, NULL)
-					 == ENDPOINT_RWSTREAM_IncompleteTransfer)
-				{	// busy loop until the first byte is read out
-				}
+		// Move the reports of the packet to the queue as long as there is room.
+		// The rest stay in the endpoint bank until FFB_Task() has made room.
+		while (Endpoint_BytesInEndpoint())
+			{
+			if (((gFfbReportHead + 1) & (FFB_REPORT_QUEUE_SIZE - 1)) == gFfbReportTail)
+				return;	// Queue full
 
-			total_bytes_read += 1;
+			TFfbReport *report = &gFfbReports[gFfbReportHead];
+			uint8_t reportId = Endpoint_Read_8();
+			uint8_t size = FfbOutReportSize(reportId);
 
-			out_wait_report_bytes = OutReportSize[out_ffbdata[0]-1] - 1;
-			if (out_wait_report_bytes + total_bytes_read >= 64)
-				{
-				while (1)  {
-				LEDs_SetAllLEDs(LEDS_NO_LEDS);
-				_delay_ms(100);
-				LEDs_SetAllLEDs(LEDS_ALL_LEDS);
-				_delay_ms(100); }
-				}
-//			LogTextP(PSTR("Starting to read new report (reportId, bytesToWait)"));
-//			LogBinary(out_ffbdata, 1);
-//			LogBinary((uint8_t*) &out_wait_report_bytes, 2);
-
-			out_report_data_read = 0;
-			while (Endpoint_Read_Stream_LE(&out_ffbdata[1], out_wait_report_bytes, NULL)
-					== ENDPOINT_RWSTREAM_IncompleteTransfer)
-				{	// busy loop until the rest of the report data is read out
+			if (size == 0 || size > FFB_REPORT_MAX_SIZE || size - 1 > Endpoint_BytesInEndpoint())
+				{	// Unknown or truncated report - can't find the following reports either
+				gFfbReportStats.malformed++;
+				break;
 				}
 
-//			LogData("Read OUT data:", out_ffbdata[0], &out_ffbdata[1], out_wait_report_bytes);
-			total_bytes_read += out_wait_report_bytes;
+			report->data[0] = reportId;
+			report->len = size;
+#if LATENCY_PROBES
+			report->receivedUs = gFfbPacketUs;
+#endif
+			Endpoint_Read_Stream_LE(&report->data[1], size - 1, NULL);
+			CaptureRecord(CAPTURE_OUT_REPORT, report->data, size, NULL, 0);
+
+			gFfbReportHead = (gFfbReportHead + 1) & (FFB_REPORT_QUEUE_SIZE - 1);
+			gFfbReportStats.received++;
 
-			FfbOnUsbData(out_ffbdata, out_wait_report_bytes + 1);
-			_delay_ms(1);
+			uint8_t used = (gFfbReportHead - gFfbReportTail) & (FFB_REPORT_QUEUE_SIZE - 1);
+			if (used > gFfbReportStats.highWater)
+				gFfbReportStats.highWater = used;
 			}
 
 		// Clear the endpoint ready for new packet
 		Endpoint_ClearOUT();
+#if LATENCY_PROBES
+		gFfbPacketTimed = 0;
+#endif
 		}
 	}
 
+/** Function to translate the received FFB reports to the joystick. Returns 0 if there was nothing to do. */
+uint8_t FFB_Task(void)
+	{
+	// One report per pass so that the USB tasks keep running in between
+	if (gFfbReportTail == gFfbReportHead)
+		return 0;
+
+	TFfbReport *report = &gFfbReports[gFfbReportTail];
+#if LATENCY_PROBES
+	LatencyReceived(report->receivedUs);
+#endif
+	FfbOnUsbData(report->data, report->len);
+
+	gFfbReportTail = (gFfbReportTail + 1) & (FFB_REPORT_QUEUE_SIZE - 1);
+	return 1;
+	}
+
+void FFB_DebugListStats(void)
+	{
+	LogTextP(PSTR("Usb reports received="));
+	LogBinary(&gFfbReportStats.received, 2);
+	LogTextP(PSTR(", malformed="));
+	LogBinary(&gFfbReportStats.malformed, 2);
+	LogTextP(PSTR(", max queued="));
+	LogBinaryLf(&gFfbReportStats.highWater, 1);
+	}
+
 
 
 // -------------------------------
@@ -446,10 +582,16 @@ void HID_Task(void)
 	parameter data following it. Spaces, tabs, enters and other non-alphanumeric input
 	is ignored.
 	
+	Tools can send the same commands with binary data as CRC checked frames instead,
+	several in a USB packet (see frame.h).
+	
 	Commands:
 		"l"
 			List all effect info from the adapter/joystick. Sends info about each
 			effect index in the device (loaded or free).
+
+		"s"
+			Show adapter statistics, e.g. MIDI transmit buffer usage and overflows.
 			
 		"d" 01 SETTING
 			Disable the given debug setting. Settings are cumulative:
@@ -489,11 +631,19 @@ void HID_Task(void)
 			e.g. "u 02 0D FF" will send bytes "0D FF" as binary to adapter's FFB data
 			processing. This example would trigger DeviceGain-report (id=0x0D) with one
 			byte parameter 0xFF.
+
+		"v" 01 PERIOD or "v" 02 PERIODLOW PERIODHIGH
+			Send a binary telemetry frame of the stick and the forces every PERIOD
+			milliseconds, 0 stops (see telemetry.h).
+			
+			e.g. "v 01 0A" sends one every 10 ms.
 */
 
 
 #if !defined ENABLE_JOYSTICK_SERIAL
 void CDC1_Task(void)  {}
+void Trace_Task(void)  {}
+void Telemetry_Task(void)  {}
 #else
 
 void ProcessDataFromCOMSerial(char data);
@@ -509,26 +659,21 @@ void CDC1_Task(void)
 	/* Select the Serial Rx Endpoint */
 	Endpoint_SelectEndpoint(CDC1_RX_EPNUM);
 
-	char data[128];
-	uint16_t len = 0;
+	char data[CDC_TXRX_EPSIZE];
 
-	/* Throw away any received data from the host */
+	/* Process a packet of received data from the host */
 	if (Endpoint_IsOUTReceived())
 		{
 		LEDs_SetAllLEDs(LEDS_ALL_LEDS);
 
-		while (Endpoint_BytesInEndpoint() && len < 128)
-			{
-			// Read the reportID from the package to determine amount of data to expect next
-			while (Endpoint_Read_Stream_LE(&data[len++], 1, NULL)
-					 == ENDPOINT_RWSTREAM_IncompleteTransfer)
-				{	// busy loop until the first byte is read out
-				}
-			}
-
+		// Take the whole packet and release the bank for the next one
+		uint8_t len = Endpoint_BytesInEndpoint();
+		if (len > sizeof(data))
+			len = sizeof(data);
+		Endpoint_Read_Stream_LE(data, len, NULL);
 		Endpoint_ClearOUT();
 
-		for (uint16_t i = 0; i < len; i++)
+		for (uint8_t i = 0; i < len; i++)
 			{
 			ProcessDataFromCOMSerial(data[i]);
 			}
@@ -537,6 +682,48 @@ void CDC1_Task(void)
 		}
 	}
 
+// Sends the trace records written since the last call (see trace.h) in a
+// short packet if the endpoint is free, never waits for the host
+void Trace_Task(void)
+	{
+#if TRACE_BUFFER_SIZE > 0
+	if (!gTraceOn || USB_DeviceState != DEVICE_STATE_Configured)
+		return;
+
+	Endpoint_SelectEndpoint(CDC1_TX_EPNUM);
+	if (!Endpoint_IsINReady())
+		return;
+
+	uint8_t chunk[CDC_TXRX_EPSIZE - 1];
+	uint8_t len = TraceRead(&chunk[2], sizeof(chunk) - 2);
+	if (len == 0)
+		return;
+
+	chunk[0] = TRACE_CHUNK_MARKER;
+	chunk[1] = len;
+	Endpoint_Write_Stream_LE(chunk, len + 2, NULL);
+	Endpoint_ClearIN();
+#endif
+	}
+
+// Sends a telemetry frame (see telemetry.h) when one is due. The frame takes
+// two packets, it is only written when both banks of the endpoint are free
+// so that nothing else comes in between and nothing waits for the host.
+void Telemetry_Task(void)
+	{
+	if (!TelemetryDue() || USB_DeviceState != DEVICE_STATE_Configured)
+		return;
+
+	Endpoint_SelectEndpoint(CDC1_TX_EPNUM);
+	if (Endpoint_GetBusyBanks() != 0)
+		return;
+
+	TTelemetryFrame frame;
+	TelemetryBuild(&frame);
+	Endpoint_Write_Stream_LE(&frame, sizeof(frame), NULL);
+	Endpoint_ClearIN();
+	}
+
 uint8_t ParseHexNibble(char data)
 	{
 	if (data >= '0' && data <= '9')
@@ -556,17 +743,93 @@ void DoCommandSetEffectType(char effectType, char value);
 void DoCommandSetEffectAtIndex(uint8_t effectIndex, char value);
 void DoCommandSendMidi(uint8_t *data, uint16_t len);
 void DoCommandSimulateUsbReceive(uint8_t *data, uint16_t len);
+void DoCommandSelectProfile(uint8_t profile);
+void DoCommandSetCalibration(uint8_t *data, uint16_t len);
+void DoCommandCapture(uint8_t operation);
+void DoCommandLatency(uint8_t operation);
+void DoCommandTrace(uint8_t operation);
+void DoCommandTelemetry(uint8_t *data, uint16_t len);
 
 void ProcessCommandDataFromCOMSerial(char command, char data);
 
 volatile static uint8_t gOngoingSerialCommandDataLen = 0; // expected length of actual command data
 volatile static char gOngoingSerialCommand = '\0';
 
+// Binary command frames, see frame.h
+static TFrameParser gFrameParser;
+
+void CDC1_DebugListStats(void)
+	{
+	LogTextP(PSTR("Com frames ok="));
+	LogBinary(&gFrameParser.stats.ok, 2);
+	LogTextP(PSTR(", crc errors="));
+	LogBinary(&gFrameParser.stats.crcErrors, 2);
+	LogTextP(PSTR(", too long="));
+	LogBinary(&gFrameParser.stats.tooLong, 2);
+	LogTextP(PSTR(", empty="));
+	LogBinaryLf(&gFrameParser.stats.empty, 2);
+	}
+
+// Runs the commands with no parameters, returns 0 for other commands
+uint8_t DoCommandWithoutData(char command)
+	{
+	if (command == 'l')
+		{
+		DoCommandListEffects();
+		return 1;
+		}
+
+	if (command == 's')
+		{
+		FfbDebugListStats();
+		DrainDebugBuffer();
+		FFB_DebugListStats();
+		Joystick_DebugListStats();
+		CDC1_DebugListStats();
+		return 1;
+		}
+
+	if (command == 'a')
+		{
+		CalDebugListProfile();
+		return 1;
+		}
+
+	return 0;
+	}
+
+void DoCommandWithData(char command, char *data, uint16_t len);
+
+void DoCommandFrame(void)
+	{
+	char command = gFrameParser.command;
+	uint8_t len = gFrameParser.len - 1;
+
+	if (DoCommandWithoutData(command))
+		return;
+
+	if (len == 0)
+		{
+		LogTextLfP(PSTR("Error: command frame without data"));
+		return;
+		}
+
+	DoCommandWithData(command, (char*) gFrameParser.data, len);
+	}
+
 void ProcessDataFromCOMSerial(char data)
 	{
 	volatile static uint8_t gOngoingSerialCommandParameterPos = 0; // how many parameter nibbles have been read
 	volatile static uint8_t gDataByte = 0; // currently parsed data byte cache
 
+	// Binary command frames can come instead of the next command
+	if (FrameBusy(&gFrameParser) || (gOngoingSerialCommand == 0 && data == FRAME_START))
+		{
+		if (FrameParse(&gFrameParser, data) == FRAME_DONE)
+			DoCommandFrame();
+		return;
+		}
+
 	// Check for start of a new command
 	if (gOngoingSerialCommand == 0)
 		{
@@ -578,11 +841,8 @@ void ProcessDataFromCOMSerial(char data)
 		if (data <= 32 || data > 'z') return; // some sanity checking - skip possible garbage or formatting
 
 		// Commands with no parameters can be handled directly here
-		if (data == 'l')
-			{
-			DoCommandListEffects();
+		if (DoCommandWithoutData(data))
 			return;
-			}
 
 		// The command has parameter data - need to parse and collect them nibble by nibble
 		gOngoingSerialCommand = data;
@@ -673,6 +933,11 @@ void CompletedCommandDataFromCOMSerial(char command, char *data, uint16_t len)
 	LogTextP(PSTR(", data="));
 	LogBinaryLf(data, len);
 
+	DoCommandWithData(command, data, len);
+	}
+
+void DoCommandWithData(char command, char *data, uint16_t len)
+	{
 	if (command == 'd' || command == 'D')
 		DoCommandSetDebug(command, data[0]);
 	else if (command == 'm')
@@ -687,6 +952,18 @@ void CompletedCommandDataFromCOMSerial(char command, char *data, uint16_t len)
 		DoCommandSetEffectAtIndex(data[0], 0);
 	else if (command == 'E') // enable effect at index
 		DoCommandSetEffectAtIndex(data[0], 1);
+	else if (command == 'p') // select calibration profile
+		DoCommandSelectProfile(data[0]);
+	else if (command == 'c') // set axis calibration, or reset it with just the axis
+		DoCommandSetCalibration((uint8_t*) data, len);
+	else if (command == 'r') // capture: 0=stop, 1=start, 2=dump
+		DoCommandCapture(data[0]);
+	else if (command == 'h') // latency histograms: 0=dump, 1=clear
+		DoCommandLatency(data[0]);
+	else if (command == 'x') // binary trace: 0=stop, 1=start
+		DoCommandTrace(data[0]);
+	else if (command == 'v') // telemetry period in ms, 0=stop
+		DoCommandTelemetry((uint8_t*) data, len);
 	else
 		{
 		LogTextLfP(PSTR("Error: unknown command"));
@@ -698,7 +975,7 @@ void DoCommandListEffects()
 	LogTextP(PSTR("Effects:\n"));
 	uint8_t i = 0;
 	while (FfbDebugListEffects(&i))
-		FlushDebugBuffer();
+		DrainDebugBuffer();
 
 	if (gDisabledEffects.springs)
 		LogTextP(PSTR(" Springs disabled\n"));
@@ -749,4 +1026,81 @@ void DoCommandSimulateUsbReceive(uint8_t *data, uint16_t len)
 	FfbOnUsbData(data, len);
 	}
 
+void DoCommandSelectProfile(uint8_t profile)
+	{
+	if (!CalSelectProfile(profile))
+		LogTextLfP(PSTR("Error: unknown calibration profile"));
+	}
+
+void DoCommandSetCalibration(uint8_t *data, uint16_t len)
+	{
+	uint8_t ok = 0;
+
+	if (len == 1)
+		ok = CalSetAxis(data[0], NULL);
+	else if (len == 1 + sizeof(TCalAxis))
+		ok = CalSetAxis(data[0], (TCalAxis*) &data[1]);
+
+	if (!ok)
+		LogTextLfP(PSTR("Error: invalid axis calibration"));
+	}
+
+void DoCommandCapture(uint8_t operation)
+	{
+#if CAPTURE_BUFFER_SIZE > 0
+	if (operation == 0)
+		CaptureStop();
+	else if (operation == 1)
+		CaptureStart();
+	else if (operation == 2)
+		CaptureDump();
+	else
+		LogTextLfP(PSTR("Error: unknown capture operation"));
+#else
+	LogTextLfP(PSTR("Error: capture not in the build"));
+#endif
+	}
+
+void DoCommandLatency(uint8_t operation)
+	{
+#if LATENCY_PROBES
+	if (operation == 0)
+		LatencyDump();
+	else if (operation == 1)
+		LatencyClear();
+	else
+		LogTextLfP(PSTR("Error: unknown latency operation"));
+#else
+	LogTextLfP(PSTR("Error: latency probes not in the build"));
+#endif
+	}
+
+void DoCommandTrace(uint8_t operation)
+	{
+#if TRACE_BUFFER_SIZE > 0
+	if (operation == 0)
+		TraceStop();
+	else if (operation == 1)
+		TraceStart();
+	else
+		LogTextLfP(PSTR("Error: unknown trace operation"));
+#else
+	LogTextLfP(PSTR("Error: trace not in the build"));
+#endif
+	}
+
+void DoCommandTelemetry(uint8_t *data, uint16_t len)
+	{
+	if (len > 2)
+		{
+		LogTextLfP(PSTR("Error: telemetry period takes one or two bytes"));
+		return;
+		}
+
+	uint16_t period = data[0];
+	if (len == 2)
+		period |= data[1] << 8;
+	TelemetrySubscribe(period);
+	}
+
 #endif //ENABLE_JOYSTICK_SERIAL
@@ -69,6 +69,8 @@
 	/* Function Prototypes: */
 		void SetupHardware(void);
 		void HID_Task(void);
+		uint8_t FFB_Task(void);
+		void FFB_DebugListStats(void);
 
 		void EVENT_USB_Device_Connect(void);
 		void EVENT_USB_Device_Disconnect(void);
@@ -0,0 +1,55 @@
+/*
+  Force Feedback Joystick
+  Recovery from read errors of the stick in tiers.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#include "recovery.h"
+#include "ffb.h"
+
+static uint8_t gRecoveryErrors = 0;	// consecutive read errors
+
+uint8_t RecoveryReadError(void)
+	{
+	if (gRecoveryErrors < 0xFF)
+		gRecoveryErrors++;
+
+	if (gRecoveryErrors <= SW_RETRIES)
+		return RECOVERY_RETRY;
+	if (gRecoveryErrors <= SW_RETRIES + SW_RESYNCS)
+		return RECOVERY_RESYNC;
+	return RECOVERY_REINIT;
+	}
+
+uint8_t RecoveryReadOk(void)
+	{
+	uint8_t recovered = (gRecoveryErrors != 0);
+	gRecoveryErrors = 0;
+	return recovered;
+	}
+
+void RecoveryReinit(void)
+	{
+	gRecoveryErrors = 0;
+	FfbReinitJoystick();
+	}
@@ -0,0 +1,65 @@
+/*
+  Force Feedback Joystick
+  Recovery from read errors of the stick in tiers.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+
+#ifndef _RECOVERY_H_
+#define _RECOVERY_H_
+
+#include <stdint.h>
+
+// Consecutive read errors of the stick are answered in tiers, keeping USB
+// and the effects of the host alive:
+//  1. read again right away (SW_RETRIES times),
+//  2. let the stick send whatever it has until it goes quiet so that the
+//     next trigger starts a new packet (SW_RESYNCS times),
+//  3. if the stick is still there, set it up again and download the effects
+//     (see FfbReinitJoystick), otherwise keep looking for it.
+// The reading itself is in 3DPro.c, the counting here for the host tests.
+
+#ifndef SW_RETRIES
+#define	SW_RETRIES	3			/* read again right away */
+#endif
+#ifndef SW_RESYNCS
+#define	SW_RESYNCS	3			/* flush the stick's output first */
+#endif
+
+#define RECOVERY_RETRY		0	// read again right away
+#define RECOVERY_RESYNC		1	// flush the stick's output, read again later
+#define RECOVERY_REINIT		2	// set the stick up again if it is there
+
+// Counts a read error and returns the tier of recovery for it (RECOVERY_xxx)
+uint8_t RecoveryReadError(void);
+
+// Counts a good read. Returns true if it ended a run of read errors.
+uint8_t RecoveryReadOk(void);
+
+// Sets the stick found again up with the joystick start-up sequence and
+// the effects of the host, and starts over from the first tier. Returns
+// right away, FfbMidiTask() runs the sequence (see FfbReinitJoystick).
+void RecoveryReinit(void);
+
+#endif // _RECOVERY_H_
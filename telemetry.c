@@ -0,0 +1,94 @@
+/*
+  Force Feedback Joystick
+  Telemetry frames of the stick state and the active forces. See telemetry.h.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+#include "telemetry.h"
+#include "Joystick.h"
+#include "ffb.h"
+#include "hal.h"
+
+#if MAX_EFFECTS > 24
+#error "Effect ids must fit into the 24-bit playing mask of the telemetry frame"
+#endif
+
+static uint16_t gTelemetryPeriod = 0;	// ms, 0 if not subscribed
+static uint16_t gTelemetryLast;	// HalMillis() of the last frame
+
+void TelemetrySubscribe(uint16_t periodMs)
+	{
+	gTelemetryPeriod = periodMs;
+	gTelemetryLast = HalMillis() - periodMs;	// first frame right away
+	}
+
+uint8_t TelemetryDue(void)
+	{
+	return gTelemetryPeriod != 0
+		&& (uint16_t) (HalMillis() - gTelemetryLast) >= gTelemetryPeriod;
+	}
+
+void TelemetryBuild(TTelemetryFrame *frame)
+	{
+	uint16_t now = HalMillis();
+
+	// Keep to the period, but start over rather than catch up after the
+	// host has not been reading
+	if ((uint16_t) (now - gTelemetryLast) >= 2 * gTelemetryPeriod)
+		gTelemetryLast = now;
+	else
+		gTelemetryLast += gTelemetryPeriod;
+
+	USB_JoystickReport_Data_t report;
+	AddedControls_ADC_t adc;
+	Joystick_PeekInputReport(&report);
+	Joystick_GetAddedControls(&adc);
+	uint32_t playing = FfbPlayingEffects();
+
+	frame->marker = TELEMETRY_MARKER;
+	frame->len = TELEMETRY_FRAME_SIZE - 2;
+	frame->timeMs = now;
+
+	frame->x = report.X;
+	frame->y = report.Y;
+	frame->z = report.Z;
+	frame->rz = report.Rz;
+	frame->rx = report.Rx;
+	frame->ry = report.Ry;
+	frame->rudder = report.Rudder;
+	frame->throttle = report.Throttle;
+	frame->buttons = report.Button;
+	frame->hat = report.Hat;
+
+	frame->trim1 = adc.trim1;
+	frame->trim2 = adc.trim2;
+	frame->pedal1 = adc.pedal1;
+	frame->pedal2 = adc.pedal2;
+
+	frame->playing[0] = playing;
+	frame->playing[1] = playing >> 8;
+	frame->playing[2] = playing >> 16;
+	frame->gain = FfbDeviceGain();
+	frame->midiQueued = FfbMidiBufferUsed();
+	}
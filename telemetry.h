@@ -0,0 +1,82 @@
+/*
+  Force Feedback Joystick
+  Telemetry frames of the stick state and the active forces for the virtual
+  serial port.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <stdint.h>
+
+// When subscribed with the 'v' command, the adapter sends a frame of its
+// current state every given number of milliseconds. The frame is built from
+// what the firmware already has: the cached input report (see
+// Joystick_PeekInputReport), the ADC snapshot of the added controls and the
+// effect state of the force feedback core, so it never reads the stick.
+//
+// Over the virtual serial port the frames go between the lines of the text
+// log and the trace chunks (see trace.h) as
+//	TELEMETRY_MARKER, TELEMETRY_FRAME_SIZE - 2, the rest of the frame
+// and they are only written when the endpoint can take the whole frame.
+// The fields follow each other without padding, multibyte values are
+// little endian.
+
+#define TELEMETRY_MARKER		0x01
+#define TELEMETRY_FRAME_SIZE	31
+
+typedef struct
+	{
+	uint8_t		marker;			// TELEMETRY_MARKER
+	uint8_t		len;			// TELEMETRY_FRAME_SIZE - 2
+	uint16_t	timeMs;			// HalMillis() when built
+
+	// Input report as sent to the host, without the report id
+	int16_t		x, y, z;
+	int8_t		rz, rx, ry;
+	uint8_t		rudder, throttle;
+	uint16_t	buttons;
+	uint8_t		hat;
+
+	// Added analog controls, ADC_RESULT_BITS each
+	uint16_t	trim1, trim2, pedal1, pedal2;
+
+	// Force feedback
+	uint8_t		playing[3];		// bit <id>-1 for effect <id>, see FfbPlayingEffects()
+	uint8_t		gain;			// device gain, see FfbDeviceGain()
+	uint8_t		midiQueued;		// bytes waiting for the MIDI line, see FfbMidiBufferUsed()
+	} TTelemetryFrame;
+
+// Sends a frame every <periodMs> milliseconds, 0 stops
+void TelemetrySubscribe(uint16_t periodMs);
+
+// True if the next frame should be sent now
+uint8_t TelemetryDue(void);
+
+// Fills in the next frame. Call when TelemetryDue() and the frame can be
+// sent, the period counts from here.
+void TelemetryBuild(TTelemetryFrame *frame);
+
+#endif // _TELEMETRY_H_
@@ -0,0 +1,162 @@
+/*
+  Force Feedback Joystick
+  Compact binary event trace of the force feedback processing, drained
+  over the virtual serial port while it runs.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+
+#include "trace.h"
+
+#if TRACE_BUFFER_SIZE > 0
+
+#include "hal.h"
+
+#if (TRACE_BUFFER_SIZE & (TRACE_BUFFER_SIZE - 1)) || TRACE_BUFFER_SIZE < 32 || TRACE_BUFFER_SIZE > 256
+#error "TRACE_BUFFER_SIZE must be a power of two from 32 to 256"
+#endif
+
+#define TRACE_MASK ((uint8_t) (TRACE_BUFFER_SIZE - 1))
+
+static uint8_t gTraceBuffer[TRACE_BUFFER_SIZE];
+static volatile uint8_t gTraceHead = 0;	// where the next record goes
+static volatile uint8_t gTraceTail = 0;	// oldest record
+static uint16_t gTraceDropped = 0;	// records dropped since the last one written
+static uint16_t gTraceHigh = 0;	// clock bits 31..16 of the last TRACE_TIME record
+static uint8_t gTraceHighValid = 0;
+uint8_t gTraceOn = 0;
+
+static void TracePut(uint8_t header, uint16_t time, uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+	{
+	uint8_t head = gTraceHead;
+	uint8_t len = TRACE_PAYLOAD_LEN(header);
+
+	gTraceBuffer[head] = header;
+	head = (head + 1) & TRACE_MASK;
+	gTraceBuffer[head] = time;
+	head = (head + 1) & TRACE_MASK;
+	gTraceBuffer[head] = time >> 8;
+	head = (head + 1) & TRACE_MASK;
+	if (len > 0)
+		{
+		gTraceBuffer[head] = a;
+		head = (head + 1) & TRACE_MASK;
+		}
+	if (len > 1)
+		{
+		gTraceBuffer[head] = b;
+		head = (head + 1) & TRACE_MASK;
+		}
+	if (len > 2)
+		{
+		gTraceBuffer[head] = c;
+		head = (head + 1) & TRACE_MASK;
+		}
+	if (len > 3)
+		{
+		gTraceBuffer[head] = d;
+		head = (head + 1) & TRACE_MASK;
+		}
+	gTraceHead = head;
+	}
+
+void TraceStart(void)
+	{
+	CRITICAL_VAR();
+	ENTER_CRITICAL();
+	gTraceHead = gTraceTail = 0;
+	gTraceDropped = 0;
+	gTraceHighValid = 0;
+	gTraceOn = 1;
+	EXIT_CRITICAL();
+	}
+
+void TraceStop(void)
+	{
+	gTraceOn = 0;
+	}
+
+void TraceWrite(uint8_t header, uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+	{
+	CRITICAL_VAR();
+	ENTER_CRITICAL();
+
+	uint32_t now = HalMicros();
+	uint16_t high = now >> 16;
+	uint8_t size = TRACE_RECORD_LEN(header);
+	uint8_t newHigh = !gTraceHighValid || high != gTraceHigh;
+
+	if (newHigh)
+		size += TRACE_RECORD_LEN(TRACE_HEADER(TRACE_TIME, 2));
+	if (gTraceDropped)
+		size += TRACE_RECORD_LEN(TRACE_HEADER(TRACE_DROPPED, 2));
+
+	if (TRACE_MASK - ((gTraceHead - gTraceTail) & TRACE_MASK) < size)
+		{	// Full, keep the older records
+		if (gTraceDropped != 0xFFFF)
+			gTraceDropped++;
+		}
+	else
+		{
+		if (newHigh)
+			{
+			TracePut(TRACE_HEADER(TRACE_TIME, 2), now, high, high >> 8, 0, 0);
+			gTraceHigh = high;
+			gTraceHighValid = 1;
+			}
+		if (gTraceDropped)
+			{
+			TracePut(TRACE_HEADER(TRACE_DROPPED, 2), now, gTraceDropped, gTraceDropped >> 8, 0, 0);
+			gTraceDropped = 0;
+			}
+		TracePut(header, now, a, b, c, d);
+		}
+
+	EXIT_CRITICAL();
+	}
+
+uint8_t TraceRead(uint8_t *buffer, uint8_t size)
+	{
+	// Only the writer moves the head and only the reader the tail
+	uint8_t head = gTraceHead;
+	uint8_t tail = gTraceTail;
+	uint8_t n = 0;
+
+	while (tail != head)
+		{
+		uint8_t len = TRACE_RECORD_LEN(gTraceBuffer[tail]);
+		if (n + len > size)
+			break;
+		while (len--)
+			{
+			buffer[n++] = gTraceBuffer[tail];
+			tail = (tail + 1) & TRACE_MASK;
+			}
+		}
+
+	gTraceTail = tail;
+	return n;
+	}
+
+#endif // TRACE_BUFFER_SIZE
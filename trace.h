@@ -0,0 +1,113 @@
+/*
+  Force Feedback Joystick
+  Compact binary event trace of the force feedback processing, drained
+  over the virtual serial port while it runs.
+
+  Copyright 2012  Tero Loimuneva (tloimu [at] gmail [dot] com)
+  MIT License.
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaim all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+
+// A trace record is a header byte, the low 16 bits of HalMicros() and up
+// to four bytes of payload:
+//	bits 7..5 of the header		payload length 0..4
+//	bits 4..0					event, TRACE_xxx
+// Multibyte values are little endian. A TRACE_TIME record with the high
+// 16 bits of the clock precedes the first record and every record where
+// they have changed, so the decoder gets the full 32 bit time.
+//
+// Over the virtual serial port the records go in chunks of
+//	TRACE_CHUNK_MARKER, length of the records, the records
+// between the lines of the text log, which never contain the marker. A
+// chunk holds whole records and fits into one USB packet.
+
+#define TRACE_CHUNK_MARKER		0x00
+
+#define TRACE_HEADER(event, len)	(((len) << 5) | (event))
+#define TRACE_EVENT(header)			((header) & 0x1F)
+#define TRACE_PAYLOAD_LEN(header)	((header) >> 5)
+#define TRACE_RECORD_LEN(header)	(3 + TRACE_PAYLOAD_LEN(header))
+#define TRACE_PAYLOAD_MAX			4
+
+// Events and their payload
+#define TRACE_TIME				0	// clock bits 31..16 (2 bytes)
+#define TRACE_DROPPED			1	// records dropped before this one as the ring was full (2 bytes)
+#define TRACE_USB_OUT			2	// output report accepted: report id, its next two bytes
+#define TRACE_USB_REJECT		3	// output report rejected: report id, TRACE_REJECT_xxx
+#define TRACE_CREATE_EFFECT		4	// Create New Effect: USB effect type, effect id, load status
+#define TRACE_MIDI				5	// MIDI message queued: priority, effect id, length
+#define TRACE_MIDI_OVERFLOW		6	// MIDI queue full: priority, length of the message
+#define TRACE_DEVICE_CONTROL	7	// control, success
+#define TRACE_DEVICE_GAIN		8	// gain
+#define TRACE_REINIT			9	// joystick initialized again
+#define TRACE_DOWNLOAD			10	// effect downloaded: effect id, joystick's effect id
+#define TRACE_EVICT				11	// effect removed from the joystick to make room: joystick's effect id
+
+#define TRACE_REJECT_UNKNOWN_ID	1
+#define TRACE_REJECT_TRUNCATED	2
+#define TRACE_REJECT_BAD_EFFECT	3
+
+// Size of the ring in RAM in bytes (power of two, 32..256). When it is full
+// the new records are dropped and counted. Define as 0 to leave the trace
+// out. While not started, tracing costs one test per event.
+#ifndef TRACE_BUFFER_SIZE
+#define TRACE_BUFFER_SIZE 64
+#endif
+
+#if TRACE_BUFFER_SIZE > 0
+
+// Clears the ring and starts tracing
+void TraceStart(void);
+void TraceStop(void);
+
+// Adds a record if tracing, use the macros below
+extern uint8_t gTraceOn;
+void TraceWrite(uint8_t header, uint8_t a, uint8_t b, uint8_t c, uint8_t d);
+
+#define Trace0(event)				do { if (gTraceOn) TraceWrite(TRACE_HEADER(event, 0), 0, 0, 0, 0); } while (0)
+#define Trace1(event, a)			do { if (gTraceOn) TraceWrite(TRACE_HEADER(event, 1), a, 0, 0, 0); } while (0)
+#define Trace2(event, a, b)			do { if (gTraceOn) TraceWrite(TRACE_HEADER(event, 2), a, b, 0, 0); } while (0)
+#define Trace3(event, a, b, c)		do { if (gTraceOn) TraceWrite(TRACE_HEADER(event, 3), a, b, c, 0); } while (0)
+#define Trace4(event, a, b, c, d)	do { if (gTraceOn) TraceWrite(TRACE_HEADER(event, 4), a, b, c, d); } while (0)
+
+// Moves whole records, oldest first, to <buffer> up to <size> bytes.
+// Returns the number of bytes moved.
+uint8_t TraceRead(uint8_t *buffer, uint8_t size);
+
+#else
+
+#define TraceStart()
+#define TraceStop()
+#define Trace0(event)
+#define Trace1(event, a)
+#define Trace2(event, a, b)
+#define Trace3(event, a, b, c)
+#define Trace4(event, a, b, c, d)
+#define TraceRead(buffer, size)	0
+
+#endif // TRACE_BUFFER_SIZE
+
+#endif // _TRACE_H_